@@ -0,0 +1,188 @@
+/*
+ *   hash.h - Intrusive hash table implementation
+ *   Copyright (C) 2026 agent <agent@local>
+ *
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _HASH_H_
+#define _HASH_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <private/list.h>
+
+/*
+ * Chained hash table with power of two number of buckets. Nodes are
+ * embedded in the hashed structures and remember their hash value, so
+ * the table can grow without knowing anything about the keys.
+ */
+
+struct hash_node {
+	struct hash_node *next;
+	uint32_t hash;
+};
+
+struct hash_table {
+	struct hash_node **buckets;
+	unsigned int size;
+	unsigned int count;
+};
+
+#define HASH_TABLE_MIN_SIZE 16
+
+static inline uint32_t hash_mix32(uint32_t val)
+{
+	val ^= val >> 16;
+	val *= 0x7feb352d;
+	val ^= val >> 15;
+	val *= 0x846ca68b;
+	val ^= val >> 16;
+	return val;
+}
+
+static inline uint32_t hash_u64(uint64_t val)
+{
+	return hash_mix32((uint32_t) val ^ hash_mix32(val >> 32));
+}
+
+static inline uint32_t hash_ptr(const void *ptr)
+{
+	return hash_u64((uintptr_t) ptr);
+}
+
+static inline uint32_t hash_combine(uint32_t hash, uint32_t val)
+{
+	return hash_mix32(hash ^ (val + 0x9e3779b9 + (hash << 6) + (hash >> 2)));
+}
+
+/* FNV-1a */
+static inline uint32_t hash_str(const char *str)
+{
+	uint32_t hash = 2166136261u;
+
+	while (*str) {
+		hash ^= (unsigned char) *str++;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static inline int hash_table_init(struct hash_table *ht)
+{
+	ht->buckets = calloc(HASH_TABLE_MIN_SIZE, sizeof(*ht->buckets));
+	if (!ht->buckets)
+		return -ENOMEM;
+	ht->size = HASH_TABLE_MIN_SIZE;
+	ht->count = 0;
+	return 0;
+}
+
+static inline void hash_table_fini(struct hash_table *ht)
+{
+	free(ht->buckets);
+	ht->buckets = NULL;
+	ht->size = 0;
+	ht->count = 0;
+}
+
+static inline struct hash_node **hash_table_bucket(struct hash_table *ht,
+						   uint32_t hash)
+{
+	return &ht->buckets[hash & (ht->size - 1)];
+}
+
+static inline void __hash_table_add(struct hash_table *ht,
+				    struct hash_node *node)
+{
+	struct hash_node **bucket = hash_table_bucket(ht, node->hash);
+
+	node->next = *bucket;
+	*bucket = node;
+}
+
+/* Failure to grow is not fatal, table just gets more crowded. */
+static inline void hash_table_grow(struct hash_table *ht)
+{
+	struct hash_node **old_buckets = ht->buckets;
+	unsigned int old_size = ht->size;
+	struct hash_node *node;
+	struct hash_node *next;
+	unsigned int i;
+
+	ht->buckets = calloc(old_size * 2, sizeof(*ht->buckets));
+	if (!ht->buckets) {
+		ht->buckets = old_buckets;
+		return;
+	}
+	ht->size = old_size * 2;
+	for (i = 0; i < old_size; i++) {
+		for (node = old_buckets[i]; node; node = next) {
+			next = node->next;
+			__hash_table_add(ht, node);
+		}
+	}
+	free(old_buckets);
+}
+
+static inline void hash_table_add(struct hash_table *ht,
+				  struct hash_node *node, uint32_t hash)
+{
+	if (ht->count >= ht->size)
+		hash_table_grow(ht);
+	node->hash = hash;
+	__hash_table_add(ht, node);
+	ht->count++;
+}
+
+static inline void hash_table_del(struct hash_table *ht,
+				  struct hash_node *node)
+{
+	struct hash_node **pprev = hash_table_bucket(ht, node->hash);
+
+	for (; *pprev; pprev = &(*pprev)->next) {
+		if (*pprev == node) {
+			*pprev = node->next;
+			ht->count--;
+			return;
+		}
+	}
+}
+
+static inline struct hash_node *hash_table_next(struct hash_node *node,
+						uint32_t hash)
+{
+	for (; node; node = node->next)
+		if (node->hash == hash)
+			return node;
+	return NULL;
+}
+
+#define hash_table_get_entry(node, struct_type, struct_member)		\
+	get_container(node, struct_type, struct_member)
+
+/*
+ * Iterates over all entries with given hash value. Caller has to compare
+ * the keys as different keys may have the same hash.
+ */
+#define hash_table_for_each_possible(entry, node, ht, hash, struct_member)	\
+	for (node = hash_table_next(*hash_table_bucket(ht, hash), hash);	\
+	     node && (entry = hash_table_get_entry(node, typeof(*entry),	\
+						   struct_member), true);	\
+	     node = hash_table_next(node->next, hash))
+
+#endif /* _HASH_H_ */
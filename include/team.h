@@ -43,6 +43,10 @@ int team_destroy(struct team_handle *th);
 int team_init(struct team_handle *th, uint32_t ifindex);
 void team_free(struct team_handle *th);
 int team_refresh(struct team_handle *th);
+void team_set_ifinfo_filter(struct team_handle *th, bool enable);
+void team_get_ifinfo_event_stats(struct team_handle *th,
+				 uint32_t *requery_count,
+				 uint32_t *requery_avoided_count);
 void team_set_log_fn(struct team_handle *th,
 		     void (*log_fn)(struct team_handle *th, int priority,
 				    const char *file, int line, const char *fn,
@@ -213,6 +217,9 @@ int team_set_option_value_bool(struct team_handle *th,
 			       struct team_option *option, bool val);
 int team_set_option_value_s32(struct team_handle *th,
 			      struct team_option *option, int32_t val);
+int team_option_batch_begin(struct team_handle *th);
+int team_option_batch_commit(struct team_handle *th);
+void team_option_batch_abort(struct team_handle *th);
 
 /*
  * team_change_handler
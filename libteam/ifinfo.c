@@ -250,12 +250,27 @@ void ifinfo_destroy_removed(struct team_handle *th)
 	}
 }
 
+/* Link event carries the same attributes as RTM_GETLINK reply, so it is
+ * only needed to ask kernel again in case something we rely on is missing.
+ */
+static bool ifinfo_link_is_complete(struct team_ifinfo *ifinfo,
+				    struct rtnl_link *link)
+{
+	if (!rtnl_link_get_name(link))
+		return false;
+	/* Only devices without hardware address do not have IFLA_ADDRESS */
+	if (!rtnl_link_get_addr(link) && ifinfo->hwaddr_len)
+		return false;
+	return true;
+}
+
 static void obj_input_newlink(struct nl_object *obj, void *arg, bool event)
 {
 	struct team_handle *th = arg;
 	struct rtnl_link *link;
 	struct team_ifinfo *ifinfo;
 	uint32_t ifindex;
+	bool requery;
 	int err;
 
 	ifinfo_destroy_removed(th);
@@ -267,16 +282,20 @@ static void obj_input_newlink(struct nl_object *obj, void *arg, bool event)
 	if (!ifinfo)
 		return;
 
-	if (event) {
+	requery = event && !ifinfo_link_is_complete(ifinfo, link);
+	if (requery) {
+		th->ifinfo_stats.requery_count++;
 		err = rtnl_link_get_kernel(th->nl_cli.sock, ifindex, NULL, &link);
 		if (err)
 			return;
+	} else if (event) {
+		th->ifinfo_stats.requery_avoided_count++;
 	}
 
 	clear_changed(ifinfo);
 	ifinfo_update(ifinfo, link);
 
-	if (event)
+	if (requery)
 		rtnl_link_put(link);
 
 	if (ifinfo->changed || !event)
@@ -320,10 +339,54 @@ static void event_handler_obj_input_dellink(struct nl_object *obj, void *arg)
 	set_call_change_handlers(th, TEAM_IFINFO_CHANGE);
 }
 
+static uint32_t ifinfo_msg_master_ifindex(struct nlmsghdr *nlh)
+{
+	struct nlattr *attr;
+
+	attr = nlmsg_find_attr(nlh, sizeof(struct ifinfomsg), IFLA_MASTER);
+	return attr ? nla_get_u32(attr) : 0;
+}
+
+/* In filtered mode, only team device itself and its ports are interesting.
+ * Check that directly on the message so the unrelated ones are not even
+ * parsed into rtnl_link objects.
+ */
+static bool ifinfo_msg_is_relevant(struct team_handle *th,
+				   struct nlmsghdr *nlh, bool event)
+{
+	struct ifinfomsg *ifi;
+
+	if (!th->ifinfo_filter)
+		return true;
+	/* Let the parser complain about malformed messages */
+	if (!nlmsg_valid_hdr(nlh, sizeof(*ifi)))
+		return true;
+	ifi = nlmsg_data(nlh);
+	if (ifi->ifi_index == th->ifindex)
+		return true;
+	/* Events for already tracked interfaces are needed as well,
+	 * for example to see the port being released.
+	 */
+	if (event && ifinfo_find(th, ifi->ifi_index))
+		return true;
+	return nlh->nlmsg_type == RTM_NEWLINK &&
+	       ifinfo_msg_master_ifindex(nlh) == th->ifindex;
+}
+
 int ifinfo_event_handler(struct nl_msg *msg, void *arg)
 {
 	struct team_handle *th = arg;
 
+	switch (nlmsg_hdr(msg)->nlmsg_type) {
+	case RTM_NEWLINK:
+	case RTM_DELLINK:
+		if (!ifinfo_msg_is_relevant(th, nlmsg_hdr(msg), true))
+			return NL_STOP;
+		break;
+	default:
+		return NL_OK;
+	}
+
 	switch (nlmsg_hdr(msg)->nlmsg_type) {
 	case RTM_NEWLINK:
 		if (nl_msg_parse(msg, &event_handler_obj_input_newlink, th) < 0)
@@ -357,18 +420,78 @@ static int valid_handler(struct nl_msg *msg, void *arg)
 	if (nlmsg_hdr(msg)->nlmsg_type != RTM_NEWLINK)
 		return NL_OK;
 
+	if (!ifinfo_msg_is_relevant(th, nlmsg_hdr(msg), false))
+		return NL_OK;
+
 	if (nl_msg_parse(msg, &valid_handler_obj_input_newlink, th) < 0)
 		err(th, "Unknown message type.");
 	return NL_OK;
 }
 
-int get_ifinfo_list(struct team_handle *th)
+static int ifinfo_update_by_ifindex(struct team_handle *th, uint32_t ifindex,
+				    struct team_ifinfo **p_ifinfo)
 {
-	struct nl_cb *cb;
-	struct nl_cb *orig_cb;
+	struct rtnl_link *link;
+	struct team_ifinfo *ifinfo;
+	int err;
+
+	err = rtnl_link_get_kernel(th->nl_cli.sock, ifindex, NULL, &link);
+	if (err)
+		return -nl2syserr(err);
+
+	ifinfo = ifinfo_find_create(th, ifindex);
+	if (!ifinfo) {
+		rtnl_link_put(link);
+		return -ENOMEM;
+	}
+	clear_changed(ifinfo);
+	ifinfo_update(ifinfo, link);
+	rtnl_link_put(link);
+
+	set_call_change_handlers(th, TEAM_IFINFO_CHANGE);
+	if (p_ifinfo)
+		*p_ifinfo = ifinfo;
+	return 0;
+}
+
+static int send_ifinfo_dump_request(struct team_handle *th)
+{
+	struct ifinfomsg ifi = {
+		.ifi_family = AF_UNSPEC,
+	};
 	struct rtgenmsg rt_hdr = {
 		.rtgen_family = AF_UNSPEC,
 	};
+	struct nl_msg *msg;
+	int err;
+
+	if (!th->ifinfo_filter)
+		return nl_send_simple(th->nl_cli.sock, RTM_GETLINK, NLM_F_DUMP,
+				      &rt_hdr, sizeof(rt_hdr));
+
+	/* Let kernel dump only devices enslaved to team device. Older
+	 * kernels ignore IFLA_MASTER in dump request, valid handler
+	 * filters the messages in that case.
+	 */
+	msg = nlmsg_alloc_simple(RTM_GETLINK, NLM_F_DUMP);
+	if (!msg)
+		return -NLE_NOMEM;
+	err = nlmsg_append(msg, &ifi, sizeof(ifi), NLMSG_ALIGNTO);
+	if (err < 0)
+		goto free_msg;
+	err = nla_put_u32(msg, IFLA_MASTER, th->ifindex);
+	if (err < 0)
+		goto free_msg;
+	err = nl_send_auto(th->nl_cli.sock, msg);
+free_msg:
+	nlmsg_free(msg);
+	return err;
+}
+
+int get_ifinfo_list(struct team_handle *th)
+{
+	struct nl_cb *cb;
+	struct nl_cb *orig_cb;
 	int ret;
 	int retry = 1;
 	struct team_ifinfo *ifinfo;
@@ -382,10 +505,9 @@ int get_ifinfo_list(struct team_handle *th)
 
 	while (retry) {
 		retry = 0;
-		ret = nl_send_simple(th->nl_cli.sock, RTM_GETLINK, NLM_F_DUMP,
-				     &rt_hdr, sizeof(rt_hdr));
+		ret = send_ifinfo_dump_request(th);
 		if (ret < 0) {
-			err(th, "get_ifinfo_list: nl_send_simple failed");
+			err(th, "get_ifinfo_list: failed to send dump request");
 			return -nl2syserr(ret);
 		}
 		orig_cb = nl_socket_get_cb(th->nl_cli.sock);
@@ -408,6 +530,17 @@ int get_ifinfo_list(struct team_handle *th)
 		}
 	}
 
+	/* Team device is not enslaved to itself so it is not part
+	 * of the filtered dump. Get it separately.
+	 */
+	if (th->ifinfo_filter) {
+		ret = ifinfo_update_by_ifindex(th, th->ifindex, NULL);
+		if (ret && ret != -ENOENT && ret != -ENODEV) {
+			err(th, "get_ifinfo_list: failed to get team device");
+			return ret;
+		}
+	}
+
 	list_for_each_node_entry(ifinfo, &th->ifinfo_list, list) {
 		if (is_changed(ifinfo, CHANGED_REFRESHING)) {
 			clear_changed(ifinfo);
@@ -452,10 +585,17 @@ int ifinfo_link_with_port(struct team_handle *th, uint32_t ifindex,
 			  struct team_port *port, struct team_ifinfo **p_ifinfo)
 {
 	struct team_ifinfo *ifinfo;
+	int err;
 
 	ifinfo = ifinfo_find(th, ifindex);
-	if (!ifinfo)
-		return -ENOENT;
+	if (!ifinfo) {
+		if (!th->ifinfo_filter)
+			return -ENOENT;
+		/* Port might have been added before its link event came */
+		err = ifinfo_update_by_ifindex(th, ifindex, &ifinfo);
+		if (err)
+			return err;
+	}
 	if (ifinfo->linked)
 		return -EBUSY;
 	ifinfo->port = port;
@@ -499,6 +639,26 @@ struct team_ifinfo *team_get_next_ifinfo(struct team_handle *th,
 	return NULL;
 }
 
+/**
+ * @param th			libteam library context
+ * @param requery_count		where the count of link events which needed
+ *				to be re-queried from kernel will be stored
+ * @param requery_avoided_count	where the count of link events processed
+ *				directly from event payload will be stored
+ *
+ * @details Get link event processing statistics.
+ **/
+TEAM_EXPORT
+void team_get_ifinfo_event_stats(struct team_handle *th,
+				 uint32_t *requery_count,
+				 uint32_t *requery_avoided_count)
+{
+	if (requery_count)
+		*requery_count = th->ifinfo_stats.requery_count;
+	if (requery_avoided_count)
+		*requery_avoided_count = th->ifinfo_stats.requery_avoided_count;
+}
+
 /**
  * @param ifinfo	ifinfo structure
  *
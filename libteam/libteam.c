@@ -748,6 +748,23 @@ int team_refresh(struct team_handle *th)
 	return 0;
 }
 
+/**
+ * @param th		libteam library context
+ * @param enable	true to track only team device and its ports
+ *
+ * @details By default, interface information is kept for every link in
+ *	    the system. With filter enabled, only the team device and
+ *	    devices enslaved to it are dumped and tracked and link events
+ *	    of unrelated interfaces are dropped right away. Ifinfo for port
+ *	    devices is then fetched on demand. Should be called before
+ *	    team_init().
+ **/
+TEAM_EXPORT
+void team_set_ifinfo_filter(struct team_handle *th, bool enable)
+{
+	th->ifinfo_filter = enable;
+}
+
 /**
  * @param th		libteam library context
  * @param log_fn	function to be called for logging messages
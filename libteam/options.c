@@ -45,6 +45,7 @@
 #include <team.h>
 #include <private/list.h>
 #include <private/misc.h>
+#include <private/hash.h>
 #include "team_private.h"
 #include "nl_updates.h"
 
@@ -58,8 +59,20 @@ struct team_option_id {
 	bool			array_index_used;
 };
 
+/*
+ * Option names are interned. Array options have many items sharing the
+ * same name so this saves memory and allows to compare names by pointer.
+ */
+struct option_name {
+	struct hash_node	node;
+	unsigned int		refcount;
+	char *			name;
+};
+
 struct team_option {
 	struct list_item	list;
+	struct hash_node	node;
+	struct option_name *	iname;
 	bool			initialized;
 	enum team_option_type	type;
 	struct team_option_id	id;
@@ -70,10 +83,71 @@ struct team_option {
 	bool			temporary;
 };
 
-static void destroy_option(struct team_option *option)
+static struct option_name *option_name_find(struct team_handle *th,
+					     const char *name, uint32_t hash)
+{
+	struct option_name *iname;
+	struct hash_node *hnode;
+
+	hash_table_for_each_possible(iname, hnode, &th->option_name_table,
+				     hash, node) {
+		if (!strcmp(iname->name, name))
+			return iname;
+	}
+	return NULL;
+}
+
+static struct option_name *option_name_get(struct team_handle *th,
+					   const char *name)
+{
+	struct option_name *iname;
+	uint32_t hash = hash_str(name);
+
+	iname = option_name_find(th, name, hash);
+	if (iname) {
+		iname->refcount++;
+		return iname;
+	}
+	iname = myzalloc(sizeof(*iname));
+	if (!iname)
+		return NULL;
+	iname->name = strdup(name);
+	if (!iname->name) {
+		free(iname);
+		return NULL;
+	}
+	iname->refcount = 1;
+	hash_table_add(&th->option_name_table, &iname->node, hash);
+	return iname;
+}
+
+static void option_name_put(struct team_handle *th,
+			    struct option_name *iname)
+{
+	if (--iname->refcount)
+		return;
+	hash_table_del(&th->option_name_table, &iname->node);
+	free(iname->name);
+	free(iname);
+}
+
+static uint32_t option_hash(struct option_name *iname,
+			    struct team_option_id *opt_id)
+{
+	uint32_t hash = hash_ptr(iname);
+
+	if (opt_id->port_ifindex_used)
+		hash = hash_combine(hash, opt_id->port_ifindex);
+	if (opt_id->array_index_used)
+		hash = hash_combine(hash, opt_id->array_index + 1);
+	return hash;
+}
+
+static void destroy_option(struct team_handle *th, struct team_option *option)
 {
 	list_del(&option->list);
-	free(option->id.name);
+	hash_table_del(&th->option_table, &option->node);
+	option_name_put(th, option->iname);
 	free(option->data);
 	free(option);
 }
@@ -83,7 +157,7 @@ static void flush_option_list(struct team_handle *th)
 	struct team_option *option, *tmp;
 
 	list_for_each_node_entry_safe(option, tmp, &th->option_list, list)
-		destroy_option(option);
+		destroy_option(th, option);
 }
 
 static void option_list_cleanup_last_state(struct team_handle *th)
@@ -93,7 +167,7 @@ static void option_list_cleanup_last_state(struct team_handle *th)
 	list_for_each_node_entry_safe(option, tmp, &th->option_list, list) {
 		option->changed = false;
 		if (option->temporary)
-			destroy_option(option);
+			destroy_option(th, option);
 	}
 }
 
@@ -101,9 +175,17 @@ static struct team_option *do_find_option(struct team_handle *th,
 					  struct team_option_id *opt_id)
 {
 	struct team_option *option;
+	struct option_name *iname;
+	struct hash_node *hnode;
+	uint32_t hash;
 
-	list_for_each_node_entry(option, &th->option_list, list) {
-		if (strcmp(option->id.name, opt_id->name))
+	iname = option_name_find(th, opt_id->name, hash_str(opt_id->name));
+	if (!iname)
+		return NULL;
+	hash = option_hash(iname, opt_id);
+	hash_table_for_each_possible(option, hnode, &th->option_table,
+				     hash, node) {
+		if (option->iname != iname)
 			continue;
 		if (option->id.port_ifindex_used != opt_id->port_ifindex_used)
 			continue;
@@ -149,17 +231,20 @@ static int create_option(struct team_handle *th, struct team_option **poption,
 	if (!option)
 		return -ENOMEM;
 
-	option->id.name = strdup(opt_id->name);
-	if (!option->id.name) {
+	option->iname = option_name_get(th, opt_id->name);
+	if (!option->iname) {
 		err = -ENOMEM;
 		goto err_alloc_name;
 	}
+	option->id.name = option->iname->name;
 	option->id.port_ifindex = opt_id->port_ifindex;
 	option->id.port_ifindex_used = opt_id->port_ifindex_used;
 	option->id.array_index = opt_id->array_index;
 	option->id.array_index_used = opt_id->array_index_used;
 
 	list_add(&th->option_list, &option->list);
+	hash_table_add(&th->option_table, &option->node,
+		       option_hash(option->iname, &option->id));
 
 	*poption = option;
 	return 0;
@@ -221,7 +306,7 @@ static int update_option(struct team_handle *th, struct team_option **poption,
 			       changed, changed_locally);
 	if (err) {
 		if (option_created)
-			destroy_option(option);
+			destroy_option(th, option);
 		return err;
 	}
 	*poption = option;
@@ -339,7 +424,7 @@ int get_options_handler(struct nl_msg *msg, void *arg)
 			continue;
 		}
 		if (option_attrs[TEAM_ATTR_OPTION_REMOVED])
-			destroy_option(option);
+			destroy_option(th, option);
 	}
 
 	set_call_change_handlers(th, TEAM_OPTION_CHANGE);
@@ -373,8 +458,18 @@ nla_put_failure:
 
 int option_list_alloc(struct team_handle *th)
 {
-	list_init(&th->option_list);
+	int err;
 
+	list_init(&th->option_list);
+	list_init(&th->option_batch.item_list);
+	err = hash_table_init(&th->option_table);
+	if (err)
+		return err;
+	err = hash_table_init(&th->option_name_table);
+	if (err) {
+		hash_table_fini(&th->option_table);
+		return err;
+	}
 	return 0;
 }
 
@@ -390,9 +485,14 @@ int option_list_init(struct team_handle *th)
 	return 0;
 }
 
+static void option_batch_reset(struct team_handle *th);
+
 void option_list_free(struct team_handle *th)
 {
+	option_batch_reset(th);
 	flush_option_list(th);
+	hash_table_fini(&th->option_table);
+	hash_table_fini(&th->option_name_table);
 }
 
 static struct team_option *find_option(struct team_handle *th,
@@ -688,57 +788,50 @@ static int local_set_option_value(struct team_handle *th,
 	err = update_option(th, &option, opt_id, opt_type,
 			    data, data_len, true, true);
 	if (option->temporary)
-		destroy_option(option);
+		destroy_option(th, option);
 	if (err)
 		return err;
 	return 0;
 }
 
-static int set_option_value(struct team_handle *th, struct team_option *option,
-			    const void *data, int data_len, int opt_type)
+static int get_option_nla_type(int opt_type)
 {
-	struct nl_msg *msg;
-	struct nlattr *option_list;
-	struct nlattr *option_item;
-	int nla_type;
-	int err;
-
-	if (option->initialized && option->type != opt_type)
-		return -EINVAL;
-
 	switch (opt_type) {
 	case TEAM_OPTION_TYPE_U32:
-		nla_type = NLA_U32;
-		break;
+		return NLA_U32;
 	case TEAM_OPTION_TYPE_STRING:
-		nla_type = NLA_STRING;
-		break;
+		return NLA_STRING;
 	case TEAM_OPTION_TYPE_BINARY:
-		nla_type = NLA_BINARY;
-		break;
+		return NLA_BINARY;
 	case TEAM_OPTION_TYPE_BOOL:
-		nla_type = NLA_FLAG;
-		break;
+		return NLA_FLAG;
 	case TEAM_OPTION_TYPE_S32:
-		nla_type = NLA_S32;
-		break;
+		return NLA_S32;
 	default:
 		return -EINVAL;
 	}
+}
 
-	msg = nlmsg_alloc();
-	if (!msg)
-		return -ENOMEM;
-
+static struct nlattr *option_list_msg_start(struct team_handle *th,
+					    struct nl_msg *msg)
+{
 	genlmsg_put(msg, NL_AUTO_PID, th->nl_sock_seq, th->family, 0, 0,
 		    TEAM_CMD_OPTIONS_SET, 0);
 	NLA_PUT_U32(msg, TEAM_ATTR_TEAM_IFINDEX, th->ifindex);
-	option_list = nla_nest_start(msg, TEAM_ATTR_LIST_OPTION);
-	if (!option_list)
-		goto nla_put_failure;
+	return nla_nest_start(msg, TEAM_ATTR_LIST_OPTION);
+
+nla_put_failure:
+	return NULL;
+}
+
+static int option_item_put(struct nl_msg *msg, struct team_option *option,
+			   const void *data, int data_len, int nla_type)
+{
+	struct nlattr *option_item;
+
 	option_item = nla_nest_start(msg, TEAM_ATTR_ITEM_OPTION);
 	if (!option_item)
-		goto nla_put_failure;
+		return -ENOBUFS;
 	NLA_PUT_STRING(msg, TEAM_ATTR_OPTION_NAME, option->id.name);
 	if (option->id.port_ifindex_used)
 		NLA_PUT_U32(msg, TEAM_ATTR_OPTION_PORT_IFINDEX,
@@ -768,6 +861,169 @@ static int set_option_value(struct team_handle *th, struct team_option *option,
 			goto nla_put_failure;
 	}
 	nla_nest_end(msg, option_item);
+	return 0;
+
+nla_put_failure:
+	nla_nest_cancel(msg, option_item);
+	return -ENOBUFS;
+}
+
+/*
+ * Local option cache update postponed until the batch is acked by kernel.
+ */
+struct option_batch_item {
+	struct list_item	list;
+	struct team_option_id	id;
+	int			opt_type;
+	void *			data;
+	int			data_len;
+};
+
+static void option_batch_item_destroy(struct option_batch_item *item)
+{
+	list_del(&item->list);
+	free(item->id.name);
+	free(item->data);
+	free(item);
+}
+
+static int option_batch_item_add(struct team_handle *th,
+				 struct team_option *option, int opt_type,
+				 const void *data, int data_len)
+{
+	struct option_batch_item *item;
+	int data_size;
+
+	data_size = get_option_data_size_by_type(opt_type, data, data_len);
+	if (data_size < 0)
+		return data_size;
+	item = myzalloc(sizeof(*item));
+	if (!item)
+		return -ENOMEM;
+	item->id = option->id;
+	item->id.name = strdup(option->id.name);
+	if (!item->id.name)
+		goto err_alloc_name;
+	item->data = malloc(data_size);
+	if (!item->data)
+		goto err_alloc_data;
+	memcpy(item->data, data, data_size);
+	item->data_len = data_len;
+	item->opt_type = opt_type;
+	list_add_tail(&th->option_batch.item_list, &item->list);
+	return 0;
+
+err_alloc_data:
+	free(item->id.name);
+err_alloc_name:
+	free(item);
+	return -ENOMEM;
+}
+
+static void option_batch_reset(struct team_handle *th)
+{
+	struct option_batch_item *item, *tmp;
+
+	list_for_each_node_entry_safe(item, tmp, &th->option_batch.item_list,
+				      list)
+		option_batch_item_destroy(item);
+	if (th->option_batch.msg)
+		nlmsg_free(th->option_batch.msg);
+	th->option_batch.msg = NULL;
+	th->option_batch.option_list = NULL;
+}
+
+static int option_batch_flush(struct team_handle *th)
+{
+	struct option_batch_item *item, *tmp;
+	struct nl_msg *msg = th->option_batch.msg;
+	int err;
+
+	if (!msg)
+		return 0;
+	nla_nest_end(msg, th->option_batch.option_list);
+	th->option_batch.msg = NULL;
+	th->option_batch.option_list = NULL;
+	err = send_and_recv(th, msg, NULL, NULL);
+	if (err) {
+		option_batch_reset(th);
+		return err;
+	}
+	list_for_each_node_entry_safe(item, tmp, &th->option_batch.item_list,
+				      list) {
+		if (!err)
+			err = local_set_option_value(th, &item->id,
+						     item->opt_type,
+						     item->data,
+						     item->data_len);
+		option_batch_item_destroy(item);
+	}
+	return err;
+}
+
+#define OPTION_BATCH_MSG_SIZE 32768
+
+static int option_batch_add(struct team_handle *th, struct team_option *option,
+			    const void *data, int data_len, int opt_type,
+			    int nla_type)
+{
+	int err;
+
+	if (!th->option_batch.msg) {
+		th->option_batch.msg = nlmsg_alloc_size(OPTION_BATCH_MSG_SIZE);
+		if (!th->option_batch.msg)
+			return -ENOMEM;
+		th->option_batch.option_list =
+			option_list_msg_start(th, th->option_batch.msg);
+		if (!th->option_batch.option_list) {
+			option_batch_reset(th);
+			return -ENOBUFS;
+		}
+	}
+	err = option_item_put(th->option_batch.msg, option, data, data_len,
+			      nla_type);
+	if (err == -ENOBUFS && !list_empty(&th->option_batch.item_list)) {
+		/* Message is full, send what we have so far and retry. */
+		err = option_batch_flush(th);
+		if (err)
+			return err;
+		return option_batch_add(th, option, data, data_len, opt_type,
+					nla_type);
+	}
+	if (err)
+		return err;
+	return option_batch_item_add(th, option, opt_type, data, data_len);
+}
+
+static int set_option_value(struct team_handle *th, struct team_option *option,
+			    const void *data, int data_len, int opt_type)
+{
+	struct nl_msg *msg;
+	struct nlattr *option_list;
+	int nla_type;
+	int err;
+
+	if (option->initialized && option->type != opt_type)
+		return -EINVAL;
+
+	nla_type = get_option_nla_type(opt_type);
+	if (nla_type < 0)
+		return nla_type;
+
+	if (th->option_batch.active)
+		return option_batch_add(th, option, data, data_len, opt_type,
+					nla_type);
+
+	msg = nlmsg_alloc();
+	if (!msg)
+		return -ENOMEM;
+
+	option_list = option_list_msg_start(th, msg);
+	if (!option_list)
+		goto nla_put_failure;
+	err = option_item_put(msg, option, data, data_len, nla_type);
+	if (err)
+		goto nla_put_failure;
 	nla_nest_end(msg, option_list);
 
 	err = send_and_recv(th, msg, NULL, NULL);
@@ -784,6 +1040,62 @@ nla_put_failure:
 	return -ENOBUFS;
 }
 
+/* \endcond */
+
+/**
+ * @param th		libteam library context
+ *
+ * @details Start batching option value changes. Values passed to
+ *	    team_set_option_value_* functions after this call are not sent
+ *	    to kernel one by one but queued and sent together in a single
+ *	    message by team_option_batch_commit(). Local option values are
+ *	    updated only after kernel acknowledges the changes.
+ *
+ * @return Zero on success or negative number in case of an error.
+ **/
+TEAM_EXPORT
+int team_option_batch_begin(struct team_handle *th)
+{
+	if (th->option_batch.active)
+		return -EBUSY;
+	th->option_batch.active = true;
+	return 0;
+}
+
+/**
+ * @param th		libteam library context
+ *
+ * @details Send option value changes queued since team_option_batch_begin()
+ *	    to kernel and end batching. In case the changes do not fit
+ *	    into one message, they are sent in several messages.
+ *
+ * @return Zero on success or negative number in case of an error.
+ **/
+TEAM_EXPORT
+int team_option_batch_commit(struct team_handle *th)
+{
+	int err;
+
+	if (!th->option_batch.active)
+		return -EINVAL;
+	err = option_batch_flush(th);
+	th->option_batch.active = false;
+	return err;
+}
+
+/**
+ * @param th		libteam library context
+ *
+ * @details Drop option value changes queued since team_option_batch_begin()
+ *	    and end batching.
+ **/
+TEAM_EXPORT
+void team_option_batch_abort(struct team_handle *th)
+{
+	option_batch_reset(th);
+	th->option_batch.active = false;
+}
+
 /**
  * @param th		libteam library context
  * @param option	option structure
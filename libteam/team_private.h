@@ -25,6 +25,7 @@
 #include <netlink/netlink.h>
 #include <team.h>
 #include <private/list.h>
+#include <private/hash.h>
 
 #include "config.h"
 
@@ -44,9 +45,22 @@ struct team_handle {
 	int			family;
 	uint32_t		ifindex;
 	struct team_ifinfo *	ifinfo;
+	bool			ifinfo_filter;
+	struct {
+		uint32_t		requery_count;
+		uint32_t		requery_avoided_count;
+	} ifinfo_stats;
 	struct list_item	port_list;
 	struct list_item	ifinfo_list;
 	struct list_item	option_list;
+	struct hash_table	option_table;
+	struct hash_table	option_name_table;
+	struct {
+		bool			active;
+		struct nl_msg *		msg;
+		struct nlattr *		option_list;
+		struct list_item	item_list;
+	} option_batch;
 	struct {
 		struct list_item		list;
 		team_change_type_mask_t		pending_type_mask;
@@ -0,0 +1,324 @@
+#! /usr/bin/env python3
+"""
+Minimal BFD responder for testing bfd link watch.
+
+Implements asynchronous mode BFD (RFC 5880) over single hop IPv4 UDP
+(RFC 5881) on a plain interface with an address configured. Echo packets
+sent by teamd are looped back by the kernel as long as forwarding is
+enabled, which --setup takes care of.
+
+With --setup, a network namespace with one end of a veth pair is created
+and the responder is run inside of it. The other end of the pair is left
+in the current namespace to be used as a team port, e.g.:
+
+   bfd_responder.py --setup --veth=bfdp0 &
+   teamd -t team0 -c '{"runner": {"name": "activebackup"},
+                       "link_watch": {"name": "bfd", "interval": 20,
+                                      "source_host": "192.168.77.1",
+                                      "target_host": "192.168.77.2",
+                                      "echo": true},
+                       "ports": {"bfdp0": {}}}' &
+   ip addr add 192.168.77.1/24 dev team0; ip link set team0 up
+   teamdctl team0 state
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+"""
+
+import sys
+import os
+import getopt
+import random
+import select
+import socket
+import struct
+import subprocess
+import time
+
+BFD_CTRL_PORT = 3784
+BFD_VERSION = 1
+BFD_TTL = 255
+BFD_FMT = "!BBBBIIIII"
+BFD_LEN = struct.calcsize(BFD_FMT)
+
+STATE_ADMIN_DOWN = 0
+STATE_DOWN = 1
+STATE_INIT = 2
+STATE_UP = 3
+STATE_NAMES = ["admin_down", "down", "init", "up"]
+
+# Not exported by older Python versions
+IP_RECVTTL = getattr(socket, "IP_RECVTTL", 12)
+
+FLAG_POLL = 0x20
+FLAG_FINAL = 0x10
+
+def usage():
+    """
+    Print usage of this app
+    """
+    print("Usage: bfd_responder.py [OPTION...]")
+    print("")
+    print("  -h, --help                         print this message")
+    print("  -i, --interface=NETDEV             interface to run on (default bfdq0)")
+    print("  -l, --local=ADDR                   local address (default 192.168.77.2)")
+    print("  -p, --peer=ADDR                    peer address (default 192.168.77.1)")
+    print("  -t, --interval=MS                  tx/rx interval (default 20)")
+    print("  -m, --detect-mult=NUMBER           detect multiplier (default 3)")
+    print("  -e, --echo-interval=MS             required min echo rx (default 20, 0 disables)")
+    print("  -s, --setup                        create netns and veth pair, run inside")
+    print("  -v, --veth=NETDEV                  veth end left outside netns (default bfdp0)")
+    sys.exit()
+
+class CmdExecFailedException(Exception):
+    def __init__(self, cmd, retval):
+        self.__cmd = cmd
+        self.__retval = retval
+
+    def __str__(self):
+        return "Command \"%s\" failed: %s" % (self.__cmd, self.__retval)
+
+def cmd_exec(cmd, cleaner=False):
+    subp = subprocess.Popen(cmd, shell=True, stdout=subprocess.PIPE,
+                            stderr=subprocess.PIPE,
+                            universal_newlines=True)
+    (data_stdout, data_stderr) = subp.communicate()
+    if subp.returncode and not cleaner:
+        if data_stderr:
+            sys.stderr.write(data_stderr)
+        raise CmdExecFailedException(cmd, subp.returncode)
+    return data_stdout.rstrip()
+
+class BfdResponder:
+    def __init__(self):
+        self._interface = "bfdq0"
+        self._local = "192.168.77.2"
+        self._peer = "192.168.77.1"
+        self._interval = 20
+        self._detect_mult = 3
+        self._echo_interval = 20
+        self._netns = "bfdtest"
+        self._veth = "bfdp0"
+        self._state = STATE_DOWN
+        self._diag = 0
+        self._local_discr = random.randint(1, 0xffffffff)
+        self._remote_discr = 0
+        self._remote_min_rx = 1
+        self._remote_min_tx = 0
+        self._remote_detect_mult = 0
+        self._last_rx = None
+
+    def set_interface(self, val):
+        self._interface = val
+
+    def set_local(self, val):
+        self._local = val
+
+    def set_peer(self, val):
+        self._peer = val
+
+    def set_interval(self, val):
+        self._interval = val
+
+    def set_detect_mult(self, val):
+        self._detect_mult = val
+
+    def set_echo_interval(self, val):
+        self._echo_interval = val
+
+    def set_veth(self, val):
+        self._veth = val
+
+    def _ns(self, cmd):
+        return "ip netns exec %s %s" % (self._netns, cmd)
+
+    def _cleanup(self):
+        cmd_exec("ip link del %s" % self._veth, True)
+        cmd_exec("ip netns del %s" % self._netns, True)
+
+    def setup_and_run(self, argv):
+        self._cleanup()
+        cmd_exec("ip netns add %s" % self._netns)
+        try:
+            cmd_exec("ip link add %s type veth peer name %s" %
+                     (self._veth, self._interface))
+            cmd_exec("ip link set %s netns %s" % (self._interface,
+                                                 self._netns))
+            cmd_exec(self._ns("ip addr add %s/24 dev %s" %
+                              (self._local, self._interface)))
+            cmd_exec(self._ns("ip link set %s up" % self._interface))
+            cmd_exec(self._ns("ip link set lo up"))
+            # Echo packets are destined to the peer itself, route them back.
+            cmd_exec(self._ns("sysctl -q -w net.ipv4.ip_forward=1"))
+            cmd_exec(self._ns("sysctl -q -w net.ipv4.conf.all.send_redirects=0"))
+            cmd_exec(self._ns("sysctl -q -w net.ipv4.conf.%s.send_redirects=0" %
+                              self._interface))
+            argv = [arg for arg in argv if arg not in ("-s", "--setup")]
+            subprocess.call(["ip", "netns", "exec", self._netns,
+                             sys.executable] + argv)
+        except KeyboardInterrupt:
+            pass
+        finally:
+            self._cleanup()
+
+    def _set_state(self, state, diag):
+        if state == self._state:
+            return
+        print("%.3f session %s -> %s (diag %d)" %
+              (time.monotonic(), STATE_NAMES[self._state],
+               STATE_NAMES[state], diag))
+        self._state = state
+        self._diag = diag
+
+    def _send(self, tx_sock, final=False):
+        flags = self._state << 6
+        if final:
+            flags |= FLAG_FINAL
+        pkt = struct.pack(BFD_FMT, (BFD_VERSION << 5) | self._diag, flags,
+                          self._detect_mult, BFD_LEN, self._local_discr,
+                          self._remote_discr, self._interval * 1000,
+                          self._interval * 1000, self._echo_interval * 1000)
+        try:
+            tx_sock.sendto(pkt, (self._peer, BFD_CTRL_PORT))
+        except OSError:
+            pass
+
+    def _receive(self, rx_sock, tx_sock):
+        data, ancdata, flags, addr = rx_sock.recvmsg(128, 64)
+        if addr[0] != self._peer or len(data) < BFD_LEN:
+            return
+        ttl = None
+        for level, ctype, cdata in ancdata:
+            if level == socket.IPPROTO_IP and ctype == socket.IP_TTL:
+                ttl = struct.unpack("i", cdata[:4])[0]
+        if ttl != BFD_TTL:
+            return
+        (vers_diag, state_flags, detect_mult, length, my_discr, your_discr,
+         min_tx, min_rx, min_echo_rx) = struct.unpack(BFD_FMT, data[:BFD_LEN])
+        if vers_diag >> 5 != BFD_VERSION or length < BFD_LEN or \
+           not detect_mult or not my_discr or state_flags & 0x05:
+            return
+        if your_discr and your_discr != self._local_discr:
+            return
+        if not your_discr and self._state not in (STATE_DOWN,
+                                                  STATE_ADMIN_DOWN):
+            return
+        old_state = self._state
+        remote_state = state_flags >> 6
+        self._remote_discr = my_discr
+        self._remote_min_tx = min_tx
+        self._remote_min_rx = min_rx
+        self._remote_detect_mult = detect_mult
+        self._last_rx = time.monotonic()
+        if remote_state == STATE_ADMIN_DOWN:
+            self._set_state(STATE_DOWN, 3)
+        elif self._state == STATE_DOWN:
+            if remote_state == STATE_DOWN:
+                self._set_state(STATE_INIT, 0)
+            elif remote_state == STATE_INIT:
+                self._set_state(STATE_UP, 0)
+        elif self._state == STATE_INIT:
+            if remote_state in (STATE_INIT, STATE_UP):
+                self._set_state(STATE_UP, 0)
+        elif self._state == STATE_UP:
+            if remote_state == STATE_DOWN:
+                self._set_state(STATE_DOWN, 3)
+        if state_flags & FLAG_POLL or self._state != old_state:
+            self._send(tx_sock, state_flags & FLAG_POLL)
+
+    def _check_detect_time(self):
+        if self._state not in (STATE_INIT, STATE_UP) or self._last_rx is None:
+            return
+        detect_time = self._remote_detect_mult * \
+                      max(self._interval * 1000, self._remote_min_tx) / 1e6
+        if time.monotonic() - self._last_rx > detect_time:
+            self._remote_discr = 0
+            self._remote_min_rx = 1
+            self._set_state(STATE_DOWN, 1)
+
+    def run(self):
+        ifname = self._interface.encode()
+        rx_sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        rx_sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        rx_sock.setsockopt(socket.SOL_SOCKET, socket.SO_BINDTODEVICE, ifname)
+        rx_sock.setsockopt(socket.IPPROTO_IP, IP_RECVTTL, 1)
+        rx_sock.bind(("", BFD_CTRL_PORT))
+        tx_sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        tx_sock.setsockopt(socket.SOL_SOCKET, socket.SO_BINDTODEVICE, ifname)
+        tx_sock.setsockopt(socket.IPPROTO_IP, socket.IP_TTL, BFD_TTL)
+        tx_sock.bind((self._local, random.randint(49152, 65535)))
+
+        print("BFD responder on %s, %s -> %s, interval %d ms" %
+              (self._interface, self._local, self._peer, self._interval))
+        next_tx = time.monotonic()
+        while True:
+            timeout = max(0, next_tx - time.monotonic())
+            readable, _, _ = select.select([rx_sock], [], [], timeout)
+            if readable:
+                self._receive(rx_sock, tx_sock)
+            self._check_detect_time()
+            now = time.monotonic()
+            if now >= next_tx:
+                if self._remote_min_rx:
+                    self._send(tx_sock)
+                tx_interval = max(self._interval * 1000,
+                                  self._remote_min_rx) / 1e6
+                # Jitter as required by RFC 5880 section 6.8.7
+                next_tx = now + tx_interval * random.uniform(0.75, 1.0)
+
+def main():
+    try:
+        opts, args = getopt.getopt(
+            sys.argv[1:],
+            "hi:l:p:t:m:e:sv:",
+            ["help", "interface=", "local=", "peer=", "interval=",
+             "detect-mult=", "echo-interval=", "setup", "veth="]
+        )
+    except getopt.GetoptError as err:
+        print(str(err))
+        usage()
+
+    responder = BfdResponder()
+    setup = False
+
+    for opt, arg in opts:
+        if opt in ("-h", "--help"):
+            usage()
+        elif opt in ("-i", "--interface"):
+            responder.set_interface(arg)
+        elif opt in ("-l", "--local"):
+            responder.set_local(arg)
+        elif opt in ("-p", "--peer"):
+            responder.set_peer(arg)
+        elif opt in ("-t", "--interval"):
+            responder.set_interval(int(arg))
+        elif opt in ("-m", "--detect-mult"):
+            responder.set_detect_mult(int(arg))
+        elif opt in ("-e", "--echo-interval"):
+            responder.set_echo_interval(int(arg))
+        elif opt in ("-s", "--setup"):
+            setup = True
+        elif opt in ("-v", "--veth"):
+            responder.set_veth(arg)
+
+    try:
+        if setup:
+            responder.setup_and_run(sys.argv)
+        else:
+            responder.run()
+    except KeyboardInterrupt:
+        pass
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,269 @@
+#! /usr/bin/env python3
+"""
+LACP failure detection benchmark.
+
+Two teamd instances running lacp runner are connected by veth pairs, one
+of them in a separate network namespace. Once all ports are current,
+the partner teamd is stopped (SIGSTOP) so it goes silent and the time
+until the local ports become expired, defaulted and disabled is measured.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+"""
+
+import sys
+import os
+import getopt
+import json
+import signal
+import subprocess
+import time
+
+def usage():
+    """
+    Print usage of this app
+    """
+    print("Usage: lacp_failover_bench.py [OPTION...]")
+    print("")
+    print("  -h, --help                         print this message")
+    print("  -c, --loop-count=NUMBER            number of measurements (default 5)")
+    print("  -n, --port-count=NUMBER            number of ports (default 2)")
+    print("  -i, --interval=MS                  fast_rate_interval (default 1000)")
+    print("  -m, --multiplier=NUMBER            timeout_multiplier (default 3)")
+    print("  -t, --teamd=PATH                   teamd binary (default teamd)")
+    print("  -d, --teamdctl=PATH                teamdctl binary (default teamdctl)")
+    sys.exit()
+
+class CmdExecFailedException(Exception):
+    def __init__(self, cmd, retval):
+        self.__cmd = cmd
+        self.__retval = retval
+
+    def __str__(self):
+        return "Command \"%s\" failed: %s" % (self.__cmd, self.__retval)
+
+def cmd_exec(cmd, cleaner=False):
+    subp = subprocess.Popen(cmd, shell=True, stdout=subprocess.PIPE,
+                            stderr=subprocess.PIPE,
+                            universal_newlines=True)
+    (data_stdout, data_stderr) = subp.communicate()
+    if subp.returncode and not cleaner:
+        if data_stderr:
+            sys.stderr.write(data_stderr)
+        raise CmdExecFailedException(cmd, subp.returncode)
+    return data_stdout.rstrip()
+
+class LacpFailoverBench:
+    def __init__(self):
+        self._team_name = "lbteam0"
+        self._peer_team_name = "lbteam1"
+        self._netns = "lacpbench"
+        self._loop_count = 5
+        self._port_count = 2
+        self._interval = 1000
+        self._multiplier = 3
+        self._teamd = "teamd"
+        self._teamdctl = "teamdctl"
+
+    def set_loop_count(self, val):
+        self._loop_count = val
+
+    def set_port_count(self, val):
+        self._port_count = val
+
+    def set_interval(self, val):
+        self._interval = val
+
+    def set_multiplier(self, val):
+        self._multiplier = val
+
+    def set_teamd(self, val):
+        self._teamd = val
+
+    def set_teamdctl(self, val):
+        self._teamdctl = val
+
+    def _port_name(self, i):
+        return "lbp%d" % i
+
+    def _peer_port_name(self, i):
+        return "lbq%d" % i
+
+    def _config(self, port_names):
+        config = {
+            "runner": {
+                "name": "lacp",
+                "active": True,
+                "fast_rate": True,
+                "fast_rate_interval": self._interval,
+                "timeout_multiplier": self._multiplier,
+            },
+            "link_watch": {"name": "ethtool"},
+            "ports": dict((name, {}) for name in port_names),
+        }
+        return json.dumps(config)
+
+    def _ns(self, cmd):
+        return "ip netns exec %s %s" % (self._netns, cmd)
+
+    def _setup(self):
+        cmd_exec("ip netns add %s" % self._netns)
+        ports = []
+        peer_ports = []
+        for i in range(self._port_count):
+            port = self._port_name(i)
+            peer_port = self._peer_port_name(i)
+            cmd_exec("ip link add %s type veth peer name %s" %
+                     (port, peer_port))
+            cmd_exec("ip link set %s netns %s" % (peer_port, self._netns))
+            ports.append(port)
+            peer_ports.append(peer_port)
+        cmd_exec("%s -d -t %s -c '%s'" %
+                 (self._teamd, self._team_name, self._config(ports)))
+        cmd_exec(self._ns("%s -d -t %s -c '%s'" %
+                          (self._teamd, self._peer_team_name,
+                           self._config(peer_ports))))
+        cmd_exec("ip link set %s up" % self._team_name)
+        cmd_exec(self._ns("ip link set %s up" % self._peer_team_name))
+
+    def _cleanup(self):
+        pid = self._peer_pid()
+        if pid:
+            os.kill(pid, signal.SIGCONT)
+        cmd_exec("%s -k -t %s" % (self._teamd, self._team_name), True)
+        cmd_exec(self._ns("%s -k -t %s" % (self._teamd, self._peer_team_name)),
+                 True)
+        for i in range(self._port_count):
+            cmd_exec("ip link del %s" % self._port_name(i), True)
+        cmd_exec("ip netns del %s" % self._netns, True)
+
+    def _peer_pid(self):
+        try:
+            f = open("/var/run/teamd/%s.pid" % self._peer_team_name)
+        except IOError:
+            return None
+        pid = int(f.read().strip())
+        f.close()
+        return pid
+
+    def _port_state(self, port):
+        return cmd_exec("%s %s state item get ports.%s.runner.state" %
+                        (self._teamdctl, self._team_name, port), True)
+
+    def _port_enabled(self, port):
+        out = cmd_exec("teamnl %s getoption enabled -p %s" %
+                       (self._team_name, port), True)
+        return out == "true"
+
+    def _wait_all_current(self, timeout):
+        deadline = time.time() + timeout
+        while time.time() < deadline:
+            if all(self._port_state(self._port_name(i)) == "current" and
+                   self._port_enabled(self._port_name(i))
+                   for i in range(self._port_count)):
+                return
+            time.sleep(0.05)
+        raise Exception("Ports did not become current in %d seconds" % timeout)
+
+    def _measure_one(self):
+        port = self._port_name(0)
+        expired = None
+        defaulted = None
+        disabled = None
+        pid = self._peer_pid()
+
+        self._wait_all_current(30)
+        start = time.monotonic()
+        os.kill(pid, signal.SIGSTOP)
+        try:
+            while time.monotonic() - start < 120:
+                state = self._port_state(port)
+                now = time.monotonic() - start
+                if expired is None and state in ("expired", "defaulted"):
+                    expired = now
+                if defaulted is None and state == "defaulted":
+                    defaulted = now
+                if disabled is None and not self._port_enabled(port):
+                    disabled = now
+                if expired is not None and defaulted is not None and \
+                   disabled is not None:
+                    break
+        finally:
+            os.kill(pid, signal.SIGCONT)
+        return (expired, defaulted, disabled)
+
+    def _print_stat(self, name, vals):
+        vals = [val for val in vals if val is not None]
+        if not vals:
+            print("%-10s n/a" % name)
+            return
+        print("%-10s min %8.1f ms  avg %8.1f ms  max %8.1f ms" %
+              (name, min(vals) * 1000, sum(vals) * 1000 / len(vals),
+               max(vals) * 1000))
+
+    def run(self):
+        results = []
+        print("fast_rate_interval %d ms, timeout_multiplier %d, %d ports" %
+              (self._interval, self._multiplier, self._port_count))
+        self._cleanup()
+        try:
+            self._setup()
+            for i in range(self._loop_count):
+                res = self._measure_one()
+                print("RUN #%d: expired %s, defaulted %s, disabled %s" %
+                      ((i + 1,) + tuple("%.1f ms" % (val * 1000)
+                                        if val is not None else "n/a"
+                                        for val in res)))
+                results.append(res)
+        finally:
+            self._cleanup()
+        self._print_stat("expired", [res[0] for res in results])
+        self._print_stat("defaulted", [res[1] for res in results])
+        self._print_stat("disabled", [res[2] for res in results])
+        print("Times include polling overhead of teamdctl/teamnl calls.")
+
+def main():
+    try:
+        opts, args = getopt.getopt(
+            sys.argv[1:],
+            "hc:n:i:m:t:d:",
+            ["help", "loop-count=", "port-count=", "interval=",
+             "multiplier=", "teamd=", "teamdctl="]
+        )
+    except getopt.GetoptError as err:
+        print(str(err))
+        usage()
+
+    bench = LacpFailoverBench()
+
+    for opt, arg in opts:
+        if opt in ("-h", "--help"):
+            usage()
+        elif opt in ("-c", "--loop-count"):
+            bench.set_loop_count(int(arg))
+        elif opt in ("-n", "--port-count"):
+            bench.set_port_count(int(arg))
+        elif opt in ("-i", "--interval"):
+            bench.set_interval(int(arg))
+        elif opt in ("-m", "--multiplier"):
+            bench.set_multiplier(int(arg))
+        elif opt in ("-t", "--teamd"):
+            bench.set_teamd(arg)
+        elif opt in ("-d", "--teamdctl"):
+            bench.set_teamdctl(arg)
+
+    bench.run()
+
+if __name__ == "__main__":
+    main()
@@ -33,18 +33,19 @@
 #include <sys/select.h>
 #include <linux/netdevice.h>
 #include <sys/syslog.h>
-#include <sys/timerfd.h>
 #include <libdaemon/dfork.h>
 #include <libdaemon/dsignal.h>
 #include <libdaemon/dlog.h>
 #include <libdaemon/dpid.h>
 #include <private/list.h>
 #include <private/misc.h>
+#include <private/hash.h>
 #include <team.h>
 
 #include "config.h"
 #include "teamd.h"
 #include "teamd_workq.h"
+#include "teamd_timer.h"
 #include "teamd_config.h"
 #include "teamd_state.h"
 #include "teamd_usock.h"
@@ -52,6 +53,10 @@
 #include "teamd_zmq.h"
 #include "teamd_phys_port_check.h"
 
+#ifdef ENABLE_EPOLL
+#include <sys/epoll.h>
+#endif
+
 enum teamd_exit_code {
 	TEAMD_EXIT_SUCCESS,
 	TEAMD_EXIT_FAILURE,
@@ -247,39 +252,362 @@ static const char *teamd_pid_file_proc(void) {
 	return *__g_pid_file;
 }
 
-static int handle_period_fd(int fd)
-{
-	ssize_t ret;
-	uint64_t exp;
+#ifdef ENABLE_EPOLL
+/*
+ * With epoll, every fd is registered in the epoll set only once, no matter
+ * how many callbacks use it (D-Bus may for example watch one fd for reading
+ * and writing separately). The epoll event mask is the union of the event
+ * masks of all enabled callbacks on the fd.
+ */
+struct teamd_loop_fd {
+	struct list_item list; /* used only for dead_fd_list */
+	struct list_item lcb_list;
+	int fd;
+	uint32_t epoll_events;
+	bool tail;
+	bool dead;
+};
+#endif
 
-	ret = read(fd, &exp, sizeof(uint64_t));
-	if (ret == -1) {
-		if (errno == EINTR || errno == EAGAIN)
-			return 0;
-		teamd_log_err("read() failed.");
-		return -errno;
-	}
-	if (ret != sizeof(uint64_t)) {
-		teamd_log_err("read() returned unexpected number of bytes.");
-		return -EINVAL;
-	}
-	if (exp > 1)
-		teamd_log_warn("some periodic function calls missed (%" PRIu64 ")",
-			       exp - 1);
-	return 0;
-}
+/*
+ * Callback names are interned so callbacks can be hashed and compared by
+ * name pointer rather than by string.
+ */
+struct teamd_loop_cb_name {
+	struct hash_node node;
+	unsigned int refcount;
+	char *name;
+};
 
 struct teamd_loop_callback {
 	struct list_item list;
-	char *name;
+	struct hash_node node;
+	struct teamd_loop_cb_name *iname;
+	const char *name;
 	void *priv;
 	teamd_loop_callback_func_t func;
 	int fd;
 	int fd_event;
 	bool is_period;
 	bool enabled;
+	struct teamd_timer timer;
+	struct timespec interval;
+	bool timer_expired;
+	bool timer_aligned;
+#ifdef ENABLE_EPOLL
+	struct teamd_loop_fd *lfd;
+	struct list_item fd_list;
+#endif
 };
 
+static int teamd_run_loop_do_callback(struct teamd_context *ctx,
+				      struct teamd_loop_callback *lcb,
+				      int ready_events)
+{
+	int i;
+	int events;
+	int err;
+
+	for (i = 0; i < 3; i++) {
+		if (!(lcb->fd_event & (1 << i)))
+			continue;
+		events = ready_events & (1 << i);
+		if (!events)
+			continue;
+		err = lcb->func(ctx, events, lcb->priv);
+		if (err) {
+			teamd_log_warn("Loop callback failed with: %s",
+				       strerror(-err));
+			teamd_log_dbg("Failed loop callback: %s, %p",
+				      lcb->name, lcb->priv);
+		}
+	}
+	return 0;
+}
+
+static int teamd_flush_ports(struct teamd_context *ctx)
+{
+	if (!ctx->no_quit_destroy)
+		return teamd_port_remove_all(ctx);
+	else
+		teamd_port_obj_remove_all(ctx);
+	return 0;
+}
+
+/*
+ * Returns 1 in case the rest of this loop iteration should be skipped,
+ * 0 in case callbacks should be processed and negative value on error.
+ */
+static int teamd_run_loop_handle_ctrl(struct teamd_context *ctx,
+				      bool *quit_in_progress)
+{
+	char ctrl_byte;
+	int err;
+
+	err = read(ctx->run_loop.ctrl_pipe_r, &ctrl_byte, 1);
+	if (err != -1) {
+		switch(ctrl_byte) {
+		case 'q':
+			if (*quit_in_progress)
+				return -EBUSY;
+			err = teamd_flush_ports(ctx);
+			if (err)
+				return err;
+			*quit_in_progress = true;
+			return 1;
+		case 'r':
+			return 1;
+		}
+	} else if (errno == EINTR || errno == EAGAIN) {
+		return 1;
+	} else {
+		teamd_log_err("read() failed.");
+		return -errno;
+	}
+	return 0;
+}
+
+#ifdef ENABLE_EPOLL
+
+#define TEAMD_RUN_LOOP_EPOLL_MAXEVENTS 64
+
+static uint32_t teamd_loop_fd_event_to_epoll(int fd_event)
+{
+	uint32_t events = 0;
+
+	if (fd_event & TEAMD_LOOP_FD_EVENT_READ)
+		events |= EPOLLIN;
+	if (fd_event & TEAMD_LOOP_FD_EVENT_WRITE)
+		events |= EPOLLOUT;
+	if (fd_event & TEAMD_LOOP_FD_EVENT_EXCEPTION)
+		events |= EPOLLPRI;
+	return events;
+}
+
+static int teamd_loop_fd_event_from_epoll(uint32_t events)
+{
+	int fd_event = 0;
+
+	/* select() reports hangup and error as readable and writable */
+	if (events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+		fd_event |= TEAMD_LOOP_FD_EVENT_READ;
+	if (events & (EPOLLOUT | EPOLLHUP | EPOLLERR))
+		fd_event |= TEAMD_LOOP_FD_EVENT_WRITE;
+	if (events & EPOLLPRI)
+		fd_event |= TEAMD_LOOP_FD_EVENT_EXCEPTION;
+	return fd_event;
+}
+
+static int teamd_loop_fd_update(struct teamd_context *ctx,
+				struct teamd_loop_fd *lfd)
+{
+	struct teamd_loop_callback *lcb;
+	struct epoll_event ev;
+	uint32_t events = 0;
+	int op;
+
+	list_for_each_node_entry(lcb, &lfd->lcb_list, fd_list) {
+		if (lcb->enabled)
+			events |= teamd_loop_fd_event_to_epoll(lcb->fd_event);
+	}
+	if (events == lfd->epoll_events)
+		return 0;
+
+	/*
+	 * Remove fds with no enabled callback from epoll set entirely,
+	 * otherwise hangup and error would be still reported for them.
+	 */
+	if (!events)
+		op = EPOLL_CTL_DEL;
+	else if (!lfd->epoll_events)
+		op = EPOLL_CTL_ADD;
+	else
+		op = EPOLL_CTL_MOD;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.ptr = lfd;
+	if (epoll_ctl(ctx->run_loop.epoll_fd, op, lfd->fd, &ev) < 0) {
+		/* Fd might have been already closed by the callback owner. */
+		if (op == EPOLL_CTL_DEL && errno == EBADF) {
+			lfd->epoll_events = 0;
+			return 0;
+		}
+		teamd_log_err("Failed to update epoll set for fd %d.",
+			      lfd->fd);
+		return -errno;
+	}
+	lfd->epoll_events = events;
+	return 0;
+}
+
+static int teamd_loop_fd_get(struct teamd_context *ctx,
+			     struct teamd_loop_callback *lcb, bool tail)
+{
+	struct teamd_loop_callback *cur;
+	struct teamd_loop_fd *lfd = NULL;
+
+	if (lcb->fd < 0)
+		return 0;
+	list_for_each_node_entry(cur, &ctx->run_loop.callback_list, list) {
+		if (cur->lfd && cur->fd == lcb->fd) {
+			lfd = cur->lfd;
+			break;
+		}
+	}
+	if (!lfd) {
+		lfd = myzalloc(sizeof(*lfd));
+		if (!lfd)
+			return -ENOMEM;
+		list_init(&lfd->lcb_list);
+		lfd->fd = lcb->fd;
+	}
+	if (tail)
+		lfd->tail = true;
+	list_add_tail(&lfd->lcb_list, &lcb->fd_list);
+	lcb->lfd = lfd;
+	return 0;
+}
+
+static void teamd_loop_fd_put(struct teamd_context *ctx,
+			      struct teamd_loop_callback *lcb)
+{
+	struct teamd_loop_fd *lfd = lcb->lfd;
+
+	if (!lfd)
+		return;
+	list_del(&lcb->fd_list);
+	lcb->lfd = NULL;
+	ctx->run_loop.del_gen++;
+	teamd_loop_fd_update(ctx, lfd);
+	if (!list_empty(&lfd->lcb_list))
+		return;
+	/*
+	 * Event array returned by epoll_wait() might still point to this
+	 * fd, so postpone the free until all events are processed.
+	 */
+	lfd->dead = true;
+	if (ctx->run_loop.in_dispatch)
+		list_add_tail(&ctx->run_loop.dead_fd_list, &lfd->list);
+	else
+		free(lfd);
+}
+
+static void teamd_loop_fd_free_dead(struct teamd_context *ctx)
+{
+	struct teamd_loop_fd *lfd;
+	struct teamd_loop_fd *tmp;
+
+	list_for_each_node_entry_safe(lfd, tmp, &ctx->run_loop.dead_fd_list,
+				      list) {
+		list_del(&lfd->list);
+		free(lfd);
+	}
+}
+
+static int teamd_run_loop_do_fd_callbacks(struct teamd_context *ctx,
+					  struct epoll_event *ev)
+{
+	struct teamd_loop_fd *lfd = ev->data.ptr;
+	struct teamd_loop_callback *lcb;
+	unsigned int del_gen = ctx->run_loop.del_gen;
+	int fd_event;
+	int err;
+
+	if (lfd->dead)
+		return 0;
+	fd_event = teamd_loop_fd_event_from_epoll(ev->events);
+	list_for_each_node_entry(lcb, &lfd->lcb_list, fd_list) {
+		if (!lcb->enabled)
+			continue;
+		err = teamd_run_loop_do_callback(ctx, lcb, fd_event);
+		if (err)
+			return err;
+		/*
+		 * Some callback got removed, the list may be changed under
+		 * our hands. Epoll is level triggered so other callbacks
+		 * for this fd will be called in the next loop iteration.
+		 */
+		if (del_gen != ctx->run_loop.del_gen)
+			break;
+	}
+	return 0;
+}
+
+static int teamd_run_loop_do_callbacks(struct teamd_context *ctx,
+				       struct epoll_event *evs, int nevs)
+{
+	struct teamd_loop_fd *lfd;
+	int pass;
+	int i;
+	int err = 0;
+
+	ctx->run_loop.in_dispatch = true;
+	/* Callbacks added to tail are processed after all others. */
+	for (pass = 0; pass < 2; pass++) {
+		for (i = 0; i < nevs; i++) {
+			lfd = evs[i].data.ptr;
+			if (!lfd || lfd->tail != pass)
+				continue;
+			err = teamd_run_loop_do_fd_callbacks(ctx, &evs[i]);
+			if (err)
+				goto out;
+		}
+	}
+out:
+	ctx->run_loop.in_dispatch = false;
+	teamd_loop_fd_free_dead(ctx);
+	return err;
+}
+
+static int teamd_run_loop_run(struct teamd_context *ctx)
+{
+	struct epoll_event evs[TEAMD_RUN_LOOP_EPOLL_MAXEVENTS];
+	int nevs;
+	int err;
+	int i;
+	bool quit_in_progress = false;
+
+	/*
+	 * To process all things correctly during cleanup, on quit command
+	 * received via control pipe ('q') do flush all existing ports.
+	 * After that wait until all ports are gone and return.
+	 */
+
+	while (true) {
+		if (quit_in_progress && !teamd_has_ports(ctx))
+			return ctx->run_loop.err;
+
+		while ((nevs = epoll_wait(ctx->run_loop.epoll_fd, evs,
+					  ARRAY_SIZE(evs), -1)) < 0) {
+			if (errno == EINTR)
+				continue;
+
+			teamd_log_err("epoll_wait() failed.");
+			return -errno;
+		}
+
+		/* Control pipe is the only fd registered with NULL data. */
+		for (i = 0; i < nevs; i++)
+			if (!evs[i].data.ptr)
+				break;
+		if (i < nevs) {
+			err = teamd_run_loop_handle_ctrl(ctx,
+							 &quit_in_progress);
+			if (err < 0)
+				return err;
+			if (err)
+				continue;
+		}
+
+		err = teamd_run_loop_do_callbacks(ctx, evs, nevs);
+		if (err)
+			return err;
+	}
+	return 0;
+}
+
+#else /* ENABLE_EPOLL */
+
 static void teamd_run_loop_set_fds(struct list_item *lcb_list,
 				   fd_set *fds, int *fdmax)
 {
@@ -287,7 +615,7 @@ static void teamd_run_loop_set_fds(struct list_item *lcb_list,
 	int i;
 
 	list_for_each_node_entry(lcb, lcb_list, list) {
-		if (!lcb->enabled)
+		if (!lcb->enabled || lcb->is_period)
 			continue;
 		for (i = 0; i < 3; i++) {
 			if (lcb->fd_event & (1 << i)) {
@@ -309,47 +637,26 @@ static int teamd_run_loop_do_callbacks(struct list_item *lcb_list, fd_set *fds,
 	int err;
 
 	list_for_each_node_entry_safe(lcb, tmp, lcb_list, list) {
+		if (lcb->is_period)
+			continue;
+		events = 0;
 		for (i = 0; i < 3; i++) {
-			if (!(lcb->fd_event & (1 << i)))
-				continue;
-			events = 0;
 			if (FD_ISSET(lcb->fd, &fds[i]))
 				events |= (1 << i);
-			if (!events)
-				continue;
-			if (lcb->is_period) {
-				err = handle_period_fd(lcb->fd);
-				if (err)
-					return err;
-			}
-			err = lcb->func(ctx, events, lcb->priv);
-			if (err) {
-				teamd_log_warn("Loop callback failed with: %s",
-					       strerror(-err));
-				teamd_log_dbg("Failed loop callback: %s, %p",
-					      lcb->name, lcb->priv);
-			}
 		}
+		err = teamd_run_loop_do_callback(ctx, lcb, events);
+		if (err)
+			return err;
 	}
 	return 0;
 }
 
-static int teamd_flush_ports(struct teamd_context *ctx)
-{
-	if (!ctx->no_quit_destroy)
-		return teamd_port_remove_all(ctx);
-	else
-		teamd_port_obj_remove_all(ctx);
-	return 0;
-}
-
 static int teamd_run_loop_run(struct teamd_context *ctx)
 {
 	int err;
 	int ctrl_fd = ctx->run_loop.ctrl_pipe_r;
 	fd_set fds[3];
 	int fdmax;
-	char ctrl_byte;
 	int i;
 	bool quit_in_progress = false;
 
@@ -380,26 +687,12 @@ static int teamd_run_loop_run(struct teamd_context *ctx)
 		}
 
 		if (FD_ISSET(ctrl_fd, &fds[0])) {
-			err = read(ctrl_fd, &ctrl_byte, 1);
-			if (err != -1) {
-				switch(ctrl_byte) {
-				case 'q':
-					if (quit_in_progress)
-						return -EBUSY;
-					err = teamd_flush_ports(ctx);
-					if (err)
-						return err;
-					quit_in_progress = true;
-					continue;
-				case 'r':
-					continue;
-				}
-			} else if (errno == EINTR || errno == EAGAIN) {
+			err = teamd_run_loop_handle_ctrl(ctx,
+							 &quit_in_progress);
+			if (err < 0)
+				return err;
+			if (err)
 				continue;
-			} else {
-				teamd_log_err("read() failed.");
-				return -errno;
-			}
 		}
 
 		err = teamd_run_loop_do_callbacks(&ctx->run_loop.callback_list,
@@ -410,6 +703,8 @@ static int teamd_run_loop_run(struct teamd_context *ctx)
 	return 0;
 }
 
+#endif /* ENABLE_EPOLL */
+
 static void teamd_run_loop_sent_ctrl_byte(struct teamd_context *ctx,
 					  const char ctrl_byte)
 {
@@ -432,6 +727,60 @@ void teamd_run_loop_restart(struct teamd_context *ctx)
 	teamd_run_loop_sent_ctrl_byte(ctx, 'r');
 }
 
+static struct teamd_loop_cb_name *
+teamd_loop_cb_name_find(struct teamd_context *ctx, const char *cb_name,
+			uint32_t hash)
+{
+	struct teamd_loop_cb_name *iname;
+	struct hash_node *hnode;
+
+	hash_table_for_each_possible(iname, hnode, &ctx->run_loop.name_table,
+				     hash, node) {
+		if (!strcmp(iname->name, cb_name))
+			return iname;
+	}
+	return NULL;
+}
+
+static struct teamd_loop_cb_name *
+teamd_loop_cb_name_get(struct teamd_context *ctx, const char *cb_name)
+{
+	struct teamd_loop_cb_name *iname;
+	uint32_t hash = hash_str(cb_name);
+
+	iname = teamd_loop_cb_name_find(ctx, cb_name, hash);
+	if (iname) {
+		iname->refcount++;
+		return iname;
+	}
+	iname = myzalloc(sizeof(*iname));
+	if (!iname)
+		return NULL;
+	iname->name = strdup(cb_name);
+	if (!iname->name) {
+		free(iname);
+		return NULL;
+	}
+	iname->refcount = 1;
+	hash_table_add(&ctx->run_loop.name_table, &iname->node, hash);
+	return iname;
+}
+
+static void teamd_loop_cb_name_put(struct teamd_context *ctx,
+				   struct teamd_loop_cb_name *iname)
+{
+	if (--iname->refcount)
+		return;
+	hash_table_del(&ctx->run_loop.name_table, &iname->node);
+	free(iname->name);
+	free(iname);
+}
+
+static uint32_t lcb_hash(struct teamd_loop_cb_name *iname, void *priv)
+{
+	return hash_combine(hash_ptr(iname), hash_ptr(priv));
+}
+
 static struct teamd_loop_callback *__get_lcb(struct teamd_context *ctx,
 					     const char *cb_name, void *priv,
 					     struct teamd_loop_callback *last)
@@ -458,7 +807,25 @@ static struct teamd_loop_callback *__get_lcb(struct teamd_context *ctx,
 static struct teamd_loop_callback *get_lcb(struct teamd_context *ctx,
 					   const char *cb_name, void *priv)
 {
-	return __get_lcb(ctx, cb_name, priv, NULL);
+	struct teamd_loop_cb_name *iname;
+	struct teamd_loop_callback *lcb;
+	struct hash_node *hnode;
+	uint32_t hash;
+
+	/* Wildcard lookups are rare, just walk the list for those. */
+	if (!cb_name || !priv)
+		return __get_lcb(ctx, cb_name, priv, NULL);
+
+	iname = teamd_loop_cb_name_find(ctx, cb_name, hash_str(cb_name));
+	if (!iname)
+		return NULL;
+	hash = lcb_hash(iname, priv);
+	hash_table_for_each_possible(lcb, hnode, &ctx->run_loop.lcb_table,
+				     hash, node) {
+		if (lcb->iname == iname && lcb->priv == priv)
+			return lcb;
+	}
+	return NULL;
 }
 
 static struct teamd_loop_callback *get_lcb_multi(struct teamd_context *ctx,
@@ -466,6 +833,9 @@ static struct teamd_loop_callback *get_lcb_multi(struct teamd_context *ctx,
 						 void *priv,
 						 struct teamd_loop_callback *last)
 {
+	/* There is at most one callback for given name and priv. */
+	if (cb_name && priv)
+		return last ? NULL : get_lcb(ctx, cb_name, priv);
 	return __get_lcb(ctx, cb_name, priv, last);
 }
 
@@ -500,22 +870,34 @@ static int __teamd_loop_callback_fd_add(struct teamd_context *ctx,
 		teamd_log_err("Failed alloc memory for callback.");
 		return -ENOMEM;
 	}
-	lcb->name = strdup(cb_name);
-	if (!lcb->name) {
+	lcb->iname = teamd_loop_cb_name_get(ctx, cb_name);
+	if (!lcb->iname) {
 		err = -ENOMEM;
 		goto lcb_free;
 	}
+	lcb->name = lcb->iname->name;
 	lcb->priv = priv;
 	lcb->func = func;
 	lcb->fd = fd;
 	lcb->fd_event = fd_event & TEAMD_LOOP_FD_EVENT_MASK;
+#ifdef ENABLE_EPOLL
+	err = teamd_loop_fd_get(ctx, lcb, tail);
+	if (err)
+		goto free_name;
+#endif
 	if (tail)
 		list_add_tail(&ctx->run_loop.callback_list, &lcb->list);
 	else
 		list_add(&ctx->run_loop.callback_list, &lcb->list);
+	hash_table_add(&ctx->run_loop.lcb_table, &lcb->node,
+		       lcb_hash(lcb->iname, lcb->priv));
 	teamd_log_dbg("Added loop callback: %s, %p", lcb->name, lcb->priv);
 	return 0;
 
+#ifdef ENABLE_EPOLL
+free_name:
+	teamd_loop_cb_name_put(ctx, lcb->iname);
+#endif
 lcb_free:
 	free(lcb);
 	return err;
@@ -539,23 +921,45 @@ int teamd_loop_callback_fd_add_tail(struct teamd_context *ctx,
 					    fd, fd_event, true);
 }
 
-static int __timerfd_reset(int fd, struct timespec *interval,
-			   struct timespec *initial)
+static void teamd_loop_callback_timer_func(struct teamd_context *ctx,
+					   struct teamd_timer *timer)
 {
-	struct itimerspec its;
+	struct teamd_loop_callback *lcb;
+	int err;
 
-	memset(&its, 0, sizeof(its));
+	lcb = get_container(timer, struct teamd_loop_callback, timer);
+	if (!lcb->enabled) {
+		/* Call it once the callback gets enabled again. */
+		lcb->timer_expired = true;
+		return;
+	}
+	if (!timespec_is_zero(&lcb->interval)) {
+		if (lcb->timer_aligned)
+			err = teamd_timer_forward_aligned(ctx, timer,
+							  &lcb->interval);
+		else
+			err = teamd_timer_forward(ctx, timer, &lcb->interval);
+		if (err)
+			teamd_log_err("Failed to forward periodic timer.");
+	}
+	teamd_run_loop_do_callback(ctx, lcb, TEAMD_LOOP_FD_EVENT_READ);
+}
+
+static int __timer_reset(struct teamd_context *ctx,
+			 struct teamd_loop_callback *lcb,
+			 struct timespec *interval, struct timespec *initial)
+{
+	lcb->timer_expired = false;
 	if (interval)
-		its.it_interval = *interval;
-	if (initial)
-		its.it_value = *initial;
+		lcb->interval = *interval;
 	else
-		its.it_value.tv_nsec = 1; /* to enable that */
-	if (timerfd_settime(fd, 0, &its, NULL) < 0) {
-		teamd_log_err("Failed to set timerfd.");
-		return -errno;
+		memset(&lcb->interval, 0, sizeof(lcb->interval));
+	/* Same as for timerfd, zero initial value disarms the timer. */
+	if (initial && timespec_is_zero(initial)) {
+		teamd_timer_del(ctx, &lcb->timer);
+		return 0;
 	}
-	return 0;
+	return teamd_timer_add(ctx, &lcb->timer, initial);
 }
 
 int teamd_loop_callback_timer_add_set(struct teamd_context *ctx,
@@ -564,28 +968,23 @@ int teamd_loop_callback_timer_add_set(struct teamd_context *ctx,
 				      struct timespec *interval,
 				      struct timespec *initial)
 {
+	struct teamd_loop_callback *lcb;
 	int err;
-	int fd;
 
-	fd = timerfd_create(CLOCK_MONOTONIC, 0);
-	if (fd < 0) {
-		teamd_log_err("Failed to create timerfd.");
-		return -errno;
-	}
+	err = teamd_loop_callback_fd_add(ctx, cb_name, priv, func, -1,
+					 TEAMD_LOOP_FD_EVENT_READ);
+	if (err)
+		return err;
+	lcb = get_lcb(ctx, cb_name, priv);
+	lcb->is_period = true;
+	teamd_timer_init(&lcb->timer, teamd_loop_callback_timer_func);
 	if (interval || initial) {
-		err = __timerfd_reset(fd, interval, initial);
+		err = __timer_reset(ctx, lcb, interval, initial);
 		if (err) {
-			close(fd);
+			teamd_loop_callback_del(ctx, cb_name, priv);
 			return err;
 		}
 	}
-	err = teamd_loop_callback_fd_add(ctx, cb_name, priv, func, fd,
-					 TEAMD_LOOP_FD_EVENT_READ);
-	if (err) {
-		close(fd);
-		return err;
-	}
-	get_lcb(ctx, cb_name, priv)->is_period = true;
 	return 0;
 }
 
@@ -597,11 +996,11 @@ int teamd_loop_callback_timer_add(struct teamd_context *ctx,
 						 NULL, NULL);
 }
 
-int teamd_loop_callback_timer_set(struct teamd_context *ctx,
-				  const char *cb_name,
-				  void *priv,
-				  struct timespec *interval,
-				  struct timespec *initial)
+static int __teamd_loop_callback_timer_set(struct teamd_context *ctx,
+					   const char *cb_name, void *priv,
+					   struct timespec *interval,
+					   struct timespec *initial,
+					   bool aligned)
 {
 	struct teamd_loop_callback *lcb;
 
@@ -616,7 +1015,34 @@ int teamd_loop_callback_timer_set(struct teamd_context *ctx,
 		teamd_log_err("Can't reset non-periodic callback.");
 		return -EINVAL;
 	}
-	return __timerfd_reset(lcb->fd, interval, initial);
+	lcb->timer_aligned = aligned;
+	return __timer_reset(ctx, lcb, interval, initial);
+}
+
+int teamd_loop_callback_timer_set(struct teamd_context *ctx,
+				  const char *cb_name,
+				  void *priv,
+				  struct timespec *interval,
+				  struct timespec *initial)
+{
+	return __teamd_loop_callback_timer_set(ctx, cb_name, priv, interval,
+					       initial, false);
+}
+
+/*
+ * Same as teamd_loop_callback_timer_set() except that after the initial
+ * expiry the callback is always fired on multiples of interval. That way
+ * all callbacks using the same interval share the same deadlines and are
+ * called one after another in a single timer wheel run.
+ */
+int teamd_loop_callback_timer_set_aligned(struct teamd_context *ctx,
+					  const char *cb_name,
+					  void *priv,
+					  struct timespec *interval,
+					  struct timespec *initial)
+{
+	return __teamd_loop_callback_timer_set(ctx, cb_name, priv, interval,
+					       initial, true);
 }
 
 void teamd_loop_callback_del(struct teamd_context *ctx, const char *cb_name,
@@ -628,33 +1054,61 @@ void teamd_loop_callback_del(struct teamd_context *ctx, const char *cb_name,
 
 	for_each_lcb_multi_match_safe(lcb, tmp, ctx, cb_name, priv) {
 		list_del(&lcb->list);
+		hash_table_del(&ctx->run_loop.lcb_table, &lcb->node);
+#ifdef ENABLE_EPOLL
+		teamd_loop_fd_put(ctx, lcb);
+#endif
 		if (lcb->is_period)
-			close(lcb->fd);
+			teamd_timer_del(ctx, &lcb->timer);
 		teamd_log_dbg("Removed loop callback: %s, %p",
 			      lcb->name, lcb->priv);
-		free(lcb->name);
+		teamd_loop_cb_name_put(ctx, lcb->iname);
 		free(lcb);
 		found = true;
 	}
+#ifndef ENABLE_EPOLL
 	if (found)
 		teamd_run_loop_restart(ctx);
-	else
+#endif
+	if (!found)
 		teamd_log_dbg("Callback named \"%s\" not found.", cb_name);
 }
 
+static int teamd_loop_callback_update(struct teamd_context *ctx,
+				      struct teamd_loop_callback *lcb)
+{
+	if (lcb->is_period) {
+		if (!lcb->enabled || !lcb->timer_expired)
+			return 0;
+		lcb->timer_expired = false;
+		return teamd_timer_add(ctx, &lcb->timer, NULL);
+	}
+#ifdef ENABLE_EPOLL
+	return teamd_loop_fd_update(ctx, lcb->lfd);
+#else
+	return 0;
+#endif
+}
+
 int teamd_loop_callback_enable(struct teamd_context *ctx, const char *cb_name,
 			       void *priv)
 {
 	struct teamd_loop_callback *lcb;
 	bool found = false;
+	int err;
 
 	for_each_lcb_multi_match(lcb, ctx, cb_name, priv) {
 		lcb->enabled = true;
 		found = true;
+		err = teamd_loop_callback_update(ctx, lcb);
+		if (err)
+			return err;
 	}
 	if (!found)
 		return -ENOENT;
+#ifndef ENABLE_EPOLL
 	teamd_run_loop_restart(ctx);
+#endif
 	return 0;
 }
 
@@ -663,14 +1117,20 @@ int teamd_loop_callback_disable(struct teamd_context *ctx, const char *cb_name,
 {
 	struct teamd_loop_callback *lcb;
 	bool found = false;
+	int err;
 
 	for_each_lcb_multi_match(lcb, ctx, cb_name, priv) {
 		lcb->enabled = false;
 		found = true;
+		err = teamd_loop_callback_update(ctx, lcb);
+		if (err)
+			return err;
 	}
 	if (!found)
 		return -ENOENT;
+#ifndef ENABLE_EPOLL
 	teamd_run_loop_restart(ctx);
+#endif
 	return 0;
 }
 
@@ -706,25 +1166,77 @@ static int callback_libteam_event(struct teamd_context *ctx, int events,
 #define DAEMON_CB_NAME "daemon"
 #define LIBTEAM_EVENTS_CB_NAME "libteam_events"
 
+#ifdef ENABLE_EPOLL
+static int teamd_run_loop_epoll_init(struct teamd_context *ctx)
+{
+	struct epoll_event ev;
+	int err;
+
+	list_init(&ctx->run_loop.dead_fd_list);
+	ctx->run_loop.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (ctx->run_loop.epoll_fd < 0) {
+		teamd_log_err("Failed to create epoll instance.");
+		return -errno;
+	}
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	if (epoll_ctl(ctx->run_loop.epoll_fd, EPOLL_CTL_ADD,
+		      ctx->run_loop.ctrl_pipe_r, &ev) < 0) {
+		teamd_log_err("Failed to add control pipe to epoll set.");
+		err = -errno;
+		close(ctx->run_loop.epoll_fd);
+		return err;
+	}
+	return 0;
+}
+
+static void teamd_run_loop_epoll_fini(struct teamd_context *ctx)
+{
+	close(ctx->run_loop.epoll_fd);
+}
+#else
+static int teamd_run_loop_epoll_init(struct teamd_context *ctx)
+{
+	return 0;
+}
+
+static void teamd_run_loop_epoll_fini(struct teamd_context *ctx)
+{
+}
+#endif
+
 static int teamd_run_loop_init(struct teamd_context *ctx)
 {
 	int fds[2];
 	int err;
 
 	list_init(&ctx->run_loop.callback_list);
-	err = pipe(fds);
+	err = hash_table_init(&ctx->run_loop.name_table);
 	if (err)
-		return -errno;
+		return err;
+	err = hash_table_init(&ctx->run_loop.lcb_table);
+	if (err)
+		goto name_table_fini;
+	err = pipe(fds);
+	if (err) {
+		err = -errno;
+		goto lcb_table_fini;
+	}
 	ctx->run_loop.ctrl_pipe_r = fds[0];
 	ctx->run_loop.ctrl_pipe_w = fds[1];
 
+	err = teamd_run_loop_epoll_init(ctx);
+	if (err)
+		goto close_pipe;
+
 	err = teamd_loop_callback_fd_add(ctx, DAEMON_CB_NAME, ctx,
 					 callback_daemon_signal,
 					 daemon_signal_fd(),
 					 TEAMD_LOOP_FD_EVENT_READ);
 	if (err) {
 		teamd_log_err("Failed to add daemon loop callback");
-		goto close_pipe;
+		goto epoll_fini;
 	}
 
 	err = teamd_loop_callback_fd_add(ctx, LIBTEAM_EVENTS_CB_NAME, ctx,
@@ -739,23 +1251,41 @@ static int teamd_run_loop_init(struct teamd_context *ctx)
 	teamd_loop_callback_enable(ctx, DAEMON_CB_NAME, ctx);
 	teamd_loop_callback_enable(ctx, LIBTEAM_EVENTS_CB_NAME, ctx);
 
+	err = teamd_timer_wheel_init(ctx);
+	if (err) {
+		teamd_log_err("Failed to init timer wheel");
+		goto del_libteam_events_callback;
+	}
+
 	return 0;
 
+del_libteam_events_callback:
+	teamd_loop_callback_del(ctx, LIBTEAM_EVENTS_CB_NAME, ctx);
 del_daemon_callback:
 	teamd_loop_callback_del(ctx, DAEMON_CB_NAME, ctx);
 
+epoll_fini:
+	teamd_run_loop_epoll_fini(ctx);
 close_pipe:
 	close(ctx->run_loop.ctrl_pipe_r);
 	close(ctx->run_loop.ctrl_pipe_w);
+lcb_table_fini:
+	hash_table_fini(&ctx->run_loop.lcb_table);
+name_table_fini:
+	hash_table_fini(&ctx->run_loop.name_table);
 	return err;
 }
 
 static void teamd_run_loop_fini(struct teamd_context *ctx)
 {
+	teamd_timer_wheel_fini(ctx);
 	teamd_loop_callback_del(ctx, LIBTEAM_EVENTS_CB_NAME, NULL);
 	teamd_loop_callback_del(ctx, DAEMON_CB_NAME, ctx);
+	teamd_run_loop_epoll_fini(ctx);
 	close(ctx->run_loop.ctrl_pipe_r);
 	close(ctx->run_loop.ctrl_pipe_w);
+	hash_table_fini(&ctx->run_loop.lcb_table);
+	hash_table_fini(&ctx->run_loop.name_table);
 }
 
 static int parse_hwaddr(const char *hwaddr_str, char **phwaddr,
@@ -1216,6 +1746,7 @@ static int teamd_init(struct teamd_context *ctx)
 		team_set_log_priority(ctx->th, LOG_DEBUG);
 
 	team_set_log_fn(ctx->th, libteam_log_daemon);
+	team_set_ifinfo_filter(ctx->th, true);
 
 	ctx->ifindex = team_ifname2ifindex(ctx->th, ctx->team_devname);
 	if (ctx->ifindex && ctx->take_over)
@@ -1639,6 +2170,16 @@ static void teamd_init_debug_level(struct teamd_context *ctx)
 	daemon_set_verbosity(LOG_DEBUG);
 }
 
+static void teamd_init_pkt_rx_ring(struct teamd_context *ctx)
+{
+	int err;
+
+	err = teamd_config_bool_get(ctx, &ctx->pkt_rx_ring, "$.rx_ring");
+	if (err)
+		ctx->pkt_rx_ring = false;
+	teamd_log_dbg("Using rx_ring \"%d\".", ctx->pkt_rx_ring);
+}
+
 static int teamd_context_init(struct teamd_context **pctx)
 {
 	struct teamd_context *ctx;
@@ -1807,6 +2348,7 @@ int main(int argc, char **argv)
 	}
 
 	teamd_init_debug_level(ctx);
+	teamd_init_pkt_rx_ring(ctx);
 
 	err = teamd_get_devname(ctx, ctx->cmd == DAEMON_CMD_RUN);
 	if (err)
@@ -35,6 +35,7 @@
 #include <linux/if_packet.h>
 #include <team.h>
 #include <private/list.h>
+#include <private/hash.h>
 
 #include "config.h"
 
@@ -94,6 +95,8 @@ enum teamd_command {
 
 struct teamd_runner;
 struct teamd_context;
+struct teamd_timer_wheel;
+struct lw_ap_engine;
 
 struct teamd_context {
 	enum teamd_command		cmd;
@@ -127,9 +130,17 @@ struct teamd_context {
 	bool				hwaddr_explicit;
 	struct {
 		struct list_item		callback_list;
+		struct hash_table		lcb_table;
+		struct hash_table		name_table;
 		int				ctrl_pipe_r;
 		int				ctrl_pipe_w;
 		int				err;
+#ifdef ENABLE_EPOLL
+		int				epoll_fd;
+		bool				in_dispatch;
+		unsigned int			del_gen;
+		struct list_item		dead_fd_list;
+#endif
 	} run_loop;
 #ifdef ENABLE_DBUS
 	struct {
@@ -151,6 +162,9 @@ struct teamd_context {
 		struct sockaddr_un	addr;
 		struct list_item	acc_conn_list;
 	} usock;
+	struct teamd_timer_wheel *	timer_wheel;
+	struct lw_ap_engine *		lw_ap_engine;
+	bool				pkt_rx_ring;
 	struct {
 		struct list_item	work_list;
 		int			pipe_r;
@@ -255,6 +269,10 @@ int teamd_loop_callback_timer_set(struct teamd_context *ctx,
 				  const char *cb_name, void *priv,
 				  struct timespec *interval,
 				  struct timespec *initial);
+int teamd_loop_callback_timer_set_aligned(struct teamd_context *ctx,
+					  const char *cb_name, void *priv,
+					  struct timespec *interval,
+					  struct timespec *initial);
 void teamd_loop_callback_del(struct teamd_context *ctx, const char *cb_name,
 			     void *priv);
 int teamd_loop_callback_enable(struct teamd_context *ctx, const char *cb_name,
@@ -357,7 +375,41 @@ void teamd_balancer_port_removed(struct teamd_balancer *tb,
 				 struct teamd_port *tdport);
 
 int teamd_hash_func_set(struct teamd_context *ctx);
+void teamd_hash_func_unset(struct teamd_context *ctx);
+
+/* TPACKET_V3 receive ring, map is NULL if frames are copied by recvmsg */
+struct teamd_packet_ring {
+	void *map;
+	size_t map_len;
+	size_t block_size;
+	unsigned int block_count;
+	unsigned int block_idx;
+};
 
+struct teamd_packet {
+	void *data;
+	size_t len;
+	struct sockaddr_ll *ll_from;
+	bool vlan_valid;
+	unsigned short vlan_tci;
+};
+
+typedef int (*teamd_packet_process_func_t)(struct teamd_packet *packet,
+					   void *priv);
+
+void teamd_packet_ring_setup(int sock, struct teamd_packet_ring *ring);
+void teamd_packet_ring_teardown(struct teamd_packet_ring *ring);
+int teamd_packet_recv(int sock, struct teamd_packet_ring *ring,
+		      void *buf, size_t len, unsigned int budget,
+		      teamd_packet_process_func_t func, void *priv);
+int teamd_packet_sock_bind(int sock, const uint32_t ifindex,
+			   const unsigned short family);
+int teamd_packet_sock_open_ring(int type, int *sock_p,
+				struct teamd_packet_ring *ring,
+				const uint32_t ifindex,
+				const unsigned short family,
+				const struct sock_fprog *fprog,
+				const struct sock_fprog *alt_fprog);
 int teamd_packet_sock_open_type(int type, int *sock_p, const uint32_t ifindex,
 				const unsigned short family,
 				const struct sock_fprog *fprog,
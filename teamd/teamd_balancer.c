@@ -27,10 +27,13 @@
 
 #include "teamd.h"
 #include "teamd_config.h"
+#include "teamd_state.h"
 
 struct tb_stats {
 	uint64_t last_bytes;
 	uint64_t curr_bytes;
+	uint64_t load; /* smoothed delta */
+	uint64_t peak;
 	bool initialized;
 };
 
@@ -38,8 +41,12 @@ struct tb_hash_info {
 	uint8_t hash;
 	struct tb_stats stats;
 	struct teamd_port *tdport;
+	uint32_t migration_count;
 	struct {
-		bool processed;
+		uint64_t load;
+		struct tb_port_info *tbpi;
+		bool moved;
+		bool migrated; /* mapped to a different port in this run */
 	} rebalance;
 };
 
@@ -49,6 +56,7 @@ struct tb_port_info {
 	struct teamd_port *tdport;
 	struct {
 		uint64_t bytes;
+		uint32_t weight;
 		bool unusable;
 	} rebalance;
 };
@@ -58,9 +66,21 @@ struct tb_port_info {
 struct teamd_balancer {
 	struct teamd_context *ctx;
 	bool tx_balancing_enabled;
+	bool weighted;
+	bool stable;
 	uint32_t balancing_interval;
+	uint32_t imbalance_threshold;
+	uint32_t max_remaps;
+	uint32_t ewma_weight; /* in percent */
+	bool ewma_peak;
 	struct tb_hash_info hash_info[HASH_COUNT];
 	struct list_item port_info_list;
+	unsigned int port_count;
+	/* Rebalance scratch space, hashes are kept in max-heap by load,
+	 * ports in min-heap by load assigned so far.
+	 */
+	void *hash_heap[HASH_COUNT];
+	void **port_heap;
 };
 
 static struct tb_port_info *get_tb_port_info(struct teamd_balancer *tb,
@@ -106,6 +126,40 @@ static void tb_stats_all_update_last(struct teamd_balancer *tb)
 		tb_stats_update_last(&tb->hash_info[i].stats);
 }
 
+/* Feed the last delta to exponentially weighted moving average. Peak
+ * follows increases immediately and decays the same way as average.
+ */
+static void tb_stats_update_load(struct teamd_balancer *tb,
+				 struct tb_stats *stats)
+{
+	uint64_t delta = tb_stats_get_delta(stats);
+	uint32_t weight = tb->ewma_weight;
+
+	stats->load = (delta * weight + stats->load * (100 - weight)) / 100;
+	if (delta >= stats->peak)
+		stats->peak = delta;
+	else
+		stats->peak = (delta * weight +
+			       stats->peak * (100 - weight)) / 100;
+}
+
+static void tb_stats_all_update_load(struct teamd_balancer *tb)
+{
+	struct tb_port_info *tbpi;
+	int i;
+
+	list_for_each_node_entry(tbpi, &tb->port_info_list, list)
+		tb_stats_update_load(tb, &tbpi->stats);
+	for (i = 0; i < HASH_COUNT; i++)
+		tb_stats_update_load(tb, &tb->hash_info[i].stats);
+}
+
+static uint64_t tb_stats_get_load(struct teamd_balancer *tb,
+				  struct tb_stats *stats)
+{
+	return tb->ewma_peak ? stats->peak : stats->load;
+}
+
 static void tb_stats_update_hash(struct teamd_balancer *tb,
 				 uint8_t hash, uint64_t bytes)
 {
@@ -128,50 +182,140 @@ static void tb_hash_to_port_map_update(struct teamd_balancer *tb,
 	tb->hash_info[hash].tdport = tdport;
 }
 
-static struct tb_port_info *tb_get_least_loaded_port(struct teamd_balancer *tb)
-{
-	struct tb_port_info *tbpi;
-	struct tb_port_info *best_tbpi = NULL;
+typedef bool (*tb_heap_before_t)(void *a, void *b);
 
-	list_for_each_node_entry(tbpi, &tb->port_info_list, list) {
-		if (tbpi->rebalance.unusable)
-			continue;
-		if (!best_tbpi ||
-		    tbpi->rebalance.bytes < best_tbpi->rebalance.bytes)
-			best_tbpi = tbpi;
+static void tb_heap_sift_down(void **heap, unsigned int count, unsigned int i,
+			      tb_heap_before_t before)
+{
+	unsigned int best;
+	unsigned int left;
+	void *tmp;
+
+	for (;;) {
+		best = i;
+		left = 2 * i + 1;
+		if (left < count && before(heap[left], heap[best]))
+			best = left;
+		if (left + 1 < count && before(heap[left + 1], heap[best]))
+			best = left + 1;
+		if (best == i)
+			return;
+		tmp = heap[i];
+		heap[i] = heap[best];
+		heap[best] = tmp;
+		i = best;
 	}
-	return best_tbpi;
 }
 
-static struct tb_hash_info *tb_get_biggest_unprocessed_hash(struct teamd_balancer *tb)
+static void tb_heap_build(void **heap, unsigned int count,
+			  tb_heap_before_t before)
+{
+	unsigned int i;
+
+	for (i = count / 2; i-- > 0;)
+		tb_heap_sift_down(heap, count, i, before);
+}
+
+static void tb_heap_pop(void **heap, unsigned int *count,
+			tb_heap_before_t before)
+{
+	heap[0] = heap[--(*count)];
+	tb_heap_sift_down(heap, *count, 0, before);
+}
+
+static bool tb_hash_heap_before(void *a, void *b)
+{
+	struct tb_hash_info *tbhi_a = a;
+	struct tb_hash_info *tbhi_b = b;
+
+	return tbhi_a->rebalance.load > tbhi_b->rebalance.load;
+}
+
+static bool tb_port_heap_before(void *a, void *b)
+{
+	struct tb_port_info *tbpi_a = a;
+	struct tb_port_info *tbpi_b = b;
+
+	return tbpi_a->rebalance.bytes < tbpi_b->rebalance.bytes;
+}
+
+/* Compare utilisation, that is load normalized by port speed */
+static bool tb_port_heap_weighted_before(void *a, void *b)
+{
+	struct tb_port_info *tbpi_a = a;
+	struct tb_port_info *tbpi_b = b;
+
+	return (double) tbpi_a->rebalance.bytes / tbpi_a->rebalance.weight <
+	       (double) tbpi_b->rebalance.bytes / tbpi_b->rebalance.weight;
+}
+
+/* Returns zero in case link is down or speed is unknown */
+static uint32_t tb_port_weight(struct tb_port_info *tbpi)
+{
+	uint32_t speed = team_get_port_speed(tbpi->tdport->team_port);
+
+	if (speed == (uint32_t) -1)
+		return 0;
+	return speed;
+}
+
+/* Put hashes to the heap. In stable mode, hashes which are already mapped
+ * to a usable port stay where they are and only account to the port load.
+ */
+static unsigned int tb_hash_heap_init(struct teamd_balancer *tb)
 {
 	struct tb_hash_info *tbhi;
-	struct tb_hash_info *best_tbhi = NULL;
+	struct tb_port_info *tbpi;
+	unsigned int count = 0;
 	int i;
 
 	for (i = 0; i < HASH_COUNT; i++) {
 		tbhi = &tb->hash_info[i];
-		if (tbhi->rebalance.processed)
-			continue;
-		if (!best_tbhi || tb_stats_get_delta(&tbhi->stats) >
-				  tb_stats_get_delta(&best_tbhi->stats))
-			best_tbhi = tbhi;
+		tbhi->rebalance.load = tb_stats_get_load(tb, &tbhi->stats);
+		tbhi->rebalance.tbpi = NULL;
+		tbhi->rebalance.moved = false;
+		tbhi->rebalance.migrated = false;
+		if (tb->stable && tbhi->tdport) {
+			tbpi = get_tb_port_info(tb, tbhi->tdport);
+			if (tbpi && !tbpi->rebalance.unusable) {
+				tbpi->rebalance.bytes += tbhi->rebalance.load;
+				tbhi->rebalance.tbpi = tbpi;
+				continue;
+			}
+		}
+		tb->hash_heap[count++] = tbhi;
 	}
-	return best_tbhi;
+	tb_heap_build(tb->hash_heap, count, tb_hash_heap_before);
+	return count;
 }
 
-static void tb_clear_rebalance_data(struct teamd_balancer *tb)
+static unsigned int tb_port_heap_init(struct teamd_balancer *tb)
 {
 	struct tb_port_info *tbpi;
-	int i;
+	unsigned int count = 0;
+	bool weight_known = false;
 
 	list_for_each_node_entry(tbpi, &tb->port_info_list, list) {
 		tbpi->rebalance.bytes = 0;
+		tbpi->rebalance.weight = tb->weighted ? tb_port_weight(tbpi) : 1;
 		tbpi->rebalance.unusable = false;
+		if (tbpi->rebalance.weight)
+			weight_known = true;
 	}
-	for (i = 0; i < HASH_COUNT; i++) {
-		tb->hash_info[i].rebalance.processed = false;
+	list_for_each_node_entry(tbpi, &tb->port_info_list, list) {
+		if (!tbpi->rebalance.weight) {
+			/* Do not put anything on ports with unknown speed
+			 * unless there is no other choice.
+			 */
+			if (weight_known) {
+				tbpi->rebalance.unusable = true;
+				continue;
+			}
+			tbpi->rebalance.weight = 1;
+		}
+		tb->port_heap[count++] = tbpi;
 	}
+	return count;
 }
 
 static int tb_hash_to_port_remap(struct team_handle *th,
@@ -192,44 +336,192 @@ static int tb_hash_to_port_remap(struct team_handle *th,
 	err = team_set_option_value_u32(th, option, new_tdport->ifindex);
 	if (err)
 		return err;
-	teamd_log_dbg("Remapped hash \"%u\" (delta %" PRIu64 ") to port %s.",
-		      hash, tb_stats_get_delta(&tbhi->stats),
+	/* Accounted once the batch is committed */
+	if (tbhi->tdport)
+		tbhi->rebalance.migrated = true;
+	teamd_log_dbg("Remapping hash \"%u\" (load %" PRIu64 ") to port %s.",
+		      hash, tbhi->rebalance.load,
 		      new_tdport->ifname);
 	return 0;
 }
 
-static int tb_rebalance(struct teamd_balancer *tb, struct team_handle *th)
+/* LPT scheduling: biggest hash goes to the least loaded port. */
+static void tb_rebalance_lpt(struct teamd_balancer *tb, struct team_handle *th,
+			     unsigned int hash_count, unsigned int port_count,
+			     tb_heap_before_t port_before)
 {
-	int err;
 	struct tb_hash_info *tbhi;
 	struct tb_port_info *tbpi;
+	int err;
 
-	if (!tb->tx_balancing_enabled)
-		return 0;
-
-	tb_clear_rebalance_data(tb);
-
-	while ((tbhi = tb_get_biggest_unprocessed_hash(tb)) &&
-	       (tbpi = tb_get_least_loaded_port(tb))) {
-		/* Do not remap zero delta hashes */
-		if (tbhi->tdport && !tb_stats_get_delta(&tbhi->stats)) {
-			tbhi->rebalance.processed = true;
+	while (hash_count && port_count) {
+		tbhi = tb->hash_heap[0];
+		tbpi = tb->port_heap[0];
+		/* Do not remap zero load hashes */
+		if (tbhi->tdport && !tbhi->rebalance.load) {
+			tb_heap_pop(tb->hash_heap, &hash_count,
+				    tb_hash_heap_before);
 			continue;
 		}
 		err = tb_hash_to_port_remap(th, tbhi, tbpi);
 		if (err) {
 			tbpi->rebalance.unusable = true;
+			tb_heap_pop(tb->port_heap, &port_count, port_before);
+			continue;
+		}
+		tbpi->rebalance.bytes += tbhi->rebalance.load;
+		tbhi->rebalance.tbpi = tbpi;
+		tb_heap_sift_down(tb->port_heap, port_count, 0, port_before);
+		tb_heap_pop(tb->hash_heap, &hash_count, tb_hash_heap_before);
+	}
+}
+
+static double tb_port_load(struct tb_port_info *tbpi)
+{
+	return (double) tbpi->rebalance.bytes / tbpi->rebalance.weight;
+}
+
+/* Hashes which would close less than 1/TB_MIGRATE_MIN_PART of the gap
+ * are not worth moving as long as there is a bigger one.
+ */
+#define TB_MIGRATE_MIN_PART 4
+
+/* Pick a hash to move from the most loaded port to the least loaded one.
+ * Only hashes which lower the difference are considered. The smallest one
+ * which closes a meaningful part of the gap is preferred, so elephants stay
+ * where they are and one remap still makes a real progress. If all hashes
+ * are too small for that, the biggest one is taken.
+ */
+static struct tb_hash_info *tb_get_hash_to_migrate(struct teamd_balancer *tb,
+						   struct tb_port_info *from,
+						   struct tb_port_info *to,
+						   double gap)
+{
+	struct tb_hash_info *tbhi;
+	struct tb_hash_info *small_tbhi = NULL;
+	struct tb_hash_info *big_tbhi = NULL;
+	double factor;
+	double change;
+	int i;
+
+	factor = 1.0 / from->rebalance.weight + 1.0 / to->rebalance.weight;
+	for (i = 0; i < HASH_COUNT; i++) {
+		tbhi = &tb->hash_info[i];
+		if (tbhi->rebalance.tbpi != from || tbhi->rebalance.moved ||
+		    !tbhi->rebalance.load)
+			continue;
+		change = tbhi->rebalance.load * factor;
+		if (change >= 2 * gap)
+			continue;
+		if (change * TB_MIGRATE_MIN_PART >= gap) {
+			if (!small_tbhi ||
+			    tbhi->rebalance.load < small_tbhi->rebalance.load)
+				small_tbhi = tbhi;
+		} else {
+			if (!big_tbhi ||
+			    tbhi->rebalance.load > big_tbhi->rebalance.load)
+				big_tbhi = tbhi;
+		}
+	}
+	return small_tbhi ? small_tbhi : big_tbhi;
+}
+
+/* Move hashes from the most loaded port to the least loaded one until
+ * the imbalance gets under threshold or the remap budget is exhausted.
+ */
+static void tb_rebalance_migrate(struct teamd_balancer *tb,
+				 struct team_handle *th)
+{
+	struct tb_hash_info *tbhi;
+	struct tb_port_info *tbpi;
+	struct tb_port_info *max_tbpi;
+	struct tb_port_info *min_tbpi;
+	unsigned int remaps = 0;
+	double gap;
+	int err;
+
+	while (!tb->max_remaps || remaps < tb->max_remaps) {
+		max_tbpi = NULL;
+		min_tbpi = NULL;
+		list_for_each_node_entry(tbpi, &tb->port_info_list, list) {
+			if (tbpi->rebalance.unusable)
+				continue;
+			if (!max_tbpi || tb_port_load(tbpi) > tb_port_load(max_tbpi))
+				max_tbpi = tbpi;
+			if (!min_tbpi || tb_port_load(tbpi) < tb_port_load(min_tbpi))
+				min_tbpi = tbpi;
+		}
+		if (max_tbpi == min_tbpi)
+			return;
+		gap = tb_port_load(max_tbpi) - tb_port_load(min_tbpi);
+		if (gap * 100 <= tb_port_load(max_tbpi) * tb->imbalance_threshold)
+			return;
+		tbhi = tb_get_hash_to_migrate(tb, max_tbpi, min_tbpi, gap);
+		if (!tbhi)
+			return;
+		err = tb_hash_to_port_remap(th, tbhi, min_tbpi);
+		if (err) {
+			min_tbpi->rebalance.unusable = true;
 			continue;
 		}
-		tbpi->rebalance.bytes += tb_stats_get_delta(&tbhi->stats);
-		tbhi->rebalance.processed = true;
+		max_tbpi->rebalance.bytes -= tbhi->rebalance.load;
+		min_tbpi->rebalance.bytes += tbhi->rebalance.load;
+		tbhi->rebalance.tbpi = min_tbpi;
+		tbhi->rebalance.moved = true;
+		remaps++;
 	}
+}
+
+static int tb_rebalance(struct teamd_balancer *tb, struct team_handle *th)
+{
+	int err;
+	struct tb_port_info *tbpi;
+	unsigned int hash_count;
+	unsigned int port_count;
+	tb_heap_before_t port_before;
+	int i;
+
+	if (!tb->tx_balancing_enabled)
+		return 0;
+
+	port_before = tb->weighted ? tb_port_heap_weighted_before :
+				     tb_port_heap_before;
+
+	port_count = tb_port_heap_init(tb);
+	hash_count = tb_hash_heap_init(tb);
+	tb_heap_build(tb->port_heap, port_count, port_before);
+
+	/* Send all remaps to kernel in one go. */
+	err = team_option_batch_begin(th);
+	if (err)
+		return err;
+
+	tb_rebalance_lpt(tb, th, hash_count, port_count, port_before);
+	if (tb->stable)
+		tb_rebalance_migrate(tb, th);
+
+	err = team_option_batch_commit(th);
+	if (err) {
+		teamd_log_err("Failed to set hash to port mapping.");
+		return err;
+	}
+
+	for (i = 0; i < HASH_COUNT; i++)
+		if (tb->hash_info[i].rebalance.migrated)
+			tb->hash_info[i].migration_count++;
 
 	list_for_each_node_entry(tbpi, &tb->port_info_list, list) {
 		if (tbpi->rebalance.unusable)
 			continue;
-		teamd_log_dbg("Port %s rebalanced, delta: %" PRIu64,
-			      tbpi->tdport->ifname, tbpi->rebalance.bytes);
+		if (tb->weighted)
+			teamd_log_dbg("Port %s rebalanced, load: %" PRIu64 " (measured %" PRIu64 "), weight: %u",
+				      tbpi->tdport->ifname, tbpi->rebalance.bytes,
+				      tb_stats_get_load(tb, &tbpi->stats),
+				      tbpi->rebalance.weight);
+		else
+			teamd_log_dbg("Port %s rebalanced, load: %" PRIu64 " (measured %" PRIu64 ")",
+				      tbpi->tdport->ifname, tbpi->rebalance.bytes,
+				      tb_stats_get_load(tb, &tbpi->stats));
 	}
 	return 0;
 }
@@ -245,6 +537,7 @@ static int tb_option_change_handler_func(struct team_handle *th, void *priv,
 	struct teamd_context *ctx = tb->ctx;
 	struct team_option *option;
 	bool rebalance_needed = false;
+	bool stats_updated = false;
 
 	team_for_each_option(option, ctx->th) {
 		char *name = team_get_option_name(option);
@@ -307,6 +600,7 @@ static int tb_option_change_handler_func(struct team_handle *th, void *priv,
 				      array_index, lb_stats->tx_bytes);
 			tb_stats_update_hash(tb, array_index,
 					     lb_stats->tx_bytes);
+			stats_updated = true;
 		}
 		else if (!strcmp(name, "lb_port_stats")) {
 			struct teamd_port *tdport;
@@ -323,23 +617,32 @@ static int tb_option_change_handler_func(struct team_handle *th, void *priv,
 				      tdport->ifname, lb_stats->tx_bytes);
 			tb_stats_update_port(tb, tdport,
 					     lb_stats->tx_bytes);
+			stats_updated = true;
 		}
 	}
 
+	/* Keep the smoothed load in case nothing new was measured */
+	if (stats_updated)
+		tb_stats_all_update_load(tb);
+
 	return tb_rebalance(tb, th);
 }
 
-static bool tb_get_enable_tx_balancing(struct teamd_context *ctx)
+static void tb_get_tx_balancer(struct teamd_context *ctx,
+			       struct teamd_balancer *tb)
 {
 	int err;
 	const char *tx_balancer_name;
 
 	err = teamd_config_string_get(ctx, &tx_balancer_name, "$.runner.tx_balancer.name");
 	if (err)
-		return false; /* disabled by default */
-	if (!strcmp(tx_balancer_name, "basic"))
-		return true;
-	return false;
+		return; /* disabled by default */
+	if (!strcmp(tx_balancer_name, "basic")) {
+		tb->tx_balancing_enabled = true;
+	} else if (!strcmp(tx_balancer_name, "weighted")) {
+		tb->tx_balancing_enabled = true;
+		tb->weighted = true;
+	}
 }
 
 static uint32_t tb_get_balancing_interval(struct teamd_context *ctx)
@@ -353,6 +656,35 @@ static uint32_t tb_get_balancing_interval(struct teamd_context *ctx)
 	return balancing_interval;
 }
 
+static void tb_get_stability(struct teamd_context *ctx,
+			     struct teamd_balancer *tb)
+{
+	int err;
+	int tmp;
+
+	err = teamd_config_int_get(ctx, &tmp, "$.runner.tx_balancer.imbalance_threshold");
+	if (!err && tmp > 0)
+		tb->imbalance_threshold = tmp;
+	err = teamd_config_int_get(ctx, &tmp, "$.runner.tx_balancer.max_remaps");
+	if (!err && tmp > 0)
+		tb->max_remaps = tmp;
+	tb->stable = tb->imbalance_threshold || tb->max_remaps;
+}
+
+static void tb_get_ewma(struct teamd_context *ctx, struct teamd_balancer *tb)
+{
+	int err;
+	int tmp;
+
+	err = teamd_config_int_get(ctx, &tmp, "$.runner.tx_balancer.ewma_weight");
+	if (err || tmp < 1 || tmp > 100)
+		tmp = 100; /* no smoothing by default */
+	tb->ewma_weight = tmp;
+	err = teamd_config_bool_get(ctx, &tb->ewma_peak, "$.runner.tx_balancer.ewma_peak");
+	if (err)
+		tb->ewma_peak = false;
+}
+
 static int tb_set_lb_tx_method(struct team_handle *th,
 			       struct teamd_balancer *tb)
 {
@@ -377,6 +709,77 @@ static int tb_set_lb_stats_refresh_interval(struct team_handle *th,
 	return team_set_option_value_u32(th, option, tb->balancing_interval);
 }
 
+static int tb_hash_state_port_get(struct teamd_context *ctx,
+				  struct team_state_gsc *gsc,
+				  void *priv)
+{
+	struct tb_hash_info *tbhi = priv;
+
+	gsc->data.str_val.ptr = tbhi->tdport ? tbhi->tdport->ifname : "";
+	return 0;
+}
+
+static int tb_hash_state_migration_count_get(struct teamd_context *ctx,
+					     struct team_state_gsc *gsc,
+					     void *priv)
+{
+	struct tb_hash_info *tbhi = priv;
+
+	gsc->data.int_val = tbhi->migration_count;
+	return 0;
+}
+
+static const struct teamd_state_val tb_hash_state_vals[] = {
+	{
+		.subpath = "port",
+		.type = TEAMD_STATE_ITEM_TYPE_STRING,
+		.getter = tb_hash_state_port_get,
+	},
+	{
+		.subpath = "migration_count",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = tb_hash_state_migration_count_get,
+	},
+};
+
+static const struct teamd_state_val tb_hash_state_vg = {
+	.vals = tb_hash_state_vals,
+	.vals_count = ARRAY_SIZE(tb_hash_state_vals),
+};
+
+static int tb_state_register(struct teamd_context *ctx,
+			     struct teamd_balancer *tb)
+{
+	int err;
+	int i;
+
+	for (i = 0; i < HASH_COUNT; i++) {
+		err = teamd_state_val_register_ex(ctx, &tb_hash_state_vg,
+						  &tb->hash_info[i], NULL,
+						  "tx_balancer.hashes.hash_%d",
+						  i);
+		if (err)
+			goto rollback;
+	}
+	return 0;
+
+rollback:
+	while (--i >= 0)
+		teamd_state_val_unregister(ctx, &tb_hash_state_vg,
+					   &tb->hash_info[i]);
+	return err;
+}
+
+static void tb_state_unregister(struct teamd_context *ctx,
+				struct teamd_balancer *tb)
+{
+	int i;
+
+	for (i = 0; i < HASH_COUNT; i++)
+		teamd_state_val_unregister(ctx, &tb_hash_state_vg,
+					   &tb->hash_info[i]);
+}
+
 static const struct team_change_handler tb_option_change_handler = {
 	.func = tb_option_change_handler_func,
 	.type_mask = TEAM_OPTION_CHANGE,
@@ -396,8 +799,10 @@ int teamd_balancer_init(struct teamd_context *ctx, struct teamd_balancer **ptb)
 	for (i = 0; i < HASH_COUNT; i++)
 		tb->hash_info[i].hash = i;
 
-	tb->tx_balancing_enabled = tb_get_enable_tx_balancing(ctx);
+	tb_get_tx_balancer(ctx, tb);
 	tb->balancing_interval = tb_get_balancing_interval(ctx);
+	tb_get_stability(ctx, tb);
+	tb_get_ewma(ctx, tb);
 
 	err = tb_set_lb_tx_method(ctx->th, tb);
 	if (err) {
@@ -405,8 +810,9 @@ int teamd_balancer_init(struct teamd_context *ctx, struct teamd_balancer **ptb)
 		goto err_set_lb_tx_method;
 	}
 
-	teamd_log_info("TX balancing %s.", tb->tx_balancing_enabled ?
-					   "enabled" : "disabled");
+	teamd_log_info("TX balancing %s.", !tb->tx_balancing_enabled ? "disabled" :
+					   tb->weighted ? "enabled (weighted)" :
+							  "enabled");
 	if (tb->tx_balancing_enabled) {
 		err = tb_set_lb_stats_refresh_interval(ctx->th, tb);
 		if (err) {
@@ -414,6 +820,13 @@ int teamd_balancer_init(struct teamd_context *ctx, struct teamd_balancer **ptb)
 			goto err_set_lb_stats_refresh_interval;
 		}
 		teamd_log_info("Balancing interval %u.", tb->balancing_interval);
+		if (tb->stable)
+			teamd_log_info("Imbalance threshold %u%%, max remaps %u.",
+				       tb->imbalance_threshold, tb->max_remaps);
+		if (tb->ewma_weight != 100 || tb->ewma_peak)
+			teamd_log_info("Load smoothing weight %u%%%s.",
+				       tb->ewma_weight,
+				       tb->ewma_peak ? ", using peak" : "");
 	}
 
 	tb->ctx = ctx;
@@ -423,9 +836,18 @@ int teamd_balancer_init(struct teamd_context *ctx, struct teamd_balancer **ptb)
 		teamd_log_err("Failed to register tb option change handler.");
 		goto err_change_handler_register;
 	}
+	if (tb->tx_balancing_enabled) {
+		err = tb_state_register(ctx, tb);
+		if (err) {
+			teamd_log_err("Failed to register tb state.");
+			goto err_state_register;
+		}
+	}
 	*ptb = tb;
 	return 0;
 
+err_state_register:
+	team_change_handler_unregister(ctx->th, &tb_option_change_handler, tb);
 err_set_lb_tx_method:
 err_set_lb_stats_refresh_interval:
 err_change_handler_register:
@@ -435,8 +857,11 @@ err_change_handler_register:
 
 void teamd_balancer_fini(struct teamd_balancer *tb)
 {
+	if (tb->tx_balancing_enabled)
+		tb_state_unregister(tb->ctx, tb);
 	team_change_handler_unregister(tb->ctx->th,
 				       &tb_option_change_handler, tb);
+	free(tb->port_heap);
 	free(tb);
 }
 
@@ -444,15 +869,22 @@ int teamd_balancer_port_added(struct teamd_balancer *tb,
 			      struct teamd_port *tdport)
 {
 	struct tb_port_info *tbpi;
+	void **port_heap;
 
 	tbpi = get_tb_port_info(tb, tdport);
 	if (tbpi)
 		return -EEXIST;
+	port_heap = realloc(tb->port_heap,
+			    sizeof(*port_heap) * (tb->port_count + 1));
+	if (!port_heap)
+		return -ENOMEM;
+	tb->port_heap = port_heap;
 	tbpi = myzalloc(sizeof(*tbpi));
 	if (!tbpi)
 		return -ENOMEM;
 	tbpi->tdport = tdport;
 	list_add(&tb->port_info_list, &tbpi->list);
+	tb->port_count++;
 	return 0;
 }
 
@@ -466,4 +898,5 @@ void teamd_balancer_port_removed(struct teamd_balancer *tb,
 		return;
 	list_del(&tbpi->list);
 	free(tbpi);
+	tb->port_count--;
 }
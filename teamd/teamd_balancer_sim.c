@@ -0,0 +1,717 @@
+/*
+ *   teamd_balancer_sim.c - Offline simulator of teamd Tx balancer
+ *   Copyright (C) 2026 agent <agent@local>
+ *
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <getopt.h>
+#include <errno.h>
+#include <private/misc.h>
+#include <team.h>
+
+#include "teamd.h"
+#include "teamd_config.h"
+#include "teamd_state.h"
+
+/*
+ * Drives teamd_balancer.c with synthetic lb_hash_stats and lb_port_stats
+ * deltas instead of kernel options. The libteam and teamd functions the
+ * balancer uses are replaced by the ones below, which keep options in
+ * a plain array. After the last round, utilisation of every port (load
+ * divided by speed) is computed for the final hash to port mapping and
+ * the program fails if the spread between the most and the least used
+ * port is over the allowed skew.
+ */
+
+#define SIM_HASH_COUNT 256
+#define SIM_PORT_MAX 16
+#define SIM_IFINDEX_BASE 100
+
+struct team_port {
+	uint32_t speed;
+};
+
+struct sim_lb_stats {
+	uint64_t tx_bytes;
+};
+
+struct team_option {
+	const char *name;
+	enum team_option_type type;
+	uint32_t port_ifindex;
+	uint32_t array_index;
+	bool changed;
+	uint32_t u32_val;
+	const char *str_val;
+	struct sim_lb_stats lb_stats;
+};
+
+struct team_handle {
+	struct team_option *options;
+	unsigned int option_count;
+	const struct team_change_handler *handler;
+	void *handler_priv;
+};
+
+struct sim_port {
+	char ifname[16];
+	struct team_port team_port;
+	struct teamd_port tdport;
+	struct team_option *stats_option;
+	uint64_t bytes;
+	unsigned int hash_count;
+};
+
+struct sim {
+	struct team_handle th;
+	struct teamd_context ctx;
+	struct sim_port ports[SIM_PORT_MAX];
+	unsigned int port_count;
+	struct team_option *mapping_options[SIM_HASH_COUNT];
+	struct team_option *stats_options[SIM_HASH_COUNT];
+	uint64_t hash_base[SIM_HASH_COUNT];
+	uint64_t hash_delta[SIM_HASH_COUNT];
+	uint32_t rand_state;
+	/* Config */
+	bool weighted;
+	int imbalance_threshold;
+	int max_remaps;
+	int ewma_weight;
+};
+
+static struct sim *sim_cfg;
+
+/*
+ * Replacements of libteam functions
+ */
+
+uint32_t team_get_port_speed(struct team_port *port)
+{
+	return port->speed;
+}
+
+struct team_option *team_get_option(struct team_handle *th,
+				    const char *fmt, ...)
+{
+	va_list ap;
+	const char *name = NULL;
+	uint32_t port_ifindex = 0;
+	uint32_t array_index = 0;
+	struct team_option *option;
+	unsigned int i;
+
+	va_start(ap, fmt);
+	for (; *fmt; fmt++) {
+		switch (*fmt) {
+		case 'n':
+			name = va_arg(ap, const char *);
+			break;
+		case 'p':
+			port_ifindex = va_arg(ap, uint32_t);
+			break;
+		case 'a':
+			array_index = va_arg(ap, uint32_t);
+			break;
+		}
+	}
+	va_end(ap);
+
+	for (i = 0; i < th->option_count; i++) {
+		option = &th->options[i];
+		if (!strcmp(option->name, name) &&
+		    option->port_ifindex == port_ifindex &&
+		    option->array_index == array_index)
+			return option;
+	}
+	return NULL;
+}
+
+struct team_option *team_get_next_option(struct team_handle *th,
+					 struct team_option *option)
+{
+	if (!option)
+		return th->option_count ? th->options : NULL;
+	if (++option == th->options + th->option_count)
+		return NULL;
+	return option;
+}
+
+char *team_get_option_name(struct team_option *option)
+{
+	return (char *) option->name;
+}
+
+uint32_t team_get_option_port_ifindex(struct team_option *option)
+{
+	return option->port_ifindex;
+}
+
+uint32_t team_get_option_array_index(struct team_option *option)
+{
+	return option->array_index;
+}
+
+enum team_option_type team_get_option_type(struct team_option *option)
+{
+	return option->type;
+}
+
+bool team_is_option_changed(struct team_option *option)
+{
+	return option->changed;
+}
+
+uint32_t team_get_option_value_u32(struct team_option *option)
+{
+	return option->u32_val;
+}
+
+void *team_get_option_value_binary(struct team_option *option)
+{
+	return &option->lb_stats;
+}
+
+int team_set_option_value_u32(struct team_handle *th,
+			      struct team_option *option, uint32_t val)
+{
+	option->u32_val = val;
+	return 0;
+}
+
+int team_set_option_value_string(struct team_handle *th,
+				 struct team_option *option, const char *str)
+{
+	option->str_val = str;
+	return 0;
+}
+
+int team_option_batch_begin(struct team_handle *th)
+{
+	return 0;
+}
+
+int team_option_batch_commit(struct team_handle *th)
+{
+	return 0;
+}
+
+int team_change_handler_register(struct team_handle *th,
+				 const struct team_change_handler *handler,
+				 void *priv)
+{
+	th->handler = handler;
+	th->handler_priv = priv;
+	return 0;
+}
+
+void team_change_handler_unregister(struct team_handle *th,
+				    const struct team_change_handler *handler,
+				    void *priv)
+{
+	th->handler = NULL;
+}
+
+/*
+ * Replacements of teamd functions
+ */
+
+struct teamd_port *teamd_get_port(struct teamd_context *ctx, uint32_t ifindex)
+{
+	unsigned int i;
+
+	for (i = 0; i < sim_cfg->port_count; i++)
+		if (sim_cfg->ports[i].tdport.ifindex == ifindex)
+			return &sim_cfg->ports[i].tdport;
+	return NULL;
+}
+
+static int sim_config_path(char *path, size_t size, const char *fmt,
+			   va_list ap)
+{
+	int ret;
+
+	ret = vsnprintf(path, size, fmt, ap);
+	return ret < 0 || (size_t) ret >= size ? -EINVAL : 0;
+}
+
+int teamd_config_string_get(struct teamd_context *ctx, const char **p_str_val,
+			    const char *fmt, ...)
+{
+	char path[128];
+	va_list ap;
+	int err;
+
+	va_start(ap, fmt);
+	err = sim_config_path(path, sizeof(path), fmt, ap);
+	va_end(ap);
+	if (err)
+		return err;
+	if (!strcmp(path, "$.runner.tx_balancer.name")) {
+		*p_str_val = sim_cfg->weighted ? "weighted" : "basic";
+		return 0;
+	}
+	return -ENOENT;
+}
+
+int teamd_config_int_get(struct teamd_context *ctx, int *p_int_val,
+			 const char *fmt, ...)
+{
+	char path[128];
+	va_list ap;
+	int err;
+
+	va_start(ap, fmt);
+	err = sim_config_path(path, sizeof(path), fmt, ap);
+	va_end(ap);
+	if (err)
+		return err;
+	if (!strcmp(path, "$.runner.tx_balancer.imbalance_threshold"))
+		*p_int_val = sim_cfg->imbalance_threshold;
+	else if (!strcmp(path, "$.runner.tx_balancer.max_remaps"))
+		*p_int_val = sim_cfg->max_remaps;
+	else if (!strcmp(path, "$.runner.tx_balancer.ewma_weight"))
+		*p_int_val = sim_cfg->ewma_weight;
+	else
+		return -ENOENT;
+	return 0;
+}
+
+int teamd_config_bool_get(struct teamd_context *ctx, bool *p_bool_val,
+			  const char *fmt, ...)
+{
+	return -ENOENT;
+}
+
+int teamd_state_val_register_ex(struct teamd_context *ctx,
+				const struct teamd_state_val *val,
+				void *priv, struct teamd_port *tdport,
+				const char *fmt, ...)
+{
+	return 0;
+}
+
+void teamd_state_val_unregister(struct teamd_context *ctx,
+				const struct teamd_state_val *val,
+				void *priv)
+{
+}
+
+/*
+ * Simulation
+ */
+
+static uint32_t sim_rand(struct sim *sim)
+{
+	uint32_t x = sim->rand_state;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	sim->rand_state = x;
+	return x;
+}
+
+static struct team_option *sim_option_add(struct sim *sim, const char *name,
+					  enum team_option_type type,
+					  uint32_t port_ifindex,
+					  uint32_t array_index)
+{
+	struct team_option *option;
+
+	option = &sim->th.options[sim->th.option_count++];
+	option->name = name;
+	option->type = type;
+	option->port_ifindex = port_ifindex;
+	option->array_index = array_index;
+	return option;
+}
+
+static int sim_options_init(struct sim *sim)
+{
+	unsigned int i;
+
+	sim->th.options = calloc(2 * SIM_HASH_COUNT + sim->port_count + 2,
+				 sizeof(*sim->th.options));
+	if (!sim->th.options)
+		return -ENOMEM;
+
+	sim_option_add(sim, "lb_tx_method", TEAM_OPTION_TYPE_STRING, 0, 0);
+	sim_option_add(sim, "lb_stats_refresh_interval",
+		       TEAM_OPTION_TYPE_U32, 0, 0);
+	for (i = 0; i < SIM_HASH_COUNT; i++)
+		sim->mapping_options[i] =
+			sim_option_add(sim, "lb_tx_hash_to_port_mapping",
+				       TEAM_OPTION_TYPE_U32, 0, i);
+	for (i = 0; i < SIM_HASH_COUNT; i++)
+		sim->stats_options[i] =
+			sim_option_add(sim, "lb_hash_stats",
+				       TEAM_OPTION_TYPE_BINARY, 0, i);
+	for (i = 0; i < sim->port_count; i++)
+		sim->ports[i].stats_option =
+			sim_option_add(sim, "lb_port_stats",
+				       TEAM_OPTION_TYPE_BINARY,
+				       sim->ports[i].tdport.ifindex, 0);
+	return 0;
+}
+
+/* Mostly small hashes of different size with a few elephants among them */
+static void sim_hash_base_init(struct sim *sim)
+{
+	unsigned int i;
+
+	for (i = 0; i < SIM_HASH_COUNT; i++) {
+		sim->hash_base[i] = (1 + sim_rand(sim) % 1000) * 1000;
+		if (!(i % 64))
+			sim->hash_base[i] *= 20;
+	}
+}
+
+static struct sim_port *sim_port_by_ifindex(struct sim *sim, uint32_t ifindex)
+{
+	unsigned int i;
+
+	for (i = 0; i < sim->port_count; i++)
+		if (sim->ports[i].tdport.ifindex == ifindex)
+			return &sim->ports[i];
+	return NULL;
+}
+
+/* Traffic of every hash wanders +-20% of its base from round to round */
+static int sim_round(struct sim *sim)
+{
+	struct team_handle *th = &sim->th;
+	struct sim_port *port;
+	unsigned int i;
+
+	for (i = 0; i < SIM_HASH_COUNT; i++) {
+		sim->hash_delta[i] = sim->hash_base[i] *
+				     (80 + sim_rand(sim) % 41) / 100;
+		sim->stats_options[i]->lb_stats.tx_bytes += sim->hash_delta[i];
+		sim->stats_options[i]->changed = true;
+		port = sim_port_by_ifindex(sim,
+					   sim->mapping_options[i]->u32_val);
+		if (port)
+			port->stats_option->lb_stats.tx_bytes +=
+							sim->hash_delta[i];
+	}
+	for (i = 0; i < sim->port_count; i++)
+		sim->ports[i].stats_option->changed = true;
+
+	if (!th->handler)
+		return -ENOENT;
+	return th->handler->func(th, th->handler_priv, TEAM_OPTION_CHANGE);
+}
+
+static void sim_options_changed_clear(struct sim *sim)
+{
+	unsigned int i;
+
+	for (i = 0; i < sim->th.option_count; i++)
+		sim->th.options[i].changed = false;
+}
+
+/* Returns utilisation skew in percent of the most used port */
+static double sim_skew(struct sim *sim, unsigned int *p_unmapped)
+{
+	struct sim_port *port;
+	double util;
+	double util_min = 0;
+	double util_max = 0;
+	unsigned int i;
+
+	*p_unmapped = 0;
+	for (i = 0; i < sim->port_count; i++) {
+		sim->ports[i].bytes = 0;
+		sim->ports[i].hash_count = 0;
+	}
+	for (i = 0; i < SIM_HASH_COUNT; i++) {
+		port = sim_port_by_ifindex(sim,
+					   sim->mapping_options[i]->u32_val);
+		if (!port) {
+			(*p_unmapped)++;
+			continue;
+		}
+		port->bytes += sim->hash_delta[i];
+		port->hash_count++;
+	}
+	for (i = 0; i < sim->port_count; i++) {
+		port = &sim->ports[i];
+		util = (double) port->bytes / port->team_port.speed;
+		if (!i || util < util_min)
+			util_min = util;
+		if (!i || util > util_max)
+			util_max = util;
+	}
+	if (!util_max)
+		return 0;
+	return (util_max - util_min) * 100 / util_max;
+}
+
+static void sim_print_ports(struct sim *sim)
+{
+	struct sim_port *port;
+	unsigned int i;
+
+	for (i = 0; i < sim->port_count; i++) {
+		port = &sim->ports[i];
+		printf("%s: speed %u, hashes %u, bytes %llu, bytes per Mbit %.1f\n",
+		       port->ifname, port->team_port.speed, port->hash_count,
+		       (unsigned long long) port->bytes,
+		       (double) port->bytes / port->team_port.speed);
+	}
+}
+
+static int sim_ports_parse(struct sim *sim, const char *str)
+{
+	unsigned long speed;
+	struct sim_port *port;
+	char *endptr;
+
+	sim->port_count = 0;
+	for (;;) {
+		if (sim->port_count == SIM_PORT_MAX)
+			return -EINVAL;
+		errno = 0;
+		speed = strtoul(str, &endptr, 10);
+		if (errno || endptr == str || !speed || speed >= ~0U)
+			return -EINVAL;
+		port = &sim->ports[sim->port_count];
+		port->team_port.speed = speed;
+		port->tdport.ifindex = SIM_IFINDEX_BASE + sim->port_count;
+		snprintf(port->ifname, sizeof(port->ifname), "sim%u",
+			 sim->port_count);
+		port->tdport.ifname = port->ifname;
+		port->tdport.team_port = &port->team_port;
+		sim->port_count++;
+		if (!*endptr)
+			return 0;
+		if (*endptr != ',')
+			return -EINVAL;
+		str = endptr + 1;
+	}
+}
+
+static void print_help(const char *argv0) {
+	printf(
+            "%s [options]\n"
+            "\t-h --help                Show this help\n"
+            "\t-p --ports=SPEEDS        Comma separated port speeds in Mbit (default 10000,10000,25000,25000)\n"
+            "\t-n --rounds=COUNT        Number of balancing rounds (default 10)\n"
+            "\t-s --seed=SEED           Seed for synthetic traffic\n"
+            "\t-b --basic               Use basic balancer instead of weighted one\n"
+            "\t-t --threshold=PERCENT   Imbalance threshold (enables stable mode)\n"
+            "\t-m --max-remaps=COUNT    Max remaps per round (enables stable mode)\n"
+            "\t-e --ewma-weight=PERCENT Load smoothing weight\n"
+            "\t-k --max-skew=PERCENT    Fail if utilisation skew is bigger (default 10)\n"
+            "\t-v --verbose             Show balancer debug messages\n",
+            argv0);
+}
+
+static int parse_uint(const char *str, unsigned int *p_val)
+{
+	unsigned long tmp;
+	char *endptr;
+
+	errno = 0;
+	tmp = strtoul(str, &endptr, 10);
+	if (errno || *endptr || !*str || tmp > ~0U)
+		return -EINVAL;
+	*p_val = tmp;
+	return 0;
+}
+
+static int parse_percent(const char *str, int *p_val)
+{
+	unsigned int tmp;
+
+	if (parse_uint(str, &tmp) || tmp > 100)
+		return -EINVAL;
+	*p_val = tmp;
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	char *argv0 = argv[0];
+	static const struct option long_options[] = {
+		{ "help",		no_argument,		NULL, 'h' },
+		{ "ports",		required_argument,	NULL, 'p' },
+		{ "rounds",		required_argument,	NULL, 'n' },
+		{ "seed",		required_argument,	NULL, 's' },
+		{ "basic",		no_argument,		NULL, 'b' },
+		{ "threshold",		required_argument,	NULL, 't' },
+		{ "max-remaps",		required_argument,	NULL, 'm' },
+		{ "ewma-weight",	required_argument,	NULL, 'e' },
+		{ "max-skew",		required_argument,	NULL, 'k' },
+		{ "verbose",		no_argument,		NULL, 'v' },
+		{ NULL, 0, NULL, 0 }
+	};
+	struct teamd_balancer *tb;
+	struct sim *sim;
+	unsigned int rounds = 10;
+	unsigned int seed = 1;
+	unsigned int max_skew = 10;
+	unsigned int unmapped;
+	unsigned int tmp;
+	unsigned int i;
+	double skew;
+	int res = EXIT_FAILURE;
+	int opt;
+	int err;
+
+	sim = myzalloc(sizeof(*sim));
+	if (!sim) {
+		fprintf(stderr, "Failed to allocate simulation.\n");
+		return EXIT_FAILURE;
+	}
+	sim_cfg = sim;
+	sim->weighted = true;
+	sim_ports_parse(sim, "10000,10000,25000,25000");
+
+	daemon_log_use = DAEMON_LOG_STDERR;
+	daemon_set_verbosity(LOG_WARNING);
+
+	while ((opt = getopt_long(argc, argv, "hp:n:s:bt:m:e:k:v",
+				  long_options, NULL)) >= 0) {
+
+		switch(opt) {
+		case 'h':
+			print_help(argv0);
+			res = EXIT_SUCCESS;
+			goto free_sim;
+		case 'p':
+			if (sim_ports_parse(sim, optarg)) {
+				fprintf(stderr, "Invalid port speeds.\n");
+				goto free_sim;
+			}
+			break;
+		case 'n':
+			if (parse_uint(optarg, &rounds) || !rounds) {
+				fprintf(stderr, "Invalid round count.\n");
+				goto free_sim;
+			}
+			break;
+		case 's':
+			if (parse_uint(optarg, &seed)) {
+				fprintf(stderr, "Invalid seed.\n");
+				goto free_sim;
+			}
+			break;
+		case 'b':
+			sim->weighted = false;
+			break;
+		case 't':
+			if (parse_percent(optarg, &sim->imbalance_threshold)) {
+				fprintf(stderr, "Invalid imbalance threshold.\n");
+				goto free_sim;
+			}
+			break;
+		case 'm':
+			if (parse_uint(optarg, &tmp) || tmp > INT32_MAX) {
+				fprintf(stderr, "Invalid max remaps.\n");
+				goto free_sim;
+			}
+			sim->max_remaps = tmp;
+			break;
+		case 'e':
+			if (parse_percent(optarg, &sim->ewma_weight)) {
+				fprintf(stderr, "Invalid ewma weight.\n");
+				goto free_sim;
+			}
+			break;
+		case 'k':
+			if (parse_uint(optarg, &max_skew) || max_skew > 100) {
+				fprintf(stderr, "Invalid max skew.\n");
+				goto free_sim;
+			}
+			break;
+		case 'v':
+			daemon_set_verbosity(LOG_DEBUG);
+			break;
+		default:
+			print_help(argv0);
+			goto free_sim;
+		}
+	}
+
+	if (optind < argc) {
+		fprintf(stderr, "Too many arguments\n");
+		goto free_sim;
+	}
+
+	/* Zero seed would stick xorshift at zero */
+	sim->rand_state = seed ? seed : 1;
+	sim_hash_base_init(sim);
+	err = sim_options_init(sim);
+	if (err) {
+		fprintf(stderr, "Failed to init options.\n");
+		goto free_sim;
+	}
+
+	sim->ctx.th = &sim->th;
+	err = teamd_balancer_init(&sim->ctx, &tb);
+	if (err) {
+		fprintf(stderr, "Failed to init balancer.\n");
+		goto free_options;
+	}
+	for (i = 0; i < sim->port_count; i++) {
+		err = teamd_balancer_port_added(tb, &sim->ports[i].tdport);
+		if (err) {
+			fprintf(stderr, "Failed to add port.\n");
+			goto balancer_fini;
+		}
+	}
+
+	for (i = 0; i < rounds; i++) {
+		err = sim_round(sim);
+		if (err) {
+			fprintf(stderr, "Balancer failed in round %u.\n", i);
+			goto ports_remove;
+		}
+		sim_options_changed_clear(sim);
+	}
+
+	skew = sim_skew(sim, &unmapped);
+	sim_print_ports(sim);
+	printf("Utilisation skew: %.1f%% (max %u%%)\n", skew, max_skew);
+	if (unmapped) {
+		fprintf(stderr, "%u hashes are not mapped to any port.\n",
+			unmapped);
+		goto ports_remove;
+	}
+	if (skew > max_skew) {
+		fprintf(stderr, "Utilisation skew is too big.\n");
+		goto ports_remove;
+	}
+	res = EXIT_SUCCESS;
+
+ports_remove:
+	for (i = 0; i < sim->port_count; i++)
+		teamd_balancer_port_removed(tb, &sim->ports[i].tdport);
+balancer_fini:
+	teamd_balancer_fini(tb);
+free_options:
+	free(sim->th.options);
+free_sim:
+	free(sim);
+	return res;
+}
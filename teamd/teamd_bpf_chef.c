@@ -18,9 +18,12 @@
  */
 
 #include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
 #include <errno.h>
 #include <stdbool.h>
 #include <linux/filter.h>
+#include <private/misc.h>
 
 #include "teamd_bpf_chef.h"
 
@@ -31,7 +34,27 @@
 #define IPV4_PROTO_OFFSET	23
 #define IPV4_FRAG_BITS		0x1fff
 #define IPV6_NEXTHEADER_OFFSET	20
-
+#define IPV6_HEADER_END		54
+#define IPV6_FRAG_OFFSET_BITS	0xfff8
+#define L3_OFFSET		14
+#define UDP_DPORT_OFFSET	2
+#define UDP_HEADER_LEN		8
+#define VXLAN_HEADER_LEN	8
+#define GENEVE_OPTLEN_MASK	0x3f
+#define GENEVE_PROTO_OFFSET	2
+#define GRE_PROTO_OFFSET	2
+#define GRE_HEADER_LEN		4
+#define GRE_FLAG_CSUM		0x80
+#define GRE_FLAG_KEY		0x20
+#define GRE_FLAG_SEQ		0x10
+#define INNER_ETH_TYPE_OFFSET	12
+#define INNER_ETH_HEADER_LEN	14
+#define INNER_IPV4_FLAGS_OFFSET	6
+#define INNER_IPV4_PROTO_OFFSET	9
+#define INNER_IPV4_SADDR_OFFSET	12
+#define INNER_IPV6_NEXTHEADER_OFFSET	6
+#define INNER_IPV6_SADDR_OFFSET	8
+#define INNER_IPV6_HEADER_LEN	40
 
 /* protocol codes */
 #define PROTOID_IPV4		0x800
@@ -40,6 +63,24 @@
 #define PROTOID_TCP		0x6
 #define PROTOID_UDP		0x11
 #define PROTOID_SCTP		0x84
+#define PROTOID_GRE		0x2f
+#define PROTOID_TEB		0x6558
+#define PORT_VXLAN		4789
+#define PORT_GENEVE		6081
+#define PROTOID_HOPOPTS		0
+#define PROTOID_ROUTING		43
+#define PROTOID_FRAGMENT	44
+#define PROTOID_DSTOPTS		60
+
+/* number of IPv6 extension headers walked before giving up on L4 */
+#define IPV6_EXTHDR_MAX		4
+
+/* mix hash function constants, per field multiplier is golden ratio,
+ * finalizer is the one of murmur3
+ */
+#define HASH_MIX_MUL		0x9e3779b1
+#define HASH_FMIX_MUL1		0x85ebca6b
+#define HASH_FMIX_MUL2		0xc2b2ae35
 
 /* jump stack flags */
 #define FIX_JT	0x1
@@ -53,21 +94,6 @@ static int vlan_hdr_shift(unsigned int offset)
 	return offset + VLAN_HEADER_SIZE;
 }
 
-static int __add_inst(struct sock_fprog *fprog, struct sock_filter *inst)
-{
-	ssize_t newsize;
-	struct sock_filter *newfilter;
-
-	newsize = sizeof(struct sock_filter) * (fprog->len + 1);
-	newfilter = realloc(fprog->filter, newsize);
-	if (!newfilter)
-		return -ENOMEM;
-	fprog->filter = newfilter;
-	fprog->filter[fprog->len] = *inst;
-	fprog->len += 1;
-	return 0;
-}
-
 #define add_inst(fprog, __inst)				\
 	{						\
 		struct sock_filter inst = __inst;	\
@@ -98,8 +124,15 @@ static int __add_inst(struct sock_fprog *fprog, struct sock_filter *inst)
 	add_inst(fprog, BPF_STMT(BPF_LDX + BPF_W + BPF_MEM, 0))
 
 #define bpf_calc_hash()							\
-	add_inst(fprog, BPF_STMT(BPF_LD + BPF_B + BPF_ABS,		\
-				 SKF_AD_OFF + SKF_AD_ALU_XOR_X))
+	do {								\
+		add_inst(fprog, BPF_STMT(BPF_LD + BPF_B + BPF_ABS,	\
+					 SKF_AD_OFF +			\
+					 SKF_AD_ALU_XOR_X));		\
+		if (bpf_ctx(fprog)->hflags.mix)				\
+			add_inst(fprog,					\
+				 BPF_STMT(BPF_ALU + BPF_MUL + BPF_K,	\
+					  HASH_MIX_MUL));		\
+	} while (0)
 
 #define bpf_move_to_x()							\
 	add_inst(fprog, BPF_STMT(BPF_MISC + BPF_TAX, 0));
@@ -123,6 +156,16 @@ static int __add_inst(struct sock_fprog *fprog, struct sock_filter *inst)
 		push_addr(fprog, FIX_K);				\
 	} while (0)
 
+/* same as bpf_cmp(0, jf, k, FIX_JF) for labels which might be out of
+ * conditional jump range
+ */
+#define bpf_cmp_far_jf(jf, k)						\
+	do {								\
+		add_inst(fprog, BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K,	\
+					 k, 1, 0));			\
+		bpf_jump(jf);						\
+	} while (0)
+
 
 #define bpf_and(jt, jf, k, flags)					\
 	do {								\
@@ -146,13 +189,85 @@ static int __add_inst(struct sock_fprog *fprog, struct sock_filter *inst)
 #define bpf_l4v4_port_to_a(pos)						\
 	add_inst(fprog, BPF_STMT(BPF_LD + BPF_H + BPF_IND, pos))
 
+#define bpf_load_mem(m)							\
+	add_inst(fprog, BPF_STMT(BPF_LD + BPF_W + BPF_MEM, m))
+
+#define bpf_load_mem_x(m)						\
+	add_inst(fprog, BPF_STMT(BPF_LDX + BPF_W + BPF_MEM, m))
+
+#define bpf_store_a(m)							\
+	add_inst(fprog, BPF_STMT(BPF_ST, m))
+
+#define bpf_store_x(m)							\
+	add_inst(fprog, BPF_STMT(BPF_STX, m))
+
+#define bpf_add(k)							\
+	add_inst(fprog, BPF_STMT(BPF_ALU + BPF_ADD + BPF_K, k))
+
+#define bpf_add_to_x(k)							\
+	do {								\
+		bpf_move_to_a();					\
+		bpf_add(k);						\
+		bpf_move_to_x();					\
+	} while (0)
+
+/* Hashes field at X + pos. Hash is kept in M[0] and base offset in M[2]
+ * so X is restored to base offset afterwards.
+ */
+#define bpf_ind_hash(size, pos)						\
+	do {								\
+		add_inst(fprog, BPF_STMT(BPF_LD + size + BPF_IND, pos));\
+		bpf_pop_x();						\
+		bpf_calc_hash();					\
+		bpf_push_a();						\
+		bpf_load_mem_x(2);					\
+	} while (0)
+
+/* A ^= A >> shift */
+#define bpf_xor_shift(shift)						\
+	do {								\
+		bpf_move_to_x();					\
+		add_inst(fprog, BPF_STMT(BPF_ALU + BPF_RSH + BPF_K,	\
+					 shift));			\
+		add_inst(fprog, BPF_STMT(BPF_ALU + BPF_XOR + BPF_X, 0));\
+	} while (0)
+
+#define bpf_hash_finalize()						\
+	do {								\
+		bpf_xor_shift(16);					\
+		add_inst(fprog, BPF_STMT(BPF_ALU + BPF_MUL + BPF_K,	\
+					 HASH_FMIX_MUL1));		\
+		bpf_xor_shift(13);					\
+		add_inst(fprog, BPF_STMT(BPF_ALU + BPF_MUL + BPF_K,	\
+					 HASH_FMIX_MUL2));		\
+		bpf_xor_shift(16);					\
+	} while (0)
+
 #define bpf_hash_return()						\
 	do {								\
 		bpf_move_to_a();					\
+		if (bpf_ctx(fprog)->hflags.mix)				\
+			bpf_hash_finalize();				\
 		bpf_return_a();						\
 	} while(0)
 
 
+/* labels used inside one tunnel block, relative to its base label */
+enum tunnel_labels {
+	TUNNEL_OUT,
+	TUNNEL_SKIP,
+	TUNNEL_VXLAN,
+	TUNNEL_GENEVE,
+	TUNNEL_GRE,
+	TUNNEL_INNER_ETH,
+	TUNNEL_INNER_IPV4,
+	TUNNEL_INNER_L4v4,
+	TUNNEL_INNER_IPV6,
+	TUNNEL_INNER_L4v6,
+	TUNNEL_DONE,
+	TUNNEL_LABEL_COUNT,
+};
+
 enum bpf_labels {
 	LABEL_VLAN_BRANCH,
 	LABEL_VLAN_TAG_SKIP,
@@ -166,6 +281,7 @@ enum bpf_labels {
 	LABEL_NOVLAN_L4v6_OUT,
 	LABEL_NOVLAN_L4v6_HASH,
 	LABEL_NOVLAN_TRY_STCP6,
+	LABEL_NOVLAN_EXTHDR_DONE,
 	LABEL_VLAN_IPV6,
 	LABEL_VLAN_L4v4_OUT,
 	LABEL_VLAN_TRY_UDP4,
@@ -176,20 +292,22 @@ enum bpf_labels {
 	LABEL_VLAN_L4v6_OUT,
 	LABEL_VLAN_L4v6_HASH,
 	LABEL_VLAN_TRY_STCP6,
+	LABEL_VLAN_EXTHDR_DONE,
+	/* tunnel label sets follow, see enum tunnel_labels */
+	LABEL_NOVLAN_IPV4_TUNNEL,
+	LABEL_NOVLAN_IPV6_TUNNEL = LABEL_NOVLAN_IPV4_TUNNEL + TUNNEL_LABEL_COUNT,
+	LABEL_VLAN_IPV4_TUNNEL = LABEL_NOVLAN_IPV6_TUNNEL + TUNNEL_LABEL_COUNT,
+	LABEL_VLAN_IPV6_TUNNEL = LABEL_VLAN_IPV4_TUNNEL + TUNNEL_LABEL_COUNT,
+	LABEL_COUNT = LABEL_VLAN_IPV6_TUNNEL + TUNNEL_LABEL_COUNT,
 };
 
-/* stack */
-struct stack_entry {
-	struct stack_entry *next;
+/* jump to be fixed up once all labels are known */
+struct bpf_fixup {
 	unsigned int addr;
-	union {
-		enum bpf_labels label;
-		int flags;
-	};
+	int flags;
 };
 
-static struct stack_entry *stack_labels;
-static struct stack_entry *stack_addrs;
+#define LABEL_UNSET	(~0U)
 
 enum hashing_flags {
 	HASH_ETH,
@@ -210,19 +328,68 @@ enum hashing_flags {
 	HASH_NOVLAN_UDP6,
 	HASH_NOVLAN_TCP6,
 	HASH_NOVLAN_SCTP6,
+	HASH_VLAN_VXLAN,
+	HASH_VLAN_GENEVE,
+	HASH_VLAN_GRE,
+	HASH_NOVLAN_VXLAN,
+	HASH_NOVLAN_GENEVE,
+	HASH_NOVLAN_GRE,
 };
 
 struct hash_flags {
 	unsigned int required;
 	unsigned int built;
+	bool mix;
+	bool symmetric;
+};
+
+/* All state of one compilation. Program buffer and fixup array are kept
+ * allocated between compilations and only grow, so reused context does
+ * not allocate per instruction or per jump.
+ */
+struct teamd_bpf_desc_ctx {
+	struct sock_fprog fprog; /* program being built */
+	unsigned int filter_size;
+	struct hash_flags hflags;
+	unsigned int labels[LABEL_COUNT];
+	struct bpf_fixup *fixups;
+	unsigned int fixup_count;
+	unsigned int fixup_size;
+	int err;
 };
 
-static struct hash_flags hflags;
+static struct teamd_bpf_desc_ctx *bpf_ctx(struct sock_fprog *fprog)
+{
+	return (struct teamd_bpf_desc_ctx *)
+		((char *) fprog - offsetof(struct teamd_bpf_desc_ctx, fprog));
+}
+
+static int __add_inst(struct sock_fprog *fprog, struct sock_filter *inst)
+{
+	struct teamd_bpf_desc_ctx *dctx = bpf_ctx(fprog);
+	struct sock_filter *newfilter;
+	unsigned int newsize;
+
+	if (fprog->len == dctx->filter_size) {
+		newsize = dctx->filter_size ? dctx->filter_size * 2 : 256;
+		newfilter = realloc(fprog->filter,
+				    sizeof(struct sock_filter) * newsize);
+		if (!newfilter)
+			return -ENOMEM;
+		fprog->filter = newfilter;
+		dctx->filter_size = newsize;
+	}
+	fprog->filter[fprog->len] = *inst;
+	fprog->len += 1;
+	return 0;
+}
 
 static void hash_flags_init(struct hash_flags *flags)
 {
 	flags->required = 0;
 	flags->built = 0;
+	flags->mix = false;
+	flags->symmetric = false;
 }
 
 static int hash_test_and_set_flag(struct hash_flags *flags,
@@ -285,7 +452,10 @@ static int hash_is_l4v6_enabled(struct hash_flags *flags)
 static int hash_is_novlan_l3l4_enabled(struct hash_flags *flags)
 {
 
-	if (hash_is_enabled(flags, HASH_NOVLAN_IPV4) ||
+	if (hash_is_enabled(flags, HASH_NOVLAN_VXLAN) ||
+	    hash_is_enabled(flags, HASH_NOVLAN_GENEVE) ||
+	    hash_is_enabled(flags, HASH_NOVLAN_GRE) ||
+	    hash_is_enabled(flags, HASH_NOVLAN_IPV4) ||
 	    hash_is_enabled(flags, HASH_NOVLAN_IPV6) ||
 	    hash_is_enabled(flags, HASH_NOVLAN_TCP4) ||
 	    hash_is_enabled(flags, HASH_NOVLAN_UDP4) ||
@@ -298,153 +468,190 @@ static int hash_is_novlan_l3l4_enabled(struct hash_flags *flags)
 	return 0;
 }
 
-static void stack_init(void)
-{
-	stack_labels = NULL;
-	stack_addrs = NULL;
-}
 
-static void __stack_release(struct stack_entry *root)
+static void stack_init(struct teamd_bpf_desc_ctx *dctx)
 {
-	struct stack_entry *p;
-	struct stack_entry *pn;
+	unsigned int i;
 
-	p = root;
-	while (p) {
-		pn = p->next;
-		free(p);
-		p = pn;
-	}
-}
-
-static void stack_release(void)
-{
-	__stack_release(stack_labels);
-	__stack_release(stack_addrs);
-	stack_init();
+	for (i = 0; i < LABEL_COUNT; i++)
+		dctx->labels[i] = LABEL_UNSET;
+	dctx->fixup_count = 0;
+	dctx->err = 0;
 }
 
+/* Errors are sticky and reported once the code is generated so the
+ * emitters do not need to check every jump.
+ */
 static int push_addr(struct sock_fprog *fprog, int flags)
 {
-	struct stack_entry *pa;
-
-	pa = malloc(sizeof(struct stack_entry));
-	if (!pa)
-		return -ENOMEM;
-
-	pa->addr = fprog->len - 1;
-	pa->flags = flags;
-
-	pa->next = stack_addrs;
-	stack_addrs = pa;
-
+	struct teamd_bpf_desc_ctx *dctx = bpf_ctx(fprog);
+	struct bpf_fixup *newfixups;
+	unsigned int newsize;
+
+	if (dctx->fixup_count == dctx->fixup_size) {
+		newsize = dctx->fixup_size ? dctx->fixup_size * 2 : 64;
+		newfixups = realloc(dctx->fixups,
+				    sizeof(struct bpf_fixup) * newsize);
+		if (!newfixups) {
+			dctx->err = -ENOMEM;
+			return -ENOMEM;
+		}
+		dctx->fixups = newfixups;
+		dctx->fixup_size = newsize;
+	}
+	dctx->fixups[dctx->fixup_count].addr = fprog->len - 1;
+	dctx->fixups[dctx->fixup_count].flags = flags;
+	dctx->fixup_count++;
 	return 0;
 }
 
-static struct stack_entry *__find_label(enum bpf_labels label)
+static int push_label(struct sock_fprog *fprog, enum bpf_labels label)
 {
-	struct stack_entry *p;
-
-	p = stack_labels;
-	while (p) {
-		if (p->label == label)
-			return p;
+	struct teamd_bpf_desc_ctx *dctx = bpf_ctx(fprog);
 
-		p = p->next;
+	if (label >= LABEL_COUNT || dctx->labels[label] != LABEL_UNSET) {
+		dctx->err = -EEXIST;
+		return -EEXIST;
 	}
-
-	return NULL;
+	dctx->labels[label] = fprog->len;
+	return 0;
 }
 
-static int push_label(struct sock_fprog *fprog, enum bpf_labels label)
+static int __resolve_offset(struct teamd_bpf_desc_ctx *dctx,
+			    unsigned int addr, unsigned int label,
+			    int max_offset, int *p_offset)
 {
-	struct stack_entry *pl;
-
-	if (__find_label(label))
-		return -EEXIST;
-
-	pl = malloc(sizeof(struct stack_entry));
-	if (!pl)
-		return -ENOMEM;
-
-	pl->addr = fprog->len;
-	pl->label = label;
-
-	pl->next = stack_labels;
-	stack_labels = pl;
+	int offset;
 
+	if (label >= LABEL_COUNT || dctx->labels[label] == LABEL_UNSET)
+		return -ENOENT;
+	offset = dctx->labels[label] - addr - 1;
+	if (offset < 0 || (max_offset && offset > max_offset))
+		return -EINVAL;
+	*p_offset = offset;
 	return 0;
 }
 
-static int stack_resolve_offsets(struct sock_fprog *fprog)
+static int stack_resolve_offsets(struct teamd_bpf_desc_ctx *dctx)
 {
-	struct stack_entry *paddr;
-	struct stack_entry *naddr;
-	struct stack_entry *plabel;
-	struct stack_entry *nlabel;
+	struct bpf_fixup *fixup;
 	struct sock_filter *sf;
+	unsigned int i;
 	int offset;
+	int err;
 
-	paddr = stack_addrs;
-	while (paddr) {
-		sf = fprog->filter + paddr->addr;
+	for (i = 0; i < dctx->fixup_count; i++) {
+		fixup = &dctx->fixups[i];
+		sf = dctx->fprog.filter + fixup->addr;
 
-		if (paddr->flags & ~(FIX_K|FIX_JT|FIX_JF))
+		if (fixup->flags & ~(FIX_K|FIX_JT|FIX_JF))
 			return -EINVAL;
 
-		if (paddr->flags & FIX_K) {
-			plabel = __find_label(sf->k);
-			if (!plabel)
-				return -ENOENT;
-
-			offset = plabel->addr - paddr->addr - 1;
-			if (offset < 0 || offset > 255)
-				return -EINVAL;
+		if (fixup->flags & FIX_K) {
+			/* unconditional jump has 32 bit offset */
+			err = __resolve_offset(dctx, fixup->addr, sf->k,
+					       0, &offset);
+			if (err)
+				return err;
 			sf->k = offset;
 		}
 
-		if (paddr->flags & FIX_JT) {
-			plabel = __find_label(sf->jt);
-			if (!plabel)
-				return -ENOENT;
-
-			offset = plabel->addr - paddr->addr - 1;
-			if (offset < 0 || offset > 255)
-				return -EINVAL;
+		if (fixup->flags & FIX_JT) {
+			err = __resolve_offset(dctx, fixup->addr, sf->jt,
+					       255, &offset);
+			if (err)
+				return err;
 			sf->jt = offset;
 		}
 
-		if (paddr->flags & FIX_JF) {
-			plabel = __find_label(sf->jf);
-			if (!plabel)
-				return -ENOENT;
-
-			offset = plabel->addr - paddr->addr - 1;
-			if (offset < 0 || offset > 255)
-				return -EINVAL;
+		if (fixup->flags & FIX_JF) {
+			err = __resolve_offset(dctx, fixup->addr, sf->jf,
+					       255, &offset);
+			if (err)
+				return err;
 			sf->jf = offset;
 		}
-
-		naddr = paddr->next;
-		free(paddr);
-		paddr = naddr;
 	}
+	return 0;
+}
 
-	plabel = stack_labels;
-	while (plabel) {
-		nlabel = plabel->next;
-		free(plabel);
-		plabel = nlabel;
-	}
+/* Hashes pair of fields loaded by given load code, smaller value first
+ * so the result does not depend on the direction of the flow. Hash is
+ * taken from M[hash_mem], new hash is left in X and M[hash_mem].
+ * Uses M[5] as scratch.
+ */
+static int __bpf_pair_hash(struct sock_fprog *fprog, uint16_t code,
+			   int pos_a, int pos_b, int hash_mem)
+{
+	int err;
 
-	stack_init();
+	add_inst(fprog, BPF_STMT(code, pos_a));
+	bpf_store_a(5);
+	add_inst(fprog, BPF_STMT(code, pos_b));
+	bpf_load_mem_x(5);
+	/* leave smaller value in A and bigger one in M[5] */
+	add_inst(fprog, BPF_JUMP(BPF_JMP + BPF_JGT + BPF_X, 0, 0, 3));
+	bpf_store_a(5);
+	bpf_move_to_a();
+	add_inst(fprog, BPF_JUMP(BPF_JMP + BPF_JA, 1, 0, 0));
+	bpf_store_x(5);
+	bpf_load_mem_x(hash_mem);
+	bpf_calc_hash();
+	bpf_move_to_x();
+	bpf_load_mem(5);
+	bpf_calc_hash();
+	bpf_store_a(hash_mem);
+	bpf_move_to_x();
 	return 0;
+
+err_add_inst:
+	return err;
+}
+
+/* Same as above for fields at absolute offsets with hash in X. */
+static int bpf_pair_hash_abs(struct sock_fprog *fprog, int size,
+			     int pos_a, int pos_b)
+{
+	int err;
+
+	bpf_store_x(4);
+	return __bpf_pair_hash(fprog, BPF_LD + size + BPF_ABS,
+			       pos_a, pos_b, 4);
+
+err_add_inst:
+	return err;
+}
+
+/* Same as above for fields relative to X with hash in M[0]. X is
+ * restored from M[2] afterwards.
+ */
+static int bpf_pair_hash_ind(struct sock_fprog *fprog, int size,
+			     int pos_a, int pos_b)
+{
+	int err;
+
+	err = __bpf_pair_hash(fprog, BPF_LD + size + BPF_IND,
+			      pos_a, pos_b, 0);
+	if (err)
+		return err;
+	bpf_load_mem_x(2);
+	return 0;
+
+err_add_inst:
+	return err;
 }
 
 static int bpf_eth_hash(struct sock_fprog *fprog)
 {
 	int err;
 
+	if (bpf_ctx(fprog)->hflags.symmetric) {
+		err = bpf_pair_hash_abs(fprog, BPF_W, 2, 8);
+		if (err)
+			return err;
+		return bpf_pair_hash_abs(fprog, BPF_H, 0, 6);
+	}
+
 	/* hash dest mac addr */
 	bpf_load_word(2);
 	bpf_calc_hash();
@@ -496,6 +703,10 @@ static int __bpf_ipv4_hash(struct sock_fprog *fprog, bool vlan)
 	int vlan_shift = vlan ? vlan_hdr_shift(0) : 0;
 	int err;
 
+	if (bpf_ctx(fprog)->hflags.symmetric)
+		return bpf_pair_hash_abs(fprog, BPF_W, 26 + vlan_shift,
+					 30 + vlan_shift);
+
 	bpf_load_word(26 + vlan_shift);
 	bpf_calc_hash();
 	bpf_move_to_x();
@@ -522,6 +733,18 @@ static int __bpf_ipv6_hash(struct sock_fprog *fprog, bool vlan)
 {
 	int vlan_shift = vlan ? vlan_hdr_shift(0) : 0;
 	int err;
+	int i;
+
+	if (bpf_ctx(fprog)->hflags.symmetric) {
+		for (i = 0; i < 16; i += 4) {
+			err = bpf_pair_hash_abs(fprog, BPF_W,
+						22 + vlan_shift + i,
+						38 + vlan_shift + i);
+			if (err)
+				return err;
+		}
+		return 0;
+	}
 
 	bpf_load_word(22 + vlan_shift);
 	bpf_calc_hash();
@@ -568,6 +791,14 @@ static int __bpf_l4v4_hash(struct sock_fprog *fprog, bool vlan)
 	int vlan_shift = vlan ? vlan_hdr_shift(0) : 0;
 	int err;
 
+	if (bpf_ctx(fprog)->hflags.symmetric) {
+		bpf_push_x();
+		bpf_ipv4_len_to_x(14 + vlan_shift);
+		/* source and dest port offsets */
+		return __bpf_pair_hash(fprog, BPF_LD + BPF_H + BPF_IND,
+				       14 + vlan_shift, 16 + vlan_shift, 0);
+	}
+
 	bpf_push_x();
 	bpf_ipv4_len_to_x(14 + vlan_shift);
 	/* source port offset */
@@ -602,8 +833,13 @@ static int __bpf_l4v6_hash(struct sock_fprog *fprog, bool vlan)
 	int vlan_shift = vlan ? vlan_hdr_shift(0) : 0;
 	int err;
 
+	if (bpf_ctx(fprog)->hflags.symmetric)
+		return bpf_pair_hash_abs(fprog, BPF_H, 54 + vlan_shift,
+					 56 + vlan_shift);
+
 	bpf_load_half(54 + vlan_shift);
 	bpf_calc_hash();
+	bpf_move_to_x();
 	bpf_load_half(56 + vlan_shift);
 	bpf_calc_hash();
 	bpf_move_to_x();
@@ -623,6 +859,291 @@ static int bpf_novlan_l4v6_hash(struct sock_fprog *fprog)
 	return __bpf_l4v6_hash(fprog, false);
 }
 
+/* Walks IPv6 extension headers. Expects hash in X, saves it to M[0].
+ * Leaves L4 protocol in A and L4 header offset in X. Non-first fragments
+ * jump to out_label.
+ */
+static int __bpf_ipv6_exthdr_walk(struct sock_fprog *fprog, bool vlan,
+				  enum bpf_labels done_label,
+				  enum bpf_labels out_label)
+{
+	int vlan_shift = vlan ? vlan_hdr_shift(0) : 0;
+	int err;
+	int i;
+
+	bpf_push_x();
+	add_inst(fprog, BPF_STMT(BPF_LDX + BPF_W + BPF_IMM,
+				 IPV6_HEADER_END + vlan_shift));
+	bpf_load_byte(IPV6_NEXTHEADER_OFFSET + vlan_shift);
+
+	for (i = 0; i < IPV6_EXTHDR_MAX; i++) {
+		/* jump offsets are relative to the layout below */
+		add_inst(fprog, BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K,
+					 PROTOID_HOPOPTS, 3, 0));
+		add_inst(fprog, BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K,
+					 PROTOID_ROUTING, 2, 0));
+		add_inst(fprog, BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K,
+					 PROTOID_DSTOPTS, 1, 0));
+		bpf_cmp(9, done_label, PROTOID_FRAGMENT, FIX_JF);
+
+		/* options or routing header, length is in 8 octet units
+		 * not including the first 8 octets
+		 */
+		add_inst(fprog, BPF_STMT(BPF_LD + BPF_B + BPF_IND, 0));
+		add_inst(fprog, BPF_STMT(BPF_ST, 1));
+		add_inst(fprog, BPF_STMT(BPF_LD + BPF_B + BPF_IND, 1));
+		add_inst(fprog, BPF_STMT(BPF_ALU + BPF_ADD + BPF_K, 1));
+		add_inst(fprog, BPF_STMT(BPF_ALU + BPF_LSH + BPF_K, 3));
+		add_inst(fprog, BPF_STMT(BPF_ALU + BPF_ADD + BPF_X, 0));
+		bpf_move_to_x();
+		add_inst(fprog, BPF_STMT(BPF_LD + BPF_W + BPF_MEM, 1));
+		add_inst(fprog, BPF_JUMP(BPF_JMP + BPF_JA, 8, 0, 0));
+
+		/* fragment header, only the first fragment has L4 header */
+		add_inst(fprog, BPF_STMT(BPF_LD + BPF_H + BPF_IND, 2));
+		bpf_and(out_label, 0, IPV6_FRAG_OFFSET_BITS, FIX_JT);
+		add_inst(fprog, BPF_STMT(BPF_LD + BPF_B + BPF_IND, 0));
+		add_inst(fprog, BPF_STMT(BPF_ST, 1));
+		bpf_move_to_a();
+		add_inst(fprog, BPF_STMT(BPF_ALU + BPF_ADD + BPF_K, 8));
+		bpf_move_to_x();
+		add_inst(fprog, BPF_STMT(BPF_LD + BPF_W + BPF_MEM, 1));
+	}
+	push_label(fprog, done_label);
+	return 0;
+
+err_add_inst:
+	return err;
+}
+
+/* Hashes both ports at once, L4 header offset is expected in X and hash
+ * in M[0]. New hash is stored back to M[0].
+ */
+static int bpf_l4v6_exthdr_hash(struct sock_fprog *fprog)
+{
+	int err;
+
+	if (bpf_ctx(fprog)->hflags.symmetric)
+		return __bpf_pair_hash(fprog, BPF_LD + BPF_H + BPF_IND,
+				       0, 2, 0);
+
+	add_inst(fprog, BPF_STMT(BPF_LD + BPF_W + BPF_IND, 0));
+	bpf_pop_x();
+	bpf_calc_hash();
+	bpf_push_a();
+	return 0;
+
+err_add_inst:
+	return err;
+}
+
+#define tunnel_label(l) (base + (l))
+
+#define bpf_ind_hash_pair(size, pos_a, pos_b)				\
+	do {								\
+		if (bpf_ctx(fprog)->hflags.symmetric) {			\
+			err = bpf_pair_hash_ind(fprog, size,		\
+						pos_a, pos_b);		\
+			if (err)					\
+				return err;				\
+		} else {						\
+			bpf_ind_hash(size, pos_a);			\
+			bpf_ind_hash(size, pos_b);			\
+		}							\
+	} while (0)
+
+/* both ports at once unless symmetric hash is requested */
+#define bpf_ind_hash_ports()						\
+	do {								\
+		if (bpf_ctx(fprog)->hflags.symmetric)			\
+			bpf_ind_hash_pair(BPF_H, 0, 2);			\
+		else							\
+			bpf_ind_hash(BPF_W, 0);				\
+	} while (0)
+
+/* Recognizes VXLAN, Geneve and GRE encapsulation in outer IPv4 or IPv6
+ * packet and hashes inner IP addresses and L4 ports (inner MAC addresses
+ * for non-IP payload) instead of outer ones which are the same for all
+ * flows between two tunnel endpoints. Expects hash in X. Packets which
+ * are not recognized continue with hash in X.
+ *
+ * Scratch memory: M[0] hash, M[1] and M[3] temporaries, M[2] offset of
+ * currently hashed inner header.
+ */
+static int __bpf_tunnel_hash(struct sock_fprog *fprog,
+			     struct hash_flags *flags, bool vlan, bool ipv6,
+			     enum bpf_labels base)
+{
+	int l3 = L3_OFFSET + (vlan ? vlan_hdr_shift(0) : 0);
+	bool vxlan, geneve, gre;
+	int err;
+
+	vxlan = hash_test_and_set_flag(flags, vlan ? HASH_VLAN_VXLAN :
+							 HASH_NOVLAN_VXLAN);
+	geneve = hash_test_and_set_flag(flags, vlan ? HASH_VLAN_GENEVE :
+							  HASH_NOVLAN_GENEVE);
+	gre = hash_test_and_set_flag(flags, vlan ? HASH_VLAN_GRE :
+						       HASH_NOVLAN_GRE);
+	if (!vxlan && !geneve && !gre)
+		return 0;
+
+	bpf_push_x();
+	/* get outer L4 protocol to A and outer L3 header length to X */
+	if (ipv6) {
+		add_inst(fprog, BPF_STMT(BPF_LDX + BPF_W + BPF_IMM,
+					 INNER_IPV6_HEADER_LEN));
+		bpf_load_byte(l3 - L3_OFFSET + IPV6_NEXTHEADER_OFFSET);
+	} else {
+		bpf_load_half(l3 - L3_OFFSET + IPV4_FLAGS_OFFSET);
+		bpf_and(tunnel_label(TUNNEL_SKIP), 0, IPV4_FRAG_BITS, FIX_JT);
+		bpf_ipv4_len_to_x(l3);
+		bpf_load_byte(l3 - L3_OFFSET + IPV4_PROTO_OFFSET);
+	}
+	if (gre)
+		bpf_cmp(tunnel_label(TUNNEL_GRE), 0, PROTOID_GRE, FIX_JT);
+	if (vxlan || geneve) {
+		bpf_cmp(0, tunnel_label(TUNNEL_SKIP), PROTOID_UDP, FIX_JF);
+		add_inst(fprog, BPF_STMT(BPF_LD + BPF_H + BPF_IND,
+					 l3 + UDP_DPORT_OFFSET));
+		if (vxlan)
+			bpf_cmp(tunnel_label(TUNNEL_VXLAN), 0, PORT_VXLAN,
+				FIX_JT);
+		if (geneve)
+			bpf_cmp(tunnel_label(TUNNEL_GENEVE), 0, PORT_GENEVE,
+				FIX_JT);
+	}
+	/* OUT is too far away for conditional jumps above */
+	push_label(fprog, tunnel_label(TUNNEL_SKIP));
+	bpf_jump(tunnel_label(TUNNEL_OUT));
+
+	if (vxlan) {
+		push_label(fprog, tunnel_label(TUNNEL_VXLAN));
+		bpf_add_to_x(l3 + UDP_HEADER_LEN + VXLAN_HEADER_LEN);
+		bpf_jump(tunnel_label(TUNNEL_INNER_ETH));
+	}
+
+	if (geneve) {
+		push_label(fprog, tunnel_label(TUNNEL_GENEVE));
+		add_inst(fprog, BPF_STMT(BPF_LD + BPF_H + BPF_IND,
+					 l3 + UDP_HEADER_LEN +
+					 GENEVE_PROTO_OFFSET));
+		bpf_cmp_far_jf(tunnel_label(TUNNEL_OUT), PROTOID_TEB);
+		/* options length is in 4 octet units */
+		add_inst(fprog, BPF_STMT(BPF_LD + BPF_B + BPF_IND,
+					 l3 + UDP_HEADER_LEN));
+		bpf_and_word(GENEVE_OPTLEN_MASK);
+		add_inst(fprog, BPF_STMT(BPF_ALU + BPF_LSH + BPF_K, 2));
+		add_inst(fprog, BPF_STMT(BPF_ALU + BPF_ADD + BPF_X, 0));
+		bpf_add(l3 + UDP_HEADER_LEN + VXLAN_HEADER_LEN);
+		bpf_move_to_x();
+		bpf_jump(tunnel_label(TUNNEL_INNER_ETH));
+	}
+
+	if (gre) {
+		push_label(fprog, tunnel_label(TUNNEL_GRE));
+		add_inst(fprog, BPF_STMT(BPF_LD + BPF_H + BPF_IND,
+					 l3 + GRE_PROTO_OFFSET));
+		bpf_store_a(1);
+		add_inst(fprog, BPF_STMT(BPF_LD + BPF_B + BPF_IND, l3));
+		bpf_store_a(3);
+		bpf_add_to_x(l3 + GRE_HEADER_LEN);
+		/* each of checksum, key and sequence adds 4 octets */
+		bpf_load_mem(3);
+		add_inst(fprog, BPF_JUMP(BPF_JMP + BPF_JSET + BPF_K,
+					 GRE_FLAG_CSUM, 0, 3));
+		bpf_add_to_x(4);
+		bpf_load_mem(3);
+		add_inst(fprog, BPF_JUMP(BPF_JMP + BPF_JSET + BPF_K,
+					 GRE_FLAG_KEY, 0, 3));
+		bpf_add_to_x(4);
+		bpf_load_mem(3);
+		add_inst(fprog, BPF_JUMP(BPF_JMP + BPF_JSET + BPF_K,
+					 GRE_FLAG_SEQ, 0, 3));
+		bpf_add_to_x(4);
+		bpf_load_mem(1);
+		bpf_cmp(tunnel_label(TUNNEL_INNER_ETH), 0, PROTOID_TEB, FIX_JT);
+		bpf_cmp(tunnel_label(TUNNEL_INNER_IPV4), 0, PROTOID_IPV4,
+			FIX_JT);
+		bpf_cmp(tunnel_label(TUNNEL_INNER_IPV6), 0, PROTOID_IPV6,
+			FIX_JT);
+		bpf_jump(tunnel_label(TUNNEL_OUT));
+	}
+
+	/* X points to inner ethernet header */
+	push_label(fprog, tunnel_label(TUNNEL_INNER_ETH));
+	add_inst(fprog, BPF_STMT(BPF_LD + BPF_H + BPF_IND,
+				 INNER_ETH_TYPE_OFFSET));
+	bpf_store_a(1);
+	bpf_add_to_x(INNER_ETH_HEADER_LEN);
+	bpf_load_mem(1);
+	bpf_cmp(tunnel_label(TUNNEL_INNER_IPV4), 0, PROTOID_IPV4, FIX_JT);
+	bpf_cmp(tunnel_label(TUNNEL_INNER_IPV6), 0, PROTOID_IPV6, FIX_JT);
+	bpf_add_to_x(-INNER_ETH_HEADER_LEN);
+	bpf_store_x(2);
+	bpf_ind_hash_pair(BPF_W, 2, 8);
+	bpf_ind_hash_pair(BPF_H, 0, 6);
+	bpf_jump(tunnel_label(TUNNEL_DONE));
+
+	/* X points to inner IPv4 header */
+	push_label(fprog, tunnel_label(TUNNEL_INNER_IPV4));
+	bpf_store_x(2);
+	bpf_ind_hash_pair(BPF_W, INNER_IPV4_SADDR_OFFSET,
+			  INNER_IPV4_SADDR_OFFSET + 4);
+	add_inst(fprog, BPF_STMT(BPF_LD + BPF_H + BPF_IND,
+				 INNER_IPV4_FLAGS_OFFSET));
+	bpf_and(tunnel_label(TUNNEL_DONE), 0, IPV4_FRAG_BITS, FIX_JT);
+	add_inst(fprog, BPF_STMT(BPF_LD + BPF_B + BPF_IND,
+				 INNER_IPV4_PROTO_OFFSET));
+	bpf_cmp(tunnel_label(TUNNEL_INNER_L4v4), 0, PROTOID_TCP, FIX_JT);
+	bpf_cmp(tunnel_label(TUNNEL_INNER_L4v4), 0, PROTOID_UDP, FIX_JT);
+	bpf_cmp(0, tunnel_label(TUNNEL_DONE), PROTOID_SCTP, FIX_JF);
+	push_label(fprog, tunnel_label(TUNNEL_INNER_L4v4));
+	add_inst(fprog, BPF_STMT(BPF_LD + BPF_B + BPF_IND, 0));
+	bpf_and_word(0xf);
+	add_inst(fprog, BPF_STMT(BPF_ALU + BPF_LSH + BPF_K, 2));
+	add_inst(fprog, BPF_STMT(BPF_ALU + BPF_ADD + BPF_X, 0));
+	bpf_move_to_x();
+	bpf_store_x(2);
+	bpf_ind_hash_ports();
+	bpf_jump(tunnel_label(TUNNEL_DONE));
+
+	/* X points to inner IPv6 header */
+	push_label(fprog, tunnel_label(TUNNEL_INNER_IPV6));
+	bpf_store_x(2);
+	bpf_ind_hash_pair(BPF_W, INNER_IPV6_SADDR_OFFSET,
+			  INNER_IPV6_SADDR_OFFSET + 16);
+	bpf_ind_hash_pair(BPF_W, INNER_IPV6_SADDR_OFFSET + 4,
+			  INNER_IPV6_SADDR_OFFSET + 20);
+	bpf_ind_hash_pair(BPF_W, INNER_IPV6_SADDR_OFFSET + 8,
+			  INNER_IPV6_SADDR_OFFSET + 24);
+	bpf_ind_hash_pair(BPF_W, INNER_IPV6_SADDR_OFFSET + 12,
+			  INNER_IPV6_SADDR_OFFSET + 28);
+	add_inst(fprog, BPF_STMT(BPF_LD + BPF_B + BPF_IND,
+				 INNER_IPV6_NEXTHEADER_OFFSET));
+	bpf_cmp(tunnel_label(TUNNEL_INNER_L4v6), 0, PROTOID_TCP, FIX_JT);
+	bpf_cmp(tunnel_label(TUNNEL_INNER_L4v6), 0, PROTOID_UDP, FIX_JT);
+	bpf_cmp(0, tunnel_label(TUNNEL_DONE), PROTOID_SCTP, FIX_JF);
+	push_label(fprog, tunnel_label(TUNNEL_INNER_L4v6));
+	bpf_add_to_x(INNER_IPV6_HEADER_LEN);
+	bpf_store_x(2);
+	bpf_ind_hash_ports();
+
+	push_label(fprog, tunnel_label(TUNNEL_DONE));
+	bpf_pop_x();
+	bpf_hash_return();
+
+	push_label(fprog, tunnel_label(TUNNEL_OUT));
+	bpf_pop_x();
+	return 0;
+
+err_add_inst:
+	return err;
+}
+
+#undef bpf_ind_hash_ports
+#undef bpf_ind_hash_pair
+#undef tunnel_label
+
 /* bpf_create_code:
  * This function creates the entire bpf hashing code and follows
  * this scheme:
@@ -667,7 +1188,10 @@ static int bpf_create_code(struct sock_fprog *fprog, struct hash_flags *flags)
 	}
 
 	bpf_load_half(ETH_TYPE_OFFSET);
-	bpf_cmp(LABEL_VLAN_BRANCH, 0, PROTOID_VLAN, FIX_JT);
+	/* vlan branch might be out of conditional jump range */
+	add_inst(fprog, BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K,
+				 PROTOID_VLAN, 0, 1));
+	bpf_jump(LABEL_VLAN_BRANCH);
 
 	/* no vlan branch, but might be offloaded */
 	if (hash_test_and_set_flag(flags, HASH_VLAN)) {
@@ -685,12 +1209,17 @@ static int bpf_create_code(struct sock_fprog *fprog, struct hash_flags *flags)
 		bpf_load_half(ETH_TYPE_OFFSET);
 
 	/* no vlan branch */
-	bpf_cmp(0, LABEL_NOVLAN_IPV6, PROTOID_IPV4, FIX_JF);
+	bpf_cmp_far_jf(LABEL_NOVLAN_IPV6, PROTOID_IPV4);
 
 	/* no vlan ipv4 branch */
 	if (hash_test_and_set_flag(flags, HASH_NOVLAN_IPV4))
 		bpf_novlan_ipv4_hash(fprog);
 
+	err = __bpf_tunnel_hash(fprog, flags, false, false,
+				LABEL_NOVLAN_IPV4_TUNNEL);
+	if (err)
+		return err;
+
 	if (!hash_is_l4v4_enabled(flags))
 		bpf_hash_return();
 
@@ -740,12 +1269,25 @@ static int bpf_create_code(struct sock_fprog *fprog, struct hash_flags *flags)
 	if (hash_test_and_set_flag(flags, HASH_NOVLAN_IPV6))
 		bpf_novlan_ipv6_hash(fprog);
 
+	err = __bpf_tunnel_hash(fprog, flags, false, true,
+				LABEL_NOVLAN_IPV6_TUNNEL);
+	if (err)
+		return err;
+
 	if (!hash_is_l4v6_enabled(flags))
 		bpf_hash_return();
 
 	/* no vlan ipv6 l4 branch */
 	/* L4 protocol check (Next Header) */
-	bpf_load_byte(IPV6_NEXTHEADER_OFFSET);
+	if (flags->mix) {
+		err = __bpf_ipv6_exthdr_walk(fprog, false,
+					     LABEL_NOVLAN_EXTHDR_DONE,
+					     LABEL_NOVLAN_L4v6_OUT);
+		if (err)
+			return err;
+	} else {
+		bpf_load_byte(IPV6_NEXTHEADER_OFFSET);
+	}
 	bpf_cmp(0, LABEL_NOVLAN_TRY_UDP6, PROTOID_TCP, FIX_JF);
 
 	if (hash_test_and_set_flag(flags, HASH_NOVLAN_TCP6))
@@ -769,10 +1311,15 @@ static int bpf_create_code(struct sock_fprog *fprog, struct hash_flags *flags)
 
 	/* no vlan l4v6 hashing */
 	push_label(fprog, LABEL_NOVLAN_L4v6_HASH);
-	bpf_novlan_l4v6_hash(fprog);
+	if (flags->mix)
+		bpf_l4v6_exthdr_hash(fprog);
+	else
+		bpf_novlan_l4v6_hash(fprog);
 
 	/* no vlan l4v6 out */
 	push_label(fprog, LABEL_NOVLAN_L4v6_OUT);
+	if (flags->mix)
+		bpf_pop_x();
 	bpf_hash_return();
 
 	/* vlan branch */
@@ -786,11 +1333,16 @@ static int bpf_create_code(struct sock_fprog *fprog, struct hash_flags *flags)
 	}
 
 	bpf_load_half(vlan_hdr_shift(ETH_TYPE_OFFSET));
-	bpf_cmp(0, LABEL_VLAN_IPV6, PROTOID_IPV4, FIX_JF);
+	bpf_cmp_far_jf(LABEL_VLAN_IPV6, PROTOID_IPV4);
 	/* vlan ipv4 branch */
 	if (hash_test_and_set_flag(flags, HASH_VLAN_IPV4))
 		bpf_vlan_ipv4_hash(fprog);
 
+	err = __bpf_tunnel_hash(fprog, flags, true, false,
+				LABEL_VLAN_IPV4_TUNNEL);
+	if (err)
+		return err;
+
 	if (!hash_is_l4v4_enabled(flags))
 		bpf_hash_return();
 
@@ -840,12 +1392,25 @@ static int bpf_create_code(struct sock_fprog *fprog, struct hash_flags *flags)
 	if (hash_test_and_set_flag(flags, HASH_VLAN_IPV6))
 		bpf_vlan_ipv6_hash(fprog);
 
+	err = __bpf_tunnel_hash(fprog, flags, true, true,
+				LABEL_VLAN_IPV6_TUNNEL);
+	if (err)
+		return err;
+
 	if (!hash_is_l4v6_enabled(flags))
 		bpf_hash_return();
 
 	/* vlan ipv6 l4 branch */
 	/* L4 protocol check (Next Header) */
-	bpf_load_byte(vlan_hdr_shift(IPV6_NEXTHEADER_OFFSET));
+	if (flags->mix) {
+		err = __bpf_ipv6_exthdr_walk(fprog, true,
+					     LABEL_VLAN_EXTHDR_DONE,
+					     LABEL_VLAN_L4v6_OUT);
+		if (err)
+			return err;
+	} else {
+		bpf_load_byte(vlan_hdr_shift(IPV6_NEXTHEADER_OFFSET));
+	}
 	bpf_cmp(0, LABEL_VLAN_TRY_UDP6, PROTOID_TCP, FIX_JF);
 
 	if (hash_test_and_set_flag(flags, HASH_VLAN_TCP6))
@@ -869,10 +1434,15 @@ static int bpf_create_code(struct sock_fprog *fprog, struct hash_flags *flags)
 
 	/* vlan l4v6 hashing */
 	push_label(fprog, LABEL_VLAN_L4v6_HASH);
-	bpf_vlan_l4v6_hash(fprog);
+	if (flags->mix)
+		bpf_l4v6_exthdr_hash(fprog);
+	else
+		bpf_vlan_l4v6_hash(fprog);
 
 	/* vlan l4v6 out */
 	push_label(fprog, LABEL_VLAN_L4v6_OUT);
+	if (flags->mix)
+		bpf_pop_x();
 	bpf_hash_return();
 	return 0;
 
@@ -880,70 +1450,187 @@ err_add_inst:
 	return err;
 }
 
-int teamd_bpf_desc_add_frag(struct sock_fprog *fprog,
+static const struct teamd_bpf_desc_frag eth_hdr_frag = {
+	.name = "eth",
+	.hproto = PROTO_ETH,
+};
+
+static const struct teamd_bpf_desc_frag vlan_hdr_frag = {
+	.name = "vlan",
+	.hproto = PROTO_VLAN,
+};
+
+static const struct teamd_bpf_desc_frag ipv4_hdr_frag = {
+	.name = "ipv4",
+	.hproto = PROTO_IPV4,
+};
+
+static const struct teamd_bpf_desc_frag ipv6_hdr_frag = {
+	.name = "ipv6",
+	.hproto = PROTO_IPV6,
+};
+
+static const struct teamd_bpf_desc_frag ip_hdr_frag = {
+	.name = "ip",
+	.hproto = PROTO_IP,
+};
+
+static const struct teamd_bpf_desc_frag l3_hdr_frag = {
+	.name = "l3",
+	.hproto = PROTO_L3,
+};
+
+static const struct teamd_bpf_desc_frag l4_hdr_frag = {
+	.name = "l4",
+	.hproto = PROTO_L4,
+};
+
+static const struct teamd_bpf_desc_frag tcp_hdr_frag = {
+	.name = "tcp",
+	.hproto = PROTO_TCP,
+};
+static const struct teamd_bpf_desc_frag udp_hdr_frag = {
+	.name = "udp",
+	.hproto = PROTO_UDP,
+};
+static const struct teamd_bpf_desc_frag sctp_hdr_frag = {
+	.name = "sctp",
+	.hproto = PROTO_SCTP,
+};
+
+static const struct teamd_bpf_desc_frag vxlan_inner_frag = {
+	.name = "vxlan_inner",
+	.hproto = PROTO_VXLAN,
+};
+
+static const struct teamd_bpf_desc_frag geneve_inner_frag = {
+	.name = "geneve_inner",
+	.hproto = PROTO_GENEVE,
+};
+
+static const struct teamd_bpf_desc_frag gre_inner_frag = {
+	.name = "gre_inner",
+	.hproto = PROTO_GRE,
+};
+
+static const struct teamd_bpf_desc_frag symmetric_frag = {
+	.name = "symmetric",
+	.hproto = PROTO_SYMMETRIC,
+};
+
+static const struct teamd_bpf_desc_frag *frags[] = {
+	&eth_hdr_frag,
+	&vlan_hdr_frag,
+	&ipv4_hdr_frag,
+	&ipv6_hdr_frag,
+	&ip_hdr_frag,
+	&l3_hdr_frag,
+	&l4_hdr_frag,
+	&tcp_hdr_frag,
+	&udp_hdr_frag,
+	&sctp_hdr_frag,
+	&vxlan_inner_frag,
+	&geneve_inner_frag,
+	&gre_inner_frag,
+	&symmetric_frag,
+};
+
+static const size_t frags_count = ARRAY_SIZE(frags);
+
+const struct teamd_bpf_desc_frag *teamd_bpf_desc_find_frag(const char *frag_name)
+{
+	int i;
+
+	for (i = 0; i < frags_count; i++) {
+		if (!strcmp(frag_name, frags[i]->name))
+			return frags[i];
+	}
+	return NULL;
+}
+
+int teamd_bpf_desc_add_frag(struct teamd_bpf_desc_ctx *dctx,
 			    const struct teamd_bpf_desc_frag *frag)
 {
 	switch (frag->hproto) {
 		case PROTO_ETH:
-			hash_set_enable(&hflags, HASH_ETH);
+			hash_set_enable(&dctx->hflags, HASH_ETH);
 			break;
 
 		case PROTO_VLAN:
-			hash_set_enable(&hflags, HASH_VLAN);
+			hash_set_enable(&dctx->hflags, HASH_VLAN);
 			break;
 
 		case PROTO_IP:
 		case PROTO_L3:
-			hash_set_enable(&hflags, HASH_VLAN_IPV4);
-			hash_set_enable(&hflags, HASH_VLAN_IPV6);
-			hash_set_enable(&hflags, HASH_NOVLAN_IPV4);
-			hash_set_enable(&hflags, HASH_NOVLAN_IPV6);
+			hash_set_enable(&dctx->hflags, HASH_VLAN_IPV4);
+			hash_set_enable(&dctx->hflags, HASH_VLAN_IPV6);
+			hash_set_enable(&dctx->hflags, HASH_NOVLAN_IPV4);
+			hash_set_enable(&dctx->hflags, HASH_NOVLAN_IPV6);
 			break;
 
 		case PROTO_IPV4:
-			hash_set_enable(&hflags, HASH_VLAN_IPV4);
-			hash_set_enable(&hflags, HASH_NOVLAN_IPV4);
+			hash_set_enable(&dctx->hflags, HASH_VLAN_IPV4);
+			hash_set_enable(&dctx->hflags, HASH_NOVLAN_IPV4);
 			break;
 
 		case PROTO_IPV6:
-			hash_set_enable(&hflags, HASH_VLAN_IPV6);
-			hash_set_enable(&hflags, HASH_NOVLAN_IPV6);
+			hash_set_enable(&dctx->hflags, HASH_VLAN_IPV6);
+			hash_set_enable(&dctx->hflags, HASH_NOVLAN_IPV6);
 			break;
 
 		case PROTO_L4:
-			hash_set_enable(&hflags, HASH_VLAN_TCP4);
-			hash_set_enable(&hflags, HASH_VLAN_TCP6);
-			hash_set_enable(&hflags, HASH_VLAN_UDP4);
-			hash_set_enable(&hflags, HASH_VLAN_UDP6);
-			hash_set_enable(&hflags, HASH_VLAN_SCTP4);
-			hash_set_enable(&hflags, HASH_VLAN_SCTP6);
-			hash_set_enable(&hflags, HASH_NOVLAN_TCP4);
-			hash_set_enable(&hflags, HASH_NOVLAN_TCP6);
-			hash_set_enable(&hflags, HASH_NOVLAN_UDP4);
-			hash_set_enable(&hflags, HASH_NOVLAN_UDP6);
-			hash_set_enable(&hflags, HASH_NOVLAN_SCTP4);
-			hash_set_enable(&hflags, HASH_NOVLAN_SCTP6);
+			hash_set_enable(&dctx->hflags, HASH_VLAN_TCP4);
+			hash_set_enable(&dctx->hflags, HASH_VLAN_TCP6);
+			hash_set_enable(&dctx->hflags, HASH_VLAN_UDP4);
+			hash_set_enable(&dctx->hflags, HASH_VLAN_UDP6);
+			hash_set_enable(&dctx->hflags, HASH_VLAN_SCTP4);
+			hash_set_enable(&dctx->hflags, HASH_VLAN_SCTP6);
+			hash_set_enable(&dctx->hflags, HASH_NOVLAN_TCP4);
+			hash_set_enable(&dctx->hflags, HASH_NOVLAN_TCP6);
+			hash_set_enable(&dctx->hflags, HASH_NOVLAN_UDP4);
+			hash_set_enable(&dctx->hflags, HASH_NOVLAN_UDP6);
+			hash_set_enable(&dctx->hflags, HASH_NOVLAN_SCTP4);
+			hash_set_enable(&dctx->hflags, HASH_NOVLAN_SCTP6);
 			break;
 
 		case PROTO_TCP:
-			hash_set_enable(&hflags, HASH_VLAN_TCP4);
-			hash_set_enable(&hflags, HASH_VLAN_TCP6);
-			hash_set_enable(&hflags, HASH_NOVLAN_TCP4);
-			hash_set_enable(&hflags, HASH_NOVLAN_TCP6);
+			hash_set_enable(&dctx->hflags, HASH_VLAN_TCP4);
+			hash_set_enable(&dctx->hflags, HASH_VLAN_TCP6);
+			hash_set_enable(&dctx->hflags, HASH_NOVLAN_TCP4);
+			hash_set_enable(&dctx->hflags, HASH_NOVLAN_TCP6);
 			break;
 
 		case PROTO_UDP:
-			hash_set_enable(&hflags, HASH_VLAN_UDP4);
-			hash_set_enable(&hflags, HASH_VLAN_UDP6);
-			hash_set_enable(&hflags, HASH_NOVLAN_UDP4);
-			hash_set_enable(&hflags, HASH_NOVLAN_UDP6);
+			hash_set_enable(&dctx->hflags, HASH_VLAN_UDP4);
+			hash_set_enable(&dctx->hflags, HASH_VLAN_UDP6);
+			hash_set_enable(&dctx->hflags, HASH_NOVLAN_UDP4);
+			hash_set_enable(&dctx->hflags, HASH_NOVLAN_UDP6);
 			break;
 
 		case PROTO_SCTP:
-			hash_set_enable(&hflags, HASH_VLAN_SCTP4);
-			hash_set_enable(&hflags, HASH_VLAN_SCTP6);
-			hash_set_enable(&hflags, HASH_NOVLAN_SCTP4);
-			hash_set_enable(&hflags, HASH_NOVLAN_SCTP6);
+			hash_set_enable(&dctx->hflags, HASH_VLAN_SCTP4);
+			hash_set_enable(&dctx->hflags, HASH_VLAN_SCTP6);
+			hash_set_enable(&dctx->hflags, HASH_NOVLAN_SCTP4);
+			hash_set_enable(&dctx->hflags, HASH_NOVLAN_SCTP6);
+			break;
+
+		case PROTO_VXLAN:
+			hash_set_enable(&dctx->hflags, HASH_VLAN_VXLAN);
+			hash_set_enable(&dctx->hflags, HASH_NOVLAN_VXLAN);
+			break;
+
+		case PROTO_GENEVE:
+			hash_set_enable(&dctx->hflags, HASH_VLAN_GENEVE);
+			hash_set_enable(&dctx->hflags, HASH_NOVLAN_GENEVE);
+			break;
+
+		case PROTO_GRE:
+			hash_set_enable(&dctx->hflags, HASH_VLAN_GRE);
+			hash_set_enable(&dctx->hflags, HASH_NOVLAN_GRE);
+			break;
+
+		case PROTO_SYMMETRIC:
+			dctx->hflags.symmetric = true;
 			break;
 
 		default:
@@ -953,40 +1640,168 @@ int teamd_bpf_desc_add_frag(struct sock_fprog *fprog,
 	return 0;
 }
 
-static void __compile_init(struct sock_fprog *fprog)
+/*
+ * Compiled programs keyed by what they hash, so frag lists which differ
+ * only in order or naming share one entry. Teamd is single threaded,
+ * compiler contexts are what has to be independent.
+ */
+#define BPF_CACHE_SIZE	8
+
+struct bpf_cache_entry {
+	struct hash_flags key;
+	struct sock_filter *filter;
+	unsigned short len;
+	unsigned long last_use;
+};
+
+static struct bpf_cache_entry bpf_cache[BPF_CACHE_SIZE];
+static unsigned long bpf_cache_clock;
+
+static bool bpf_cache_key_eq(const struct hash_flags *a,
+			     const struct hash_flags *b)
 {
-	fprog->len = 0;
-	fprog->filter = NULL;
-	stack_init();
-	hash_flags_init(&hflags);
+	return a->required == b->required && a->mix == b->mix &&
+	       a->symmetric == b->symmetric;
 }
 
-void teamd_bpf_desc_compile_start(struct sock_fprog *fprog)
+static struct bpf_cache_entry *bpf_cache_find(const struct hash_flags *key)
 {
-	__compile_init(fprog);
+	int i;
+
+	for (i = 0; i < BPF_CACHE_SIZE; i++) {
+		if (bpf_cache[i].filter &&
+		    bpf_cache_key_eq(&bpf_cache[i].key, key))
+			return &bpf_cache[i];
+	}
+	return NULL;
 }
 
-void teamd_bpf_desc_compile_release(struct sock_fprog *fprog)
+static struct sock_filter *bpf_filter_dup(const struct sock_filter *filter,
+					  unsigned short len)
 {
-	free(fprog->filter);
-	__compile_init(fprog);
-	stack_release();
-	hash_flags_init(&hflags);
+	struct sock_filter *dup;
+
+	dup = malloc(sizeof(struct sock_filter) * len);
+	if (!dup)
+		return NULL;
+	memcpy(dup, filter, sizeof(struct sock_filter) * len);
+	return dup;
+}
+
+static void bpf_cache_add(const struct hash_flags *key,
+			  const struct sock_fprog *fprog)
+{
+	struct bpf_cache_entry *entry = &bpf_cache[0];
+	struct sock_filter *filter;
+	int i;
+
+	/* cache is just an optimization, failure is not fatal */
+	filter = bpf_filter_dup(fprog->filter, fprog->len);
+	if (!filter)
+		return;
+	for (i = 1; i < BPF_CACHE_SIZE; i++) {
+		if (bpf_cache[i].last_use < entry->last_use)
+			entry = &bpf_cache[i];
+	}
+	free(entry->filter);
+	entry->key = *key;
+	entry->filter = filter;
+	entry->len = fprog->len;
+	entry->last_use = ++bpf_cache_clock;
+}
+
+void teamd_bpf_desc_cache_flush(void)
+{
+	int i;
+
+	for (i = 0; i < BPF_CACHE_SIZE; i++)
+		free(bpf_cache[i].filter);
+	memset(bpf_cache, 0, sizeof(bpf_cache));
+	bpf_cache_clock = 0;
 }
 
-int teamd_bpf_desc_compile_finish(struct sock_fprog *fprog)
+struct teamd_bpf_desc_ctx *teamd_bpf_desc_ctx_alloc(void)
 {
+	struct teamd_bpf_desc_ctx *dctx;
+
+	dctx = myzalloc(sizeof(*dctx));
+	if (!dctx)
+		return NULL;
+	teamd_bpf_desc_compile_start(dctx);
+	return dctx;
+}
+
+void teamd_bpf_desc_ctx_free(struct teamd_bpf_desc_ctx *dctx)
+{
+	free(dctx->fprog.filter);
+	free(dctx->fixups);
+	free(dctx);
+}
+
+void teamd_bpf_desc_compile_start(struct teamd_bpf_desc_ctx *dctx)
+{
+	dctx->fprog.len = 0;
+	stack_init(dctx);
+	hash_flags_init(&dctx->hflags);
+}
+
+int teamd_bpf_desc_set_func(struct teamd_bpf_desc_ctx *dctx,
+			    enum teamd_bpf_hash_func func)
+{
+	switch (func) {
+	case TEAMD_BPF_HASH_FUNC_XOR:
+		dctx->hflags.mix = false;
+		break;
+	case TEAMD_BPF_HASH_FUNC_MIX:
+		dctx->hflags.mix = true;
+		break;
+	default:
+		return -EINVAL;
+	}
 	return 0;
 }
 
-int teamd_bpf_desc_compile(struct sock_fprog *fprog)
+void teamd_bpf_desc_compile_release(struct sock_fprog *fprog)
+{
+	free(fprog->filter);
+	fprog->filter = NULL;
+	fprog->len = 0;
+}
+
+int teamd_bpf_desc_compile(struct teamd_bpf_desc_ctx *dctx,
+			   struct sock_fprog *fprog)
 {
+	struct bpf_cache_entry *entry;
+	struct hash_flags key = dctx->hflags;
 	int err;
 
-	err = bpf_create_code(fprog, &hflags);
+	entry = bpf_cache_find(&key);
+	if (entry) {
+		entry->last_use = ++bpf_cache_clock;
+		fprog->filter = bpf_filter_dup(entry->filter, entry->len);
+		if (!fprog->filter)
+			return -ENOMEM;
+		fprog->len = entry->len;
+		return 0;
+	}
+
+	dctx->fprog.len = 0;
+	dctx->hflags.built = 0;
+	stack_init(dctx);
+	err = bpf_create_code(&dctx->fprog, &dctx->hflags);
+	if (!err)
+		err = dctx->err;
 	if (err)
 		return err;
 
-	err = stack_resolve_offsets(fprog);
-	return err;
+	err = stack_resolve_offsets(dctx);
+	if (err)
+		return err;
+
+	bpf_cache_add(&key, &dctx->fprog);
+	fprog->filter = bpf_filter_dup(dctx->fprog.filter, dctx->fprog.len);
+	if (!fprog->filter)
+		return -ENOMEM;
+	fprog->len = dctx->fprog.len;
+	return 0;
 }
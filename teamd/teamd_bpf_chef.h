@@ -34,6 +34,21 @@ enum hashing_protos {
 	PROTO_UDP,
 	PROTO_SCTP,
 	PROTO_L4,
+	PROTO_VXLAN,
+	PROTO_GENEVE,
+	PROTO_GRE,
+	PROTO_SYMMETRIC,
+};
+
+/*
+ * Function used to combine hashed fields.
+ * XOR just xors header words together. MIX multiplies after each field,
+ * runs murmur3 finalizer on the result and walks IPv6 extension headers
+ * to find L4 header.
+ */
+enum teamd_bpf_hash_func {
+	TEAMD_BPF_HASH_FUNC_XOR,
+	TEAMD_BPF_HASH_FUNC_MIX,
 };
 
 /*
@@ -46,11 +61,24 @@ struct teamd_bpf_desc_frag {
 	enum hashing_protos			hproto;
 };
 
-void teamd_bpf_desc_compile_start(struct sock_fprog *fprog);
-void teamd_bpf_desc_compile_release(struct sock_fprog *fprog);
-int teamd_bpf_desc_compile(struct sock_fprog *fprog);
-int teamd_bpf_desc_compile_finish(struct sock_fprog *fprog);
-int teamd_bpf_desc_add_frag(struct sock_fprog *fprog,
+/*
+ * Compiler context, holds all state of one compilation. Independent
+ * contexts can be used at the same time. Compiled programs are cached
+ * by what they hash so recompiling the same recipe is cheap.
+ */
+struct teamd_bpf_desc_ctx;
+
+const struct teamd_bpf_desc_frag *teamd_bpf_desc_find_frag(const char *frag_name);
+struct teamd_bpf_desc_ctx *teamd_bpf_desc_ctx_alloc(void);
+void teamd_bpf_desc_ctx_free(struct teamd_bpf_desc_ctx *dctx);
+void teamd_bpf_desc_compile_start(struct teamd_bpf_desc_ctx *dctx);
+int teamd_bpf_desc_set_func(struct teamd_bpf_desc_ctx *dctx,
+			    enum teamd_bpf_hash_func func);
+int teamd_bpf_desc_add_frag(struct teamd_bpf_desc_ctx *dctx,
 			    const struct teamd_bpf_desc_frag *frag);
+int teamd_bpf_desc_compile(struct teamd_bpf_desc_ctx *dctx,
+			   struct sock_fprog *fprog);
+void teamd_bpf_desc_compile_release(struct sock_fprog *fprog);
+void teamd_bpf_desc_cache_flush(void);
 
 #endif /* _TEAMD_BPF_CHEF_H_ */
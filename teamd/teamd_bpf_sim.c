@@ -0,0 +1,937 @@
+/*
+ *   teamd_bpf_sim.c - Offline simulator of teamd Tx hash functions
+ *   Copyright (C) 2026 agent <agent@local>
+ *
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <getopt.h>
+#include <errno.h>
+#include <linux/filter.h>
+#include <private/misc.h>
+
+#include "teamd_bpf_chef.h"
+
+/*
+ * Runs the classic BPF program compiled by teamd_bpf_chef over packets
+ * from pcap file or over generated flows and reports how the resulting
+ * hashes spread over hash buckets and ports. Bucket and port selection
+ * mimics the kernel loadbalance mode: the 32bit program result is folded
+ * into one byte by xoring its bytes and port is picked as bucket modulo
+ * port count.
+ */
+
+#define SIM_BUCKET_COUNT 256
+
+struct sim_packet {
+	const uint8_t *data;
+	unsigned int len;
+};
+
+struct sim_stats {
+	unsigned long long packet_count;
+	unsigned long long aborted_count;
+	unsigned long long asymmetric_count;
+	unsigned long long insn_count;
+	unsigned int insn_max;
+	unsigned long long buckets[SIM_BUCKET_COUNT];
+	unsigned long long *ports;
+	unsigned int port_count;
+};
+
+/*
+ * Classic BPF interpreter
+ */
+
+static int sim_load(const struct sim_packet *pkt, uint32_t offset,
+		    unsigned int size, uint32_t *p_val)
+{
+	const uint8_t *p;
+
+	if (offset > pkt->len || size > pkt->len - offset)
+		return -EFAULT;
+	p = pkt->data + offset;
+	switch (size) {
+	case 4:
+		*p_val = (uint32_t) p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+		break;
+	case 2:
+		*p_val = p[0] << 8 | p[1];
+		break;
+	default:
+		*p_val = p[0];
+	}
+	return 0;
+}
+
+static int sim_load_ancillary(const struct sim_packet *pkt, int32_t k,
+			      uint32_t A, uint32_t X, uint32_t *p_val)
+{
+	switch (k - SKF_AD_OFF) {
+	case SKF_AD_PROTOCOL:
+		return sim_load(pkt, 12, 2, p_val);
+	case SKF_AD_PKTTYPE:
+	case SKF_AD_IFINDEX:
+	case SKF_AD_MARK:
+	case SKF_AD_QUEUE:
+	case SKF_AD_HATYPE:
+	case SKF_AD_RXHASH:
+	case SKF_AD_CPU:
+	/* VLAN headers are always part of simulated packets,
+	 * no tag is offloaded.
+	 */
+	case SKF_AD_VLAN_TAG:
+	case SKF_AD_VLAN_TAG_PRESENT:
+		*p_val = 0;
+		return 0;
+	case SKF_AD_ALU_XOR_X:
+		*p_val = A ^ X;
+		return 0;
+	}
+	return -EOPNOTSUPP;
+}
+
+static unsigned int sim_size(uint16_t code)
+{
+	switch (BPF_SIZE(code)) {
+	case BPF_W:
+		return 4;
+	case BPF_H:
+		return 2;
+	default:
+		return 1;
+	}
+}
+
+static bool sim_jump_cond(uint16_t code, uint32_t A, uint32_t val)
+{
+	switch (BPF_OP(code)) {
+	case BPF_JEQ:
+		return A == val;
+	case BPF_JGT:
+		return A > val;
+	case BPF_JGE:
+		return A >= val;
+	default: /* BPF_JSET */
+		return A & val;
+	}
+}
+
+static int sim_alu(uint16_t code, uint32_t *A, uint32_t val)
+{
+	switch (BPF_OP(code)) {
+	case BPF_ADD:
+		*A += val;
+		break;
+	case BPF_SUB:
+		*A -= val;
+		break;
+	case BPF_MUL:
+		*A *= val;
+		break;
+	case BPF_DIV:
+		if (!val)
+			return -EINVAL;
+		*A /= val;
+		break;
+	case BPF_MOD:
+		if (!val)
+			return -EINVAL;
+		*A %= val;
+		break;
+	case BPF_AND:
+		*A &= val;
+		break;
+	case BPF_OR:
+		*A |= val;
+		break;
+	case BPF_XOR:
+		*A ^= val;
+		break;
+	case BPF_LSH:
+		*A <<= val;
+		break;
+	case BPF_RSH:
+		*A >>= val;
+		break;
+	case BPF_NEG:
+		*A = -*A;
+		break;
+	default:
+		return -EOPNOTSUPP;
+	}
+	return 0;
+}
+
+/* Returns -EOPNOTSUPP in case program contains instruction simulator does
+ * not know. Other errors mean the program was aborted the same way kernel
+ * would abort it, which results in zero hash.
+ */
+static int sim_bpf_run(const struct sock_fprog *fprog,
+		       const struct sim_packet *pkt,
+		       uint32_t *p_ret, unsigned int *p_insn_count)
+{
+	const struct sock_filter *f;
+	uint32_t mem[BPF_MEMWORDS];
+	uint32_t A = 0;
+	uint32_t X = 0;
+	uint32_t val;
+	unsigned int pc = 0;
+	int err = -EINVAL;
+
+	memset(mem, 0, sizeof(mem));
+	*p_ret = 0;
+	*p_insn_count = 0;
+	while (pc < fprog->len) {
+		f = &fprog->filter[pc++];
+		(*p_insn_count)++;
+
+		switch (BPF_CLASS(f->code)) {
+		case BPF_LD:
+		case BPF_LDX:
+			switch (BPF_MODE(f->code)) {
+			case BPF_ABS:
+				if ((int32_t) f->k >= SKF_AD_OFF &&
+				    (int32_t) f->k < 0)
+					err = sim_load_ancillary(pkt, f->k,
+								 A, X, &val);
+				else
+					err = sim_load(pkt, f->k,
+						       sim_size(f->code), &val);
+				break;
+			case BPF_IND:
+				err = sim_load(pkt, X + f->k,
+					       sim_size(f->code), &val);
+				break;
+			case BPF_MSH:
+				err = sim_load(pkt, f->k, 1, &val);
+				val = (val & 0xf) << 2;
+				break;
+			case BPF_LEN:
+				val = pkt->len;
+				err = 0;
+				break;
+			case BPF_IMM:
+				val = f->k;
+				err = 0;
+				break;
+			case BPF_MEM:
+				if (f->k >= BPF_MEMWORDS)
+					return -EINVAL;
+				val = mem[f->k];
+				err = 0;
+				break;
+			default:
+				return -EOPNOTSUPP;
+			}
+			if (err)
+				return err;
+			if (BPF_CLASS(f->code) == BPF_LD)
+				A = val;
+			else
+				X = val;
+			break;
+		case BPF_ST:
+		case BPF_STX:
+			if (f->k >= BPF_MEMWORDS)
+				return -EINVAL;
+			mem[f->k] = BPF_CLASS(f->code) == BPF_ST ? A : X;
+			break;
+		case BPF_ALU:
+			err = sim_alu(f->code, &A,
+				      BPF_SRC(f->code) == BPF_X ? X : f->k);
+			if (err)
+				return err;
+			break;
+		case BPF_JMP:
+			if (BPF_OP(f->code) == BPF_JA)
+				pc += f->k;
+			else if (sim_jump_cond(f->code, A,
+					       BPF_SRC(f->code) == BPF_X ?
+					       X : f->k))
+				pc += f->jt;
+			else
+				pc += f->jf;
+			break;
+		case BPF_RET:
+			*p_ret = BPF_RVAL(f->code) == BPF_A ? A : f->k;
+			return 0;
+		case BPF_MISC:
+			if (BPF_MISCOP(f->code) == BPF_TAX)
+				X = A;
+			else
+				A = X;
+			break;
+		default:
+			return -EOPNOTSUPP;
+		}
+	}
+	/* Falling off the end of program */
+	return -EINVAL;
+}
+
+static int sim_process_packet(const struct sock_fprog *fprog,
+			      struct sim_stats *stats,
+			      const struct sim_packet *pkt)
+{
+	unsigned int insn_count;
+	uint32_t ret;
+	uint8_t bucket;
+	int err;
+
+	err = sim_bpf_run(fprog, pkt, &ret, &insn_count);
+	if (err == -EOPNOTSUPP) {
+		fprintf(stderr, "Program contains unsupported instruction.\n");
+		return err;
+	}
+	if (err) {
+		stats->aborted_count++;
+		ret = 0;
+	}
+	bucket = ret ^ ret >> 8 ^ ret >> 16 ^ ret >> 24;
+	stats->packet_count++;
+	stats->insn_count += insn_count;
+	if (insn_count > stats->insn_max)
+		stats->insn_max = insn_count;
+	stats->buckets[bucket]++;
+	stats->ports[bucket % stats->port_count]++;
+	return 0;
+}
+
+/*
+ * Packet sources
+ */
+
+#define PCAP_MAGIC		0xa1b2c3d4
+#define PCAP_MAGIC_NSEC		0xa1b23c4d
+#define PCAP_LINKTYPE_ETHERNET	1
+
+struct pcap_file_hdr {
+	uint32_t magic;
+	uint16_t version_major;
+	uint16_t version_minor;
+	int32_t thiszone;
+	uint32_t sigfigs;
+	uint32_t snaplen;
+	uint32_t linktype;
+};
+
+struct pcap_pkt_hdr {
+	uint32_t ts_sec;
+	uint32_t ts_frac;
+	uint32_t caplen;
+	uint32_t len;
+};
+
+static int sim_run_pcap(const struct sock_fprog *fprog,
+			struct sim_stats *stats, const char *filename)
+{
+	struct pcap_file_hdr fhdr;
+	struct pcap_pkt_hdr phdr;
+	struct sim_packet pkt;
+	uint8_t *buf = NULL;
+	bool swapped;
+	FILE *f;
+	int err;
+
+	f = fopen(filename, "r");
+	if (!f) {
+		fprintf(stderr, "Failed to open \"%s\".\n", filename);
+		return -errno;
+	}
+	if (fread(&fhdr, sizeof(fhdr), 1, f) != 1) {
+		fprintf(stderr, "Failed to read pcap header.\n");
+		err = -EINVAL;
+		goto close_file;
+	}
+	if (fhdr.magic == PCAP_MAGIC || fhdr.magic == PCAP_MAGIC_NSEC) {
+		swapped = false;
+	} else if (fhdr.magic == __builtin_bswap32(PCAP_MAGIC) ||
+		   fhdr.magic == __builtin_bswap32(PCAP_MAGIC_NSEC)) {
+		swapped = true;
+	} else {
+		fprintf(stderr, "Unknown file format, only pcap is supported.\n");
+		err = -EINVAL;
+		goto close_file;
+	}
+	if (swapped) {
+		fhdr.snaplen = __builtin_bswap32(fhdr.snaplen);
+		fhdr.linktype = __builtin_bswap32(fhdr.linktype);
+	}
+	if (fhdr.linktype != PCAP_LINKTYPE_ETHERNET) {
+		fprintf(stderr, "Unsupported link type %u.\n", fhdr.linktype);
+		err = -EINVAL;
+		goto close_file;
+	}
+	buf = malloc(fhdr.snaplen);
+	if (!buf) {
+		err = -ENOMEM;
+		goto close_file;
+	}
+
+	while (fread(&phdr, sizeof(phdr), 1, f) == 1) {
+		if (swapped)
+			phdr.caplen = __builtin_bswap32(phdr.caplen);
+		if (phdr.caplen > fhdr.snaplen ||
+		    fread(buf, phdr.caplen, 1, f) != 1) {
+			fprintf(stderr, "Truncated or corrupted pcap file.\n");
+			err = -EINVAL;
+			goto free_buf;
+		}
+		pkt.data = buf;
+		pkt.len = phdr.caplen;
+		err = sim_process_packet(fprog, stats, &pkt);
+		if (err)
+			goto free_buf;
+	}
+	err = 0;
+
+free_buf:
+	free(buf);
+close_file:
+	fclose(f);
+	return err;
+}
+
+enum sim_flow_type {
+	SIM_FLOW_ETH,
+	SIM_FLOW_IPV4,
+	SIM_FLOW_TCP4,
+	SIM_FLOW_UDP4,
+	SIM_FLOW_IPV6,
+	SIM_FLOW_TCP6,
+	SIM_FLOW_UDP6,
+	SIM_FLOW_VXLAN,
+	SIM_FLOW_GENEVE,
+	SIM_FLOW_GRE,
+};
+
+static const char *sim_flow_type_names[] = {
+	[SIM_FLOW_ETH] = "eth",
+	[SIM_FLOW_IPV4] = "ipv4",
+	[SIM_FLOW_TCP4] = "tcp4",
+	[SIM_FLOW_UDP4] = "udp4",
+	[SIM_FLOW_IPV6] = "ipv6",
+	[SIM_FLOW_TCP6] = "tcp6",
+	[SIM_FLOW_UDP6] = "udp6",
+	[SIM_FLOW_VXLAN] = "vxlan",
+	[SIM_FLOW_GENEVE] = "geneve",
+	[SIM_FLOW_GRE] = "gre",
+};
+
+struct sim_flow_opts {
+	enum sim_flow_type type;
+	unsigned int count;
+	bool vlan;
+	bool reverse;
+	bool check_symmetric;
+	uint32_t seed;
+};
+
+static uint32_t sim_random(uint32_t *state)
+{
+	uint32_t x = *state;
+
+	/* xorshift32, good enough and reproducible across platforms */
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+	return x;
+}
+
+static void sim_random_fill(uint32_t *state, uint8_t *buf, unsigned int len)
+{
+	while (len--)
+		*buf++ = sim_random(state);
+}
+
+static void sim_put_u16(uint8_t *buf, uint16_t val)
+{
+	buf[0] = val >> 8;
+	buf[1] = val;
+}
+
+static void sim_swap(uint8_t *a, uint8_t *b, unsigned int len)
+{
+	uint8_t tmp;
+
+	while (len--) {
+		tmp = *a;
+		*a++ = *b;
+		*b++ = tmp;
+	}
+}
+
+/* Fields of the layer given by flow type and of all upper layers are
+ * random for every flow. Lower layers are the same for all flows, like
+ * for traffic going through a router. Tunnel flow types carry tcp4 flow
+ * inside, outer headers are the same for all flows, like for traffic
+ * between two tunnel endpoints. With reverse set, source and destination
+ * addresses and ports are swapped, except for outer tunnel ports.
+ */
+static unsigned int sim_build_flow(const struct sim_flow_opts *opts,
+				   uint32_t *state, uint8_t *buf)
+{
+	static const uint8_t dst_mac[] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+	static const uint8_t src_mac[] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x02 };
+	static const uint8_t ipv4_addrs[] = { 192, 168, 1, 1, 192, 168, 2, 1 };
+	bool tunnel = opts->type >= SIM_FLOW_VXLAN;
+	bool ipv4 = (opts->type >= SIM_FLOW_IPV4 &&
+		     opts->type <= SIM_FLOW_UDP4) || tunnel;
+	bool tcp = opts->type == SIM_FLOW_TCP4 || opts->type == SIM_FLOW_TCP6;
+	bool udp = opts->type == SIM_FLOW_UDP4 || opts->type == SIM_FLOW_UDP6 ||
+		   opts->type == SIM_FLOW_VXLAN ||
+		   opts->type == SIM_FLOW_GENEVE;
+	struct sim_flow_opts inner_opts = {
+		.type = SIM_FLOW_TCP4,
+		.reverse = opts->reverse,
+	};
+	unsigned int off = 0;
+	uint8_t *l3;
+
+	if (opts->type == SIM_FLOW_ETH) {
+		sim_random_fill(state, buf, 12);
+		buf[0] &= ~0x01; /* unicast */
+		buf[6] &= ~0x01;
+	} else {
+		memcpy(buf, dst_mac, sizeof(dst_mac));
+		memcpy(buf + 6, src_mac, sizeof(src_mac));
+	}
+	if (opts->reverse)
+		sim_swap(buf, buf + 6, 6);
+	off = 12;
+	if (opts->vlan) {
+		sim_put_u16(buf + off, 0x8100);
+		sim_put_u16(buf + off + 2, 100);
+		off += 4;
+	}
+	if (opts->type == SIM_FLOW_ETH) {
+		sim_put_u16(buf + off, 0x88b5); /* local experimental */
+		off += 2;
+		memset(buf + off, 0, 46);
+		return off + 46;
+	}
+
+	sim_put_u16(buf + off, ipv4 ? 0x0800 : 0x86dd);
+	off += 2;
+	l3 = buf + off;
+	if (ipv4) {
+		memset(l3, 0, 20);
+		l3[0] = 0x45;
+		sim_put_u16(l3 + 2, 20 + (tcp ? 20 : udp ? 8 : 0));
+		l3[8] = 64;
+		l3[9] = tcp ? 6 : udp ? 17 : tunnel ? 47 : 253;
+		if (opts->type == SIM_FLOW_IPV4)
+			sim_random_fill(state, l3 + 12, 8);
+		else
+			memcpy(l3 + 12, ipv4_addrs, sizeof(ipv4_addrs));
+		if (opts->reverse)
+			sim_swap(l3 + 12, l3 + 16, 4);
+		off += 20;
+	} else {
+		memset(l3, 0, 40);
+		l3[0] = 0x60;
+		sim_put_u16(l3 + 4, tcp ? 20 : udp ? 8 : 0);
+		l3[6] = tcp ? 6 : udp ? 17 : 59;
+		l3[7] = 64;
+		if (opts->type == SIM_FLOW_IPV6) {
+			sim_random_fill(state, l3 + 8, 32);
+		} else {
+			l3[8] = l3[24] = 0x20;
+			l3[9] = l3[25] = 0x01;
+			l3[23] = 1;
+			l3[39] = 2;
+		}
+		if (opts->reverse)
+			sim_swap(l3 + 8, l3 + 24, 16);
+		off += 40;
+	}
+	if (tcp || udp) {
+		sim_random_fill(state, buf + off, 4);
+		memset(buf + off + 4, 0, tcp ? 16 : 4);
+		if (opts->reverse)
+			sim_swap(buf + off, buf + off + 2, 2);
+		if (tcp)
+			buf[off + 12] = 0x50;
+		off += tcp ? 20 : 8;
+	}
+	if (!tunnel)
+		return off;
+
+	/* outer UDP ports are fixed as well */
+	if (udp)
+		sim_put_u16(buf + off - 8, 49152);
+	switch (opts->type) {
+	case SIM_FLOW_VXLAN:
+		sim_put_u16(buf + off - 6, 4789);
+		memset(buf + off, 0, 8);
+		buf[off] = 0x08; /* VNI present */
+		buf[off + 6] = 1;
+		off += 8;
+		break;
+	case SIM_FLOW_GENEVE:
+		/* one 4 octet long option */
+		sim_put_u16(buf + off - 6, 6081);
+		memset(buf + off, 0, 16);
+		buf[off] = 2;
+		sim_put_u16(buf + off + 2, 0x6558);
+		off += 16;
+		break;
+	default:
+		/* with key */
+		memset(buf + off, 0, 8);
+		buf[off] = 0x20;
+		sim_put_u16(buf + off + 2, 0x6558);
+		buf[off + 7] = 1;
+		off += 8;
+		break;
+	}
+	return off + sim_build_flow(&inner_opts, state, buf + off);
+}
+
+static int sim_run_flows(const struct sock_fprog *fprog,
+			 struct sim_stats *stats,
+			 const struct sim_flow_opts *opts)
+{
+	struct sim_flow_opts reverse_opts = *opts;
+	uint8_t buf[128];
+	struct sim_packet pkt;
+	uint32_t state = opts->seed ? opts->seed : 1;
+	uint32_t reverse_state;
+	unsigned int insn_count;
+	uint32_t ret, reverse_ret;
+	unsigned int i;
+	int err;
+
+	reverse_opts.reverse = !opts->reverse;
+	pkt.data = buf;
+	for (i = 0; i < opts->count; i++) {
+		reverse_state = state;
+		pkt.len = sim_build_flow(opts, &state, buf);
+		err = sim_process_packet(fprog, stats, &pkt);
+		if (err)
+			return err;
+		if (!opts->check_symmetric)
+			continue;
+
+		/* the same flow in the opposite direction must hash the same */
+		if (sim_bpf_run(fprog, &pkt, &ret, &insn_count))
+			ret = 0;
+		pkt.len = sim_build_flow(&reverse_opts, &reverse_state, buf);
+		if (sim_bpf_run(fprog, &pkt, &reverse_ret, &insn_count))
+			reverse_ret = 0;
+		if (ret != reverse_ret)
+			stats->asymmetric_count++;
+	}
+	return 0;
+}
+
+/*
+ * Reporting
+ */
+
+static double sim_jain_fairness(const unsigned long long *vals,
+				unsigned int count)
+{
+	double sum = 0;
+	double sum_sq = 0;
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		sum += vals[i];
+		sum_sq += (double) vals[i] * vals[i];
+	}
+	if (!sum_sq)
+		return 1;
+	return sum * sum / (count * sum_sq);
+}
+
+static void sim_print_program(const struct sock_fprog *fprog)
+{
+	unsigned int i;
+
+	for (i = 0; i < fprog->len; i++)
+		printf("(%03u) { 0x%02x, %u, %u, 0x%08x },\n", i,
+		       fprog->filter[i].code, fprog->filter[i].jt,
+		       fprog->filter[i].jf, fprog->filter[i].k);
+}
+
+static void sim_print_stats(const struct sock_fprog *fprog,
+			    const struct sim_stats *stats, bool verbose)
+{
+	unsigned long long min = ~0ULL;
+	unsigned long long max = 0;
+	unsigned int used = 0;
+	unsigned int i;
+
+	for (i = 0; i < SIM_BUCKET_COUNT; i++) {
+		if (stats->buckets[i])
+			used++;
+		if (stats->buckets[i] < min)
+			min = stats->buckets[i];
+		if (stats->buckets[i] > max)
+			max = stats->buckets[i];
+	}
+
+	printf("Program length: %u instructions\n", fprog->len);
+	printf("Packets: %llu (aborted: %llu)\n",
+	       stats->packet_count, stats->aborted_count);
+	if (!stats->packet_count)
+		return;
+	printf("Instructions per packet: %.2f average, %u max\n",
+	       (double) stats->insn_count / stats->packet_count,
+	       stats->insn_max);
+	printf("Hash buckets: %u/%u used, %llu min, %llu max, fairness %.4f\n",
+	       used, SIM_BUCKET_COUNT, min, max,
+	       sim_jain_fairness(stats->buckets, SIM_BUCKET_COUNT));
+	if (verbose) {
+		for (i = 0; i < SIM_BUCKET_COUNT; i++)
+			printf("  bucket %3u: %llu\n", i, stats->buckets[i]);
+	}
+	for (i = 0; i < stats->port_count; i++)
+		printf("Port %u: %llu (%.2f%%)\n", i, stats->ports[i],
+		       100.0 * stats->ports[i] / stats->packet_count);
+	printf("Port fairness: %.4f\n",
+	       sim_jain_fairness(stats->ports, stats->port_count));
+}
+
+static void print_help(const char *argv0) {
+	unsigned int i;
+
+	printf(
+            "%s [options] frag [frag...]\n"
+            "\t-h --help                Show this help\n"
+            "\t-r --pcap=FILE           Read packets from pcap file\n"
+            "\t-n --flows=COUNT         Generate COUNT synthetic flows (default 4096)\n"
+            "\t-t --flow-type=TYPE      Type of synthetic flows (default tcp4)\n"
+            "\t-V --vlan                Add VLAN header to synthetic flows\n"
+            "\t-s --seed=SEED           Seed for synthetic flows\n"
+            "\t-p --ports=COUNT         Number of team ports (default 2)\n"
+            "\t-m --func=FUNC           Hash function, xor or mix (default xor)\n"
+            "\t-S --check-symmetric     Check synthetic flows hash the same in both directions\n"
+            "\t-d --dump                Dump compiled program\n"
+            "\t-v --verbose             Show count for every hash bucket\n",
+            argv0);
+	printf("Frags are the same as for runner.tx_hash config option.\n");
+	printf("Flow types:");
+	for (i = 0; i < ARRAY_SIZE(sim_flow_type_names); i++)
+		printf(" %s", sim_flow_type_names[i]);
+	printf("\n");
+}
+
+static int parse_uint(const char *str, unsigned int *p_val)
+{
+	unsigned long tmp;
+	char *endptr;
+
+	errno = 0;
+	tmp = strtoul(str, &endptr, 10);
+	if (errno || *endptr || !*str || tmp > ~0U)
+		return -EINVAL;
+	*p_val = tmp;
+	return 0;
+}
+
+static int parse_flow_type(const char *str, enum sim_flow_type *p_type)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(sim_flow_type_names); i++) {
+		if (!strcmp(str, sim_flow_type_names[i])) {
+			*p_type = i;
+			return 0;
+		}
+	}
+	return -EINVAL;
+}
+
+int main(int argc, char **argv)
+{
+	char *argv0 = argv[0];
+	static const struct option long_options[] = {
+		{ "help",		no_argument,		NULL, 'h' },
+		{ "pcap",		required_argument,	NULL, 'r' },
+		{ "flows",		required_argument,	NULL, 'n' },
+		{ "flow-type",		required_argument,	NULL, 't' },
+		{ "vlan",		no_argument,		NULL, 'V' },
+		{ "seed",		required_argument,	NULL, 's' },
+		{ "ports",		required_argument,	NULL, 'p' },
+		{ "func",		required_argument,	NULL, 'm' },
+		{ "check-symmetric",	no_argument,		NULL, 'S' },
+		{ "dump",		no_argument,		NULL, 'd' },
+		{ "verbose",		no_argument,		NULL, 'v' },
+		{ NULL, 0, NULL, 0 }
+	};
+	struct sim_flow_opts flow_opts = {
+		.type = SIM_FLOW_TCP4,
+		.count = 4096,
+		.seed = 1,
+	};
+	const struct teamd_bpf_desc_frag *frag;
+	struct teamd_bpf_desc_ctx *dctx;
+	enum teamd_bpf_hash_func func = TEAMD_BPF_HASH_FUNC_XOR;
+	struct sim_stats stats;
+	struct sock_fprog fprog;
+	const char *pcap_filename = NULL;
+	bool dump = false;
+	bool verbose = false;
+	int res = EXIT_FAILURE;
+	int opt;
+	int err;
+
+	memset(&stats, 0, sizeof(stats));
+	stats.port_count = 2;
+
+	while ((opt = getopt_long(argc, argv, "hr:n:t:Vs:p:m:Sdv",
+				  long_options, NULL)) >= 0) {
+
+		switch(opt) {
+		case 'h':
+			print_help(argv0);
+			return EXIT_SUCCESS;
+		case 'r':
+			pcap_filename = optarg;
+			break;
+		case 'n':
+			if (parse_uint(optarg, &flow_opts.count)) {
+				fprintf(stderr, "Invalid flow count.\n");
+				return EXIT_FAILURE;
+			}
+			break;
+		case 't':
+			if (parse_flow_type(optarg, &flow_opts.type)) {
+				fprintf(stderr, "Unknown flow type \"%s\".\n",
+					optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'V':
+			flow_opts.vlan = true;
+			break;
+		case 's':
+			if (parse_uint(optarg, &flow_opts.seed)) {
+				fprintf(stderr, "Invalid seed.\n");
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'p':
+			if (parse_uint(optarg, &stats.port_count) ||
+			    !stats.port_count) {
+				fprintf(stderr, "Invalid port count.\n");
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'm':
+			if (!strcmp(optarg, "xor")) {
+				func = TEAMD_BPF_HASH_FUNC_XOR;
+			} else if (!strcmp(optarg, "mix")) {
+				func = TEAMD_BPF_HASH_FUNC_MIX;
+			} else {
+				fprintf(stderr, "Unknown hash function \"%s\".\n",
+					optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'S':
+			flow_opts.check_symmetric = true;
+			break;
+		case 'd':
+			dump = true;
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		case '?':
+			fprintf(stderr, "unknown option.\n");
+			print_help(argv0);
+			return EXIT_FAILURE;
+		default:
+			fprintf(stderr, "unknown option \"%c\".\n", opt);
+			print_help(argv0);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (optind >= argc) {
+		fprintf(stderr, "No hash frag specified.\n");
+		printf("\n");
+		print_help(argv0);
+		return EXIT_FAILURE;
+	}
+
+	stats.ports = calloc(stats.port_count, sizeof(*stats.ports));
+	if (!stats.ports)
+		return EXIT_FAILURE;
+
+	dctx = teamd_bpf_desc_ctx_alloc();
+	if (!dctx)
+		goto free_ports;
+	err = teamd_bpf_desc_set_func(dctx, func);
+	if (err)
+		goto free_ctx;
+	for (; optind < argc; optind++) {
+		frag = teamd_bpf_desc_find_frag(argv[optind]);
+		if (!frag) {
+			fprintf(stderr, "Hash frag named \"%s\" not found.\n",
+				argv[optind]);
+			goto free_ctx;
+		}
+		err = teamd_bpf_desc_add_frag(dctx, frag);
+		if (err)
+			goto free_ctx;
+	}
+	err = teamd_bpf_desc_compile(dctx, &fprog);
+	teamd_bpf_desc_ctx_free(dctx);
+	if (err) {
+		fprintf(stderr, "Failed to compile hash function: %s\n",
+			strerror(-err));
+		goto free_ports;
+	}
+
+	if (dump)
+		sim_print_program(&fprog);
+
+	if (pcap_filename)
+		err = sim_run_pcap(&fprog, &stats, pcap_filename);
+	else
+		err = sim_run_flows(&fprog, &stats, &flow_opts);
+	if (err)
+		goto release;
+
+	sim_print_stats(&fprog, &stats, verbose);
+	if (flow_opts.check_symmetric && !pcap_filename) {
+		printf("Asymmetric flows: %llu\n", stats.asymmetric_count);
+		if (stats.asymmetric_count)
+			goto release;
+	}
+	res = EXIT_SUCCESS;
+
+release:
+	teamd_bpf_desc_compile_release(&fprog);
+	teamd_bpf_desc_cache_flush();
+free_ports:
+	free(stats.ports);
+	return res;
+
+free_ctx:
+	teamd_bpf_desc_ctx_free(dctx);
+	goto free_ports;
+}
@@ -0,0 +1,23 @@
+#!/bin/sh
+#
+# Checks that "symmetric" tx_hash modifier gives both directions of every
+# synthetic flow the same hash, for all flow types, with and without VLAN
+# and with both hash functions. Run by "make check" from build directory.
+#
+
+SIM=./teamd_bpf_sim
+FRAGS="eth vlan ipv4 ipv6 l4 vxlan_inner geneve_inner gre_inner symmetric"
+FLOW_TYPES="eth ipv4 tcp4 udp4 ipv6 tcp6 udp6 vxlan geneve gre"
+
+rc=0
+for func in xor mix; do
+	for type in $FLOW_TYPES; do
+		for vlan in "" "-V"; do
+			if ! $SIM -S -m $func -t $type $vlan $FRAGS > /dev/null; then
+				echo "Asymmetric hash: func $func, flow type $type $vlan" >&2
+				rc=1
+			fi
+		done
+	done
+done
+exit $rc
@@ -24,6 +24,7 @@
 #include <sys/types.h>
 #include <pwd.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <linux/if_packet.h>
 #include <linux/filter.h>
 #include <private/misc.h>
@@ -81,14 +82,227 @@ static int attach_filter(int sock, const struct sock_fprog *pref_fprog,
 	return 0;
 }
 
-int teamd_packet_sock_open_type(int type, int *sock_p, const uint32_t ifindex,
+/*
+ * Blocks are handed to userspace once full or when the retire timeout
+ * expires, so a frame may wait up to that long before the socket becomes
+ * readable.
+ */
+#define TEAMD_PACKET_RING_BLOCK_SIZE	16384
+#define TEAMD_PACKET_RING_BLOCK_COUNT	4
+#define TEAMD_PACKET_RING_FRAME_SIZE	2048
+#define TEAMD_PACKET_RING_RETIRE_TOV	1 /* ms */
+
+/*
+ * Has to be called before the socket is bound to a protocol, otherwise
+ * frames already queued on the socket would keep it readable forever.
+ * In case the ring cannot be set up, socket is left in copy mode.
+ */
+void teamd_packet_ring_setup(int sock, struct teamd_packet_ring *ring)
+{
+	struct tpacket_req3 req;
+	int version = TPACKET_V3;
+	long page_size;
+	void *map;
+	int ret;
+
+	memset(ring, 0, sizeof(*ring));
+	ret = setsockopt(sock, SOL_PACKET, PACKET_VERSION,
+			 &version, sizeof(version));
+	if (ret == -1) {
+		teamd_log_warn("Kernel does not support TPACKET_V3, falling back to copying receive.");
+		return;
+	}
+
+	page_size = sysconf(_SC_PAGESIZE);
+	if (page_size <= 0)
+		page_size = 4096;
+	ring->block_size = (TEAMD_PACKET_RING_BLOCK_SIZE + page_size - 1) /
+			   page_size * page_size;
+	ring->block_count = TEAMD_PACKET_RING_BLOCK_COUNT;
+	memset(&req, 0, sizeof(req));
+	req.tp_block_size = ring->block_size;
+	req.tp_block_nr = ring->block_count;
+	req.tp_frame_size = TEAMD_PACKET_RING_FRAME_SIZE;
+	req.tp_frame_nr = ring->block_size / req.tp_frame_size *
+			  ring->block_count;
+	req.tp_retire_blk_tov = TEAMD_PACKET_RING_RETIRE_TOV;
+	ret = setsockopt(sock, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req));
+	if (ret == -1) {
+		teamd_log_warn("Failed to set up receive ring, falling back to copying receive.");
+		return;
+	}
+
+	ring->map_len = ring->block_size * ring->block_count;
+	map = mmap(NULL, ring->map_len, PROT_READ | PROT_WRITE, MAP_SHARED,
+		   sock, 0);
+	if (map == MAP_FAILED) {
+		teamd_log_warn("Failed to map receive ring, falling back to copying receive.");
+		/* Zeroed request releases the ring so recvmsg works again. */
+		memset(&req, 0, sizeof(req));
+		setsockopt(sock, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req));
+		ring->map_len = 0;
+		return;
+	}
+	ring->map = map;
+}
+
+void teamd_packet_ring_teardown(struct teamd_packet_ring *ring)
+{
+	if (ring->map)
+		munmap(ring->map, ring->map_len);
+	ring->map = NULL;
+}
+
+static int teamd_packet_ring_drain(struct teamd_packet_ring *ring,
+				   teamd_packet_process_func_t func,
+				   void *priv)
+{
+	struct tpacket_block_desc *bd;
+	struct tpacket3_hdr *hdr;
+	struct teamd_packet packet;
+	unsigned int blocks;
+	unsigned int i;
+	int err = 0;
+
+	/* At most one lap so a busy ring does not starve the loop. */
+	for (blocks = ring->block_count; blocks && !err; blocks--) {
+		bd = (struct tpacket_block_desc *)
+		     ((char *) ring->map + ring->block_idx * ring->block_size);
+		if (!(bd->hdr.bh1.block_status & TP_STATUS_USER))
+			break;
+		__sync_synchronize();
+
+		hdr = (struct tpacket3_hdr *)
+		      ((char *) bd + bd->hdr.bh1.offset_to_first_pkt);
+		for (i = 0; i < bd->hdr.bh1.num_pkts; i++) {
+			packet.data = (char *) hdr + hdr->tp_mac;
+			packet.len = hdr->tp_snaplen;
+			packet.ll_from = (struct sockaddr_ll *)
+					 ((char *) hdr +
+					  TPACKET_ALIGN(sizeof(*hdr)));
+			packet.vlan_valid = hdr->tp_status &
+					    TP_STATUS_VLAN_VALID;
+			packet.vlan_tci = hdr->hv1.tp_vlan_tci;
+			err = func(&packet, priv);
+			if (err)
+				break;
+			hdr = (struct tpacket3_hdr *)
+			      ((char *) hdr + hdr->tp_next_offset);
+		}
+
+		/* Give the block back even if processing failed. */
+		__sync_synchronize();
+		bd->hdr.bh1.block_status = TP_STATUS_KERNEL;
+		ring->block_idx = (ring->block_idx + 1) % ring->block_count;
+	}
+	return err;
+}
+
+static int teamd_packet_copy_recv(int sock, void *buf, size_t len,
+				  unsigned int budget,
+				  teamd_packet_process_func_t func, void *priv)
+{
+	struct sockaddr_ll ll_from;
+	struct teamd_packet packet;
+	struct iovec iov;
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	union {
+		struct cmsghdr cmsg;
+		char buf[CMSG_SPACE(sizeof(struct tpacket_auxdata))];
+	} cmsg_buf;
+	struct tpacket_auxdata *aux;
+	ssize_t ret;
+	int err;
+
+	while (budget) {
+		iov.iov_base = buf;
+		iov.iov_len = len;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_name = &ll_from;
+		msg.msg_namelen = sizeof(ll_from);
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = &cmsg_buf;
+		msg.msg_controllen = sizeof(cmsg_buf);
+		ret = recvmsg(sock, &msg, MSG_DONTWAIT);
+		if (ret == -1) {
+			switch(errno) {
+			case EINTR:
+				continue;
+			case EAGAIN:
+			case ENETDOWN:
+				return 0;
+			default:
+				teamd_log_err("recvmsg failed.");
+				return -errno;
+			}
+		}
+		budget--;
+
+		packet.data = buf;
+		packet.len = ret;
+		packet.ll_from = &ll_from;
+		packet.vlan_valid = false;
+		packet.vlan_tci = 0;
+		/* Present only if PACKET_AUXDATA is enabled on the socket. */
+		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+		     cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if (cmsg->cmsg_level != SOL_PACKET ||
+			    cmsg->cmsg_type != PACKET_AUXDATA)
+				continue;
+			aux = (struct tpacket_auxdata *) CMSG_DATA(cmsg);
+			packet.vlan_valid = aux->tp_status &
+					    TP_STATUS_VLAN_VALID;
+			packet.vlan_tci = aux->tp_vlan_tci;
+		}
+		err = func(&packet, priv);
+		if (err)
+			return err;
+	}
+	return 0;
+}
+
+/*
+ * Calls func for each received frame. With ring set up, all the blocks
+ * handed to userspace are processed without any syscall. Otherwise up to
+ * budget frames are copied to buf one by one.
+ */
+int teamd_packet_recv(int sock, struct teamd_packet_ring *ring,
+		      void *buf, size_t len, unsigned int budget,
+		      teamd_packet_process_func_t func, void *priv)
+{
+	if (ring && ring->map)
+		return teamd_packet_ring_drain(ring, func, priv);
+	return teamd_packet_copy_recv(sock, buf, len, budget, func, priv);
+}
+
+int teamd_packet_sock_bind(int sock, const uint32_t ifindex,
+			   const unsigned short family)
+{
+	struct sockaddr_ll ll_my;
+	int ret;
+
+	memset(&ll_my, 0, sizeof(ll_my));
+	ll_my.sll_family = AF_PACKET;
+	ll_my.sll_ifindex = ifindex;
+	ll_my.sll_protocol = family;
+	ret = bind(sock, (struct sockaddr *) &ll_my, sizeof(ll_my));
+	if (ret == -1) {
+		teamd_log_err("Failed to bind socket.");
+		return -errno;
+	}
+	return 0;
+}
+
+int teamd_packet_sock_open_ring(int type, int *sock_p,
+				struct teamd_packet_ring *ring,
+				const uint32_t ifindex,
 				const unsigned short family,
 				const struct sock_fprog *fprog,
 				const struct sock_fprog *alt_fprog)
 {
-	struct sockaddr_ll ll_my;
 	int sock;
-	int ret;
 	int err;
 
 	sock = socket(PF_PACKET, type, 0);
@@ -103,24 +317,32 @@ int teamd_packet_sock_open_type(int type, int *sock_p, const uint32_t ifindex,
 		goto close_sock;
 	}
 
-	memset(&ll_my, 0, sizeof(ll_my));
-	ll_my.sll_family = AF_PACKET;
-	ll_my.sll_ifindex = ifindex;
-	ll_my.sll_protocol = family;
-	ret = bind(sock, (struct sockaddr *) &ll_my, sizeof(ll_my));
-	if (ret == -1) {
-		teamd_log_err("Failed to bind socket.");
-		err = -errno;
-		goto close_sock;
-	}
+	if (ring)
+		teamd_packet_ring_setup(sock, ring);
+
+	err = teamd_packet_sock_bind(sock, ifindex, family);
+	if (err)
+		goto teardown_ring;
 
 	*sock_p = sock;
 	return 0;
+teardown_ring:
+	if (ring)
+		teamd_packet_ring_teardown(ring);
 close_sock:
 	close(sock);
 	return err;
 }
 
+int teamd_packet_sock_open_type(int type, int *sock_p, const uint32_t ifindex,
+				const unsigned short family,
+				const struct sock_fprog *fprog,
+				const struct sock_fprog *alt_fprog)
+{
+	return teamd_packet_sock_open_ring(type, sock_p, NULL, ifindex, family,
+					   fprog, alt_fprog);
+}
+
 int teamd_packet_sock_open(int *sock_p, const uint32_t ifindex,
 			   const unsigned short family,
 			   const struct sock_fprog *fprog,
@@ -17,8 +17,9 @@
  *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
  */
 
-#include <string.h>
 #include <linux/filter.h>
+#include <string.h>
+#include <errno.h>
 #include <private/misc.h>
 #include <team.h>
 
@@ -26,86 +27,39 @@
 #include "teamd_config.h"
 #include "teamd_bpf_chef.h"
 
-static const struct teamd_bpf_desc_frag eth_hdr_frag = {
-	.name = "eth",
-	.hproto = PROTO_ETH,
-};
-
-static const struct teamd_bpf_desc_frag vlan_hdr_frag = {
-	.name = "vlan",
-	.hproto = PROTO_VLAN,
-};
-
-static const struct teamd_bpf_desc_frag ipv4_hdr_frag = {
-	.name = "ipv4",
-	.hproto = PROTO_IPV4,
-};
-
-static const struct teamd_bpf_desc_frag ipv6_hdr_frag = {
-	.name = "ipv6",
-	.hproto = PROTO_IPV6,
-};
-
-static const struct teamd_bpf_desc_frag ip_hdr_frag = {
-	.name = "ip",
-	.hproto = PROTO_IP,
-};
-
-static const struct teamd_bpf_desc_frag l3_hdr_frag = {
-	.name = "l3",
-	.hproto = PROTO_L3,
-};
-
-static const struct teamd_bpf_desc_frag l4_hdr_frag = {
-	.name = "l4",
-	.hproto = PROTO_L4,
-};
-
-static const struct teamd_bpf_desc_frag tcp_hdr_frag = {
-	.name = "tcp",
-	.hproto = PROTO_TCP,
-};
-static const struct teamd_bpf_desc_frag udp_hdr_frag = {
-	.name = "udp",
-	.hproto = PROTO_UDP,
-};
-static const struct teamd_bpf_desc_frag sctp_hdr_frag = {
-	.name = "sctp",
-	.hproto = PROTO_SCTP,
-};
-
-static const struct teamd_bpf_desc_frag *frags[] = {
-	&eth_hdr_frag,
-	&vlan_hdr_frag,
-	&ipv4_hdr_frag,
-	&ipv6_hdr_frag,
-	&ip_hdr_frag,
-	&l3_hdr_frag,
-	&l4_hdr_frag,
-	&tcp_hdr_frag,
-	&udp_hdr_frag,
-	&sctp_hdr_frag,
-};
-
-static const size_t frags_count = ARRAY_SIZE(frags);
-
-static const struct teamd_bpf_desc_frag *__find_frag(const char *frag_name)
+static int teamd_hash_func_get_func(struct teamd_context *ctx,
+				    enum teamd_bpf_hash_func *func)
 {
-	int i;
+	const char *func_name;
+	int err;
 
-	for (i = 0; i < frags_count; i++) {
-		if (!strcmp(frag_name, frags[i]->name))
-			return frags[i];
+	err = teamd_config_string_get(ctx, &func_name, "$.runner.tx_hash_func");
+	if (err || !strcmp(func_name, "xor")) {
+		*func = TEAMD_BPF_HASH_FUNC_XOR;
+	} else if (!strcmp(func_name, "mix")) {
+		*func = TEAMD_BPF_HASH_FUNC_MIX;
+	} else {
+		teamd_log_err("Unknown \"runner.tx_hash_func\" named \"%s\" passed.",
+			      func_name);
+		return -EINVAL;
 	}
-	return NULL;
+	return 0;
 }
 
-static int teamd_hash_func_init(struct teamd_context *ctx, struct sock_fprog *fprog)
+static int teamd_hash_func_init(struct teamd_context *ctx,
+				struct sock_fprog *fprog,
+				enum teamd_bpf_hash_func func)
 {
+	struct teamd_bpf_desc_ctx *dctx;
 	int i;
 	int err;
 
-	teamd_bpf_desc_compile_start(fprog);
+	dctx = teamd_bpf_desc_ctx_alloc();
+	if (!dctx)
+		return -ENOMEM;
+	err = teamd_bpf_desc_set_func(dctx, func);
+	if (err)
+		goto free_ctx;
 	teamd_config_for_each_arr_index(i, ctx, "$.runner.tx_hash") {
 		const struct teamd_bpf_desc_frag *frag;
 		const char *frag_name;
@@ -115,28 +69,21 @@ static int teamd_hash_func_init(struct teamd_context *ctx, struct sock_fprog *fp
 		if (err)
 			continue;
 
-		frag = __find_frag(frag_name);
+		frag = teamd_bpf_desc_find_frag(frag_name);
 		if (!frag) {
 			teamd_log_warn("Hash frag named \"%s\" not found.",
 				       frag_name);
 			continue;
 		}
-		err = teamd_bpf_desc_add_frag(fprog, frag);
+		err = teamd_bpf_desc_add_frag(dctx, frag);
 		if (err)
-			goto release;
+			goto free_ctx;
 	}
 
-	err = teamd_bpf_desc_compile(fprog);
-	if (err)
-		goto release;
+	err = teamd_bpf_desc_compile(dctx, fprog);
 
-	err = teamd_bpf_desc_compile_finish(fprog);
-	if (err)
-		goto release;
-	return 0;
-
-release:
-	teamd_bpf_desc_compile_release(fprog);
+free_ctx:
+	teamd_bpf_desc_ctx_free(dctx);
 	return err;
 }
 
@@ -166,6 +113,7 @@ static int teamd_hash_func_add_default_frags(struct teamd_context *ctx)
 
 int teamd_hash_func_set(struct teamd_context *ctx)
 {
+	enum teamd_bpf_hash_func func;
 	struct sock_fprog fprog;
 	int err;
 
@@ -175,14 +123,38 @@ int teamd_hash_func_set(struct teamd_context *ctx)
 		if (err)
 			return err;
 	}
-	err = teamd_hash_func_init(ctx, &fprog);
+	err = teamd_hash_func_get_func(ctx, &func);
+	if (err)
+		return err;
+	err = teamd_hash_func_init(ctx, &fprog, func);
 	if (err) {
 		teamd_log_err("Failed to init hash function.");
 		return err;
 	}
 	err = team_set_bpf_hash_func(ctx->th, &fprog);
+	teamd_hash_func_fini(&fprog);
+	if (err && func != TEAMD_BPF_HASH_FUNC_XOR) {
+		/* Older kernels may refuse ALU ops used by mix function
+		 * or longer program, so fall back to plain xor one.
+		 */
+		teamd_log_warn("Failed to set \"mix\" hash function, falling back to \"xor\".");
+		err = teamd_hash_func_init(ctx, &fprog, TEAMD_BPF_HASH_FUNC_XOR);
+		if (err) {
+			teamd_log_err("Failed to init hash function.");
+			return err;
+		}
+		err = team_set_bpf_hash_func(ctx->th, &fprog);
+		teamd_hash_func_fini(&fprog);
+	}
 	if (err)
 		teamd_log_err("Failed to set hash function.");
-	teamd_hash_func_fini(&fprog);
 	return err;
 }
+
+/* Kernel keeps the program until the team device is gone, so only drop
+ * the compiled programs cached by teamd_hash_func_set().
+ */
+void teamd_hash_func_unset(struct teamd_context *ctx)
+{
+	teamd_bpf_desc_cache_flush();
+}
@@ -37,6 +37,7 @@
 extern const struct teamd_link_watch teamd_link_watch_ethtool;
 extern const struct teamd_link_watch teamd_link_watch_arp_ping;
 extern const struct teamd_link_watch teamd_link_watch_nsnap;
+extern const struct teamd_link_watch teamd_link_watch_bfd;
 extern const struct teamd_link_watch teamd_link_watch_tipc;
 
 int __set_sockaddr(struct sockaddr *sa, socklen_t sa_len, sa_family_t family,
@@ -103,6 +104,7 @@ static const struct teamd_link_watch *teamd_link_watch_list[] = {
 	&teamd_link_watch_ethtool,
 	&teamd_link_watch_arp_ping,
 	&teamd_link_watch_nsnap,
+	&teamd_link_watch_bfd,
 	&teamd_link_watch_tipc,
 };
 
@@ -113,6 +115,16 @@ static const struct teamd_link_watch *teamd_link_watch_list[] = {
  */
 #define LW_PORT_PRIV_CREATOR_PRIV (&teamd_link_watch_list)
 
+/* Link watch privs of the port in order, NULL starts from the first one */
+struct lw_common_port_priv *
+teamd_link_watch_ppriv_next(struct teamd_port *tdport,
+			    struct lw_common_port_priv *common_ppriv)
+{
+	return teamd_get_next_port_priv_by_creator(tdport,
+						   LW_PORT_PRIV_CREATOR_PRIV,
+						   common_ppriv);
+}
+
 static const struct teamd_link_watch *teamd_find_link_watch(const char *link_watch_name)
 {
 	int i;
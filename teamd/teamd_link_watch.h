@@ -30,16 +30,22 @@ struct lw_psr_ops {
 			    struct lw_psr_port_priv *psr_ppriv);
 	int (*send)(struct lw_psr_port_priv *psr_ppriv);
 	int (*receive)(struct lw_psr_port_priv *psr_ppriv);
+	/* optional, sets reply_received at the end of each interval */
+	void (*period_check)(struct lw_psr_port_priv *psr_ppriv);
 };
 
 struct lw_psr_port_priv {
 	struct lw_common_port_priv common; /* must be first */
 	const struct lw_psr_ops *ops;
 	struct timespec interval;
+	struct timespec interval_max; /* zero unless adaptive */
+	struct timespec cur_interval;
 	struct timespec init_wait;
 	unsigned int missed_max;
 	int sock;
+	struct teamd_packet_ring ring;
 	unsigned int missed;
+	unsigned int replied;
 	bool reply_received;
 };
 
@@ -59,6 +65,10 @@ int teamd_link_watch_check_link_up(struct teamd_context *ctx,
 				   struct lw_common_port_priv *common_ppriv,
 				   bool new_link_up);
 
+struct lw_common_port_priv *
+teamd_link_watch_ppriv_next(struct teamd_port *tdport,
+			    struct lw_common_port_priv *common_ppriv);
+
 struct lw_psr_port_priv *
 lw_psr_ppriv_get(struct lw_common_port_priv *common_ppriv);
 int lw_psr_port_added(struct teamd_context *ctx, struct teamd_port *tdport,
@@ -77,5 +87,11 @@ int lw_psr_state_missed_max_get(struct teamd_context *ctx,
 int lw_psr_state_missed_get(struct teamd_context *ctx,
 			    struct team_state_gsc *gsc,
 			    void *priv);
+int lw_psr_state_interval_max_get(struct teamd_context *ctx,
+				  struct team_state_gsc *gsc,
+				  void *priv);
+int lw_psr_state_effective_interval_get(struct teamd_context *ctx,
+					struct team_state_gsc *gsc,
+					void *priv);
 
 #endif
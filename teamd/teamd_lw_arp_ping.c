@@ -22,40 +22,155 @@
 #include <net/if_arp.h>
 #include <linux/if_ether.h>
 #include <netdb.h>
+#include <sys/ioctl.h>
+#include <net/if.h>
+#include <linux/if_packet.h>
 #include <private/misc.h>
+#include <private/hash.h>
+#include <private/list.h>
 #include "teamd.h"
 #include "teamd_link_watch.h"
 #include "teamd_config.h"
+#include "teamd_workq.h"
 
 /*
  * ARP ping link watch
  */
 
+struct arp_packet {
+	struct arphdr			ah;
+	unsigned char			sender_mac[ETH_ALEN];
+	struct in_addr			sender_ip;
+	unsigned char			target_mac[ETH_ALEN];
+	struct in_addr			target_ip;
+} __attribute__((packed));
+
+struct __vlan_hdr {
+	__be16 h_vlan_TCI;
+	__be16 h_vlan_encapsulated_proto;
+};
+
+struct arp_vlan_packet {
+	struct __vlan_hdr		vlanh;
+	struct arp_packet		ap;
+} __attribute__((packed));
+
+struct lw_ap_port_priv;
+
+struct lw_ap_target {
+	struct lw_ap_port_priv *ap_ppriv;
+	struct in_addr dst;
+	struct hash_node pair_node; /* in engine pair_table */
+	bool reply_received;
+	unsigned int missed;
+	union {
+		struct arp_packet ap;
+		struct arp_vlan_packet avp;
+	} tx_pkt;
+};
+
 struct lw_ap_port_priv {
 	union {
 		struct lw_common_port_priv common;
 		struct lw_psr_port_priv psr;
 	} start; /* must be first */
 	struct in_addr src;
-	struct in_addr dst;
+	struct lw_ap_target *targets;
+	unsigned int target_count;
+	unsigned int quorum;
 	bool validate_active;
 	bool validate_inactive;
 	bool send_always;
 	bool vlanid_in_use;
 	unsigned short vlanid;
+	struct hash_node port_node; /* in engine port_table, if lenient */
+	struct lw_ap_port_sock *port_sock;
+	struct list_item tx_list;
+	unsigned short hatype;
+	struct sockaddr_ll tx_addr;
 };
 
+#define for_each_ap_target(target, ap_ppriv)				\
+	for (target = (ap_ppriv)->targets;				\
+	     target < (ap_ppriv)->targets + (ap_ppriv)->target_count;	\
+	     target++)
+
 static struct lw_ap_port_priv *
 lw_ap_ppriv_get(struct lw_psr_port_priv *psr_ppriv)
 {
 	return (struct lw_ap_port_priv *) psr_ppriv;
 }
 
+static int set_in_addr(struct in_addr *addr, const char *hostname)
+{
+	struct sockaddr_in sin;
+	int err;
+
+	err = __set_sockaddr((struct sockaddr *) &sin, sizeof(sin),
+			     AF_INET, hostname);
+	if (err)
+		return err;
+	memcpy(addr, &sin.sin_addr, sizeof(*addr));
+	return 0;
+}
+
+static char *str_in_addr(struct in_addr *addr)
+{
+	struct sockaddr_in sin;
+	static char buf[NI_MAXHOST];
+
+	memcpy(&sin.sin_addr, addr, sizeof(*addr));
+	return __str_sockaddr((struct sockaddr *) &sin, sizeof(sin), AF_INET,
+			      buf, sizeof(buf));
+}
+
+/*
+ * Shared ARP ping engine
+ *
+ * All arp_ping instances on one port share one receive socket bound to
+ * that port. Replies are dispatched to targets by (ifindex, vlan, sender
+ * and target address) and probes of all instances which are due are sent
+ * in one batch through single transmit only socket.
+ */
+
+#define LW_AP_TX_BATCH 32
+#define LW_AP_RX_BUDGET 64
+
+struct lw_ap_engine;
+
+struct lw_ap_port_sock {
+	struct hash_node node; /* in engine sock_table */
+	struct lw_ap_engine *engine;
+	uint32_t ifindex;
+	unsigned int refcount;
+	int sock;
+	struct teamd_packet_ring ring;
+};
+
+struct lw_ap_engine {
+	unsigned int refcount;
+	int tx_sock; /* not bound, receives nothing */
+	struct hash_table sock_table; /* receive sockets by ifindex */
+	struct hash_table pair_table; /* targets by addresses */
+	struct hash_table port_table; /* instances accepting any ARP */
+	struct list_item tx_list; /* instances having probe due */
+	struct teamd_workq tx_workq;
+	struct mmsghdr tx_msgs[LW_AP_TX_BATCH];
+	struct iovec tx_iovs[LW_AP_TX_BATCH];
+};
+
 #define OFFSET_ARP_OP_CODE					\
 	in_struct_offset(struct arphdr, ar_op)
 
+/*
+ * Sockets are bound to ports with ETH_P_ALL because ARPs coming to
+ * inactive ports are passed only to taps. VLAN id is taken from
+ * PACKET_AUXDATA, or from the frame header when receive ring is used.
+ */
 static struct sock_filter arp_rpl_flt[] = {
-	BPF_STMT(BPF_LD + BPF_B + BPF_ABS, SKF_AD_OFF + SKF_AD_PROTOCOL),
+	BPF_STMT(BPF_LD + BPF_W + BPF_ABS, SKF_AD_OFF + SKF_AD_PKTTYPE),
+	BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, PACKET_OUTGOING, 6, 0),
+	BPF_STMT(BPF_LD + BPF_H + BPF_ABS, SKF_AD_OFF + SKF_AD_PROTOCOL),
 	BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, ETH_P_ARP, 0, 4),
 	BPF_STMT(BPF_LD + BPF_H + BPF_ABS, OFFSET_ARP_OP_CODE),
 	BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, ARPOP_REPLY, 1, 0),
@@ -69,93 +184,523 @@ static const struct sock_fprog arp_rpl_fprog = {
 	.filter = arp_rpl_flt,
 };
 
-static struct sock_filter arp_novlan_rpl_flt[] = {
-	BPF_STMT(BPF_LD + BPF_B + BPF_ABS, SKF_AD_OFF + SKF_AD_PROTOCOL),
-	BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, ETH_P_ARP, 0, 6),
-	BPF_STMT(BPF_LD + BPF_B + BPF_ABS, SKF_AD_OFF + SKF_AD_VLAN_TAG_PRESENT),
-	BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, 0, 2, 0),
-	BPF_STMT(BPF_LD + BPF_B + BPF_ABS, SKF_AD_OFF + SKF_AD_VLAN_TAG),
-	BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, 0, 0, 4),
-	BPF_STMT(BPF_LD + BPF_H + BPF_ABS, OFFSET_ARP_OP_CODE),
-	BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, ARPOP_REPLY, 1, 0),
-	BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, ARPOP_REQUEST, 0, 1),
-	BPF_STMT(BPF_RET + BPF_K, (u_int) -1),
-	BPF_STMT(BPF_RET + BPF_K, 0),
-};
-
-static const struct sock_fprog arp_novlan_rpl_fprog = {
-	.len = ARRAY_SIZE(arp_novlan_rpl_flt),
-	.filter = arp_novlan_rpl_flt,
-};
+static unsigned short lw_ap_vlanid(struct lw_ap_port_priv *ap_ppriv)
+{
+	return ap_ppriv->vlanid_in_use ? ap_ppriv->vlanid : 0;
+}
 
-static struct sock_filter arp_vlan_rpl_flt[] = {
-	BPF_STMT(BPF_LD + BPF_B + BPF_ABS, SKF_AD_OFF + SKF_AD_PROTOCOL),
-	BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, ETH_P_ARP, 0, 8),
-	BPF_STMT(BPF_LD + BPF_B + BPF_ABS, SKF_AD_OFF + SKF_AD_VLAN_TAG_PRESENT),
-	BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, 0, 6, 0),
-	BPF_STMT(BPF_LD + BPF_B + BPF_ABS, SKF_AD_OFF + SKF_AD_VLAN_TAG),
-	BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, 0xffff, 0, 4), /* 0xffff will be replaced by vland id */
-	BPF_STMT(BPF_LD + BPF_H + BPF_ABS, OFFSET_ARP_OP_CODE),
-	BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, ARPOP_REPLY, 1, 0),
-	BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, ARPOP_REQUEST, 0, 1),
-	BPF_STMT(BPF_RET + BPF_K, (u_int) -1),
-	BPF_STMT(BPF_RET + BPF_K, 0),
-};
+static uint32_t lw_ap_port_hash(uint32_t ifindex, unsigned short vlanid)
+{
+	return hash_combine(hash_mix32(ifindex), vlanid);
+}
 
-/* this hack replaces vlanid value in filter code */
-#define SET_FILTER_VLANID(fprog, vlanid) (fprog)->filter[5].k = vlanid
+/* Validation accepts both directions, so the pair is kept ordered. */
+static uint32_t lw_ap_pair_hash(uint32_t ifindex, unsigned short vlanid,
+				struct in_addr a, struct in_addr b)
+{
+	uint32_t lo = a.s_addr < b.s_addr ? a.s_addr : b.s_addr;
+	uint32_t hi = a.s_addr < b.s_addr ? b.s_addr : a.s_addr;
 
-static const struct sock_fprog arp_vlan_rpl_fprog = {
-	.len = ARRAY_SIZE(arp_vlan_rpl_flt),
-	.filter = arp_vlan_rpl_flt,
-};
+	return hash_combine(hash_combine(lw_ap_port_hash(ifindex, vlanid),
+					 lo), hi);
+}
 
-static int set_in_addr(struct in_addr *addr, const char *hostname)
+static int lw_ap_validate(struct lw_ap_port_priv *ap_ppriv, bool *validate)
 {
-	struct sockaddr_in sin;
+	struct lw_common_port_priv *common_ppriv = &ap_ppriv->start.common;
+	bool port_enabled;
 	int err;
 
-	err = __set_sockaddr((struct sockaddr *) &sin, sizeof(sin),
-			     AF_INET, hostname);
+	err = teamd_port_enabled(common_ppriv->ctx, common_ppriv->tdport,
+				 &port_enabled);
 	if (err)
 		return err;
-	memcpy(addr, &sin.sin_addr, sizeof(*addr));
+	*validate = (port_enabled && ap_ppriv->validate_active) ||
+		    (!port_enabled && ap_ppriv->validate_inactive);
 	return 0;
 }
 
-static char *str_in_addr(struct in_addr *addr)
+static bool lw_ap_pair_match(struct lw_ap_target *target,
+			     struct sockaddr_ll *ll_from,
+			     struct arp_packet *ap)
 {
-	struct sockaddr_in sin;
-	static char buf[NI_MAXHOST];
+	struct lw_ap_port_priv *ap_ppriv = target->ap_ppriv;
+	struct lw_common_port_priv *common_ppriv = &ap_ppriv->start.common;
 
-	memcpy(&sin.sin_addr, addr, sizeof(*addr));
-	return __str_sockaddr((struct sockaddr *) &sin, sizeof(sin), AF_INET,
-			      buf, sizeof(buf));
+	if (common_ppriv->tdport->ifindex != ll_from->sll_ifindex)
+		return false;
+	if (ap->ah.ar_hrd != htons(ll_from->sll_hatype) ||
+	    ap->ah.ar_pro != htons(ETH_P_IP) ||
+	    ap->ah.ar_hln != ll_from->sll_halen ||
+	    ap->ah.ar_pln != 4)
+		return false;
+	if ((ap_ppriv->src.s_addr != ap->target_ip.s_addr ||
+	     target->dst.s_addr != ap->sender_ip.s_addr) &&
+	    (target->dst.s_addr != ap->target_ip.s_addr ||
+	     ap_ppriv->src.s_addr != ap->sender_ip.s_addr))
+		return false;
+	return true;
+}
+
+static int lw_ap_engine_process(struct lw_ap_engine *engine,
+				struct sockaddr_ll *ll_from,
+				unsigned short vlanid,
+				struct arp_packet *ap)
+{
+	struct lw_ap_port_priv *ap_ppriv;
+	struct lw_ap_target *target;
+	struct hash_node *hnode;
+	uint32_t ifindex = ll_from->sll_ifindex;
+	uint32_t hash;
+	bool validate;
+	int err;
+
+	/* Replies matching the addresses pass validation as well. */
+	hash = lw_ap_pair_hash(ifindex, vlanid, ap->sender_ip, ap->target_ip);
+	hash_table_for_each_possible(target, hnode, &engine->pair_table,
+				     hash, pair_node) {
+		if (lw_ap_vlanid(target->ap_ppriv) != vlanid ||
+		    !lw_ap_pair_match(target, ll_from, ap))
+			continue;
+		target->reply_received = true;
+	}
+
+	hash = lw_ap_port_hash(ifindex, vlanid);
+	hash_table_for_each_possible(ap_ppriv, hnode, &engine->port_table,
+				     hash, port_node) {
+		if (ap_ppriv->start.common.tdport->ifindex != ifindex ||
+		    lw_ap_vlanid(ap_ppriv) != vlanid)
+			continue;
+		err = lw_ap_validate(ap_ppriv, &validate);
+		if (err)
+			return err;
+		if (validate)
+			continue;
+		/* Any ARP counts as reply from all the targets. */
+		for_each_ap_target(target, ap_ppriv)
+			target->reply_received = true;
+	}
+	return 0;
+}
+
+static int lw_ap_engine_packet_process(struct teamd_packet *packet,
+				       void *priv)
+{
+	unsigned short vlanid;
+
+	if (packet->len < sizeof(struct arp_packet))
+		return 0;
+	vlanid = packet->vlan_valid ? packet->vlan_tci & 0x0fff : 0;
+	return lw_ap_engine_process(priv, packet->ll_from, vlanid,
+				    packet->data);
+}
+
+#define LW_AP_SOCK_CB_NAME "lw_ap_sock"
+
+static int lw_ap_port_sock_callback(struct teamd_context *ctx, int events,
+				    void *priv)
+{
+	struct lw_ap_port_sock *port_sock = priv;
+	struct arp_packet ap;
+
+	return teamd_packet_recv(port_sock->sock, &port_sock->ring,
+				 &ap, sizeof(ap), LW_AP_RX_BUDGET,
+				 lw_ap_engine_packet_process, port_sock->engine);
+}
+
+static struct lw_ap_port_sock *
+lw_ap_port_sock_get(struct teamd_context *ctx, struct lw_ap_engine *engine,
+		    uint32_t ifindex)
+{
+	struct lw_ap_port_sock *port_sock;
+	struct hash_node *hnode;
+	uint32_t hash = hash_mix32(ifindex);
+	int one = 1;
+	int ret;
+	int err;
+
+	hash_table_for_each_possible(port_sock, hnode, &engine->sock_table,
+				     hash, node) {
+		if (port_sock->ifindex == ifindex) {
+			port_sock->refcount++;
+			return port_sock;
+		}
+	}
+	port_sock = myzalloc(sizeof(*port_sock));
+	if (!port_sock)
+		return NULL;
+	port_sock->engine = engine;
+	port_sock->ifindex = ifindex;
+	err = teamd_packet_sock_open_ring(SOCK_DGRAM, &port_sock->sock,
+					  ctx->pkt_rx_ring ?
+					  &port_sock->ring : NULL,
+					  ifindex, htons(ETH_P_ALL),
+					  &arp_rpl_fprog, NULL);
+	if (err)
+		goto free_port_sock;
+	ret = setsockopt(port_sock->sock, SOL_PACKET, PACKET_AUXDATA,
+			 &one, sizeof(one));
+	if (ret == -1) {
+		teamd_log_err("Failed to enable packet auxdata.");
+		goto close_sock;
+	}
+	err = teamd_loop_callback_fd_add(ctx, LW_AP_SOCK_CB_NAME, port_sock,
+					 lw_ap_port_sock_callback,
+					 port_sock->sock,
+					 TEAMD_LOOP_FD_EVENT_READ);
+	if (err) {
+		teamd_log_err("Failed add socket callback.");
+		goto close_sock;
+	}
+	teamd_loop_callback_enable(ctx, LW_AP_SOCK_CB_NAME, port_sock);
+	hash_table_add(&engine->sock_table, &port_sock->node, hash);
+	port_sock->refcount = 1;
+	return port_sock;
+
+close_sock:
+	teamd_packet_ring_teardown(&port_sock->ring);
+	close(port_sock->sock);
+free_port_sock:
+	free(port_sock);
+	return NULL;
+}
+
+static void lw_ap_port_sock_put(struct teamd_context *ctx,
+				struct lw_ap_port_sock *port_sock)
+{
+	if (--port_sock->refcount)
+		return;
+	hash_table_del(&port_sock->engine->sock_table, &port_sock->node);
+	teamd_loop_callback_del(ctx, LW_AP_SOCK_CB_NAME, port_sock);
+	teamd_packet_ring_teardown(&port_sock->ring);
+	close(port_sock->sock);
+	free(port_sock);
+}
+
+/* Skips the probe which failed and sends the rest, returns the first
+ * error which is not caused by the port being down.
+ */
+static int lw_ap_engine_msgs_send(struct lw_ap_engine *engine,
+				  unsigned int count)
+{
+	unsigned int i = 0;
+	int first_err = 0;
+	int ret;
+
+	while (i < count) {
+		ret = sendmmsg(engine->tx_sock, &engine->tx_msgs[i], count - i, 0);
+		if (ret == -1) {
+			switch(errno) {
+			case EINTR:
+				continue;
+			case ENETDOWN:
+			case ENETUNREACH:
+			case EADDRNOTAVAIL:
+			case ENXIO:
+				break;
+			default:
+				teamd_log_err("sendmmsg failed.");
+				if (!first_err)
+					first_err = -errno;
+			}
+			i++;
+			continue;
+		}
+		i += ret;
+	}
+	return first_err;
+}
+
+static size_t lw_ap_build(struct lw_ap_port_priv *ap_ppriv,
+			  struct lw_ap_target *target)
+{
+	struct team_ifinfo *ifinfo = ap_ppriv->start.common.tdport->team_ifinfo;
+	size_t port_hwaddr_len = team_get_ifinfo_hwaddr_len(ifinfo);
+	char *port_hwaddr = team_get_ifinfo_hwaddr(ifinfo);
+	struct sockaddr_ll *ll_bcast = &ap_ppriv->tx_addr;
+	struct arp_packet ap;
+
+	if (port_hwaddr_len != ETH_ALEN) {
+		teamd_log_err("Unexpected length of hw address.");
+		return 0;
+	}
+
+	memset(&ap, 0, sizeof(ap));
+	ap.ah.ar_hrd = htons(ap_ppriv->hatype);
+	ap.ah.ar_pro = htons(ETH_P_IP);
+	ap.ah.ar_hln = port_hwaddr_len;
+	ap.ah.ar_pln = 4;
+	ap.ah.ar_op = htons(ARPOP_REQUEST);
+
+	memcpy(ap.sender_mac, port_hwaddr, sizeof(ap.sender_mac));
+	ap.sender_ip = ap_ppriv->src;
+	memcpy(ap.target_mac, ll_bcast->sll_addr, sizeof(ap.target_mac));
+	ap.target_ip = target->dst;
+
+	if (ap_ppriv->vlanid_in_use) {
+		struct arp_vlan_packet *avp = &target->tx_pkt.avp;
+
+		avp->ap = ap;
+		avp->vlanh.h_vlan_encapsulated_proto = htons(ETH_P_ARP);
+		avp->vlanh.h_vlan_TCI = htons(ap_ppriv->vlanid);
+		return sizeof(*avp);
+	}
+	target->tx_pkt.ap = ap;
+	return sizeof(ap);
+}
+
+static int lw_ap_engine_flush(struct teamd_context *ctx,
+			      struct teamd_workq *workq)
+{
+	struct lw_ap_engine *engine;
+	struct lw_ap_port_priv *ap_ppriv;
+	struct lw_ap_port_priv *tmp;
+	struct lw_ap_target *target;
+	struct msghdr *msg;
+	unsigned int count = 0;
+	int first_err = 0;
+	size_t len;
+	int err;
+
+	/* Failure of one probe must not hold back probes of other ports */
+	engine = get_container(workq, struct lw_ap_engine, tx_workq);
+	list_for_each_node_entry_safe(ap_ppriv, tmp, &engine->tx_list,
+				      tx_list) {
+		list_del(&ap_ppriv->tx_list);
+		list_init(&ap_ppriv->tx_list);
+		for_each_ap_target(target, ap_ppriv) {
+			len = lw_ap_build(ap_ppriv, target);
+			if (!len)
+				break;
+			engine->tx_iovs[count].iov_base = &target->tx_pkt;
+			engine->tx_iovs[count].iov_len = len;
+			msg = &engine->tx_msgs[count].msg_hdr;
+			memset(msg, 0, sizeof(*msg));
+			msg->msg_name = &ap_ppriv->tx_addr;
+			msg->msg_namelen = sizeof(ap_ppriv->tx_addr);
+			msg->msg_iov = &engine->tx_iovs[count];
+			msg->msg_iovlen = 1;
+			if (++count == LW_AP_TX_BATCH) {
+				err = lw_ap_engine_msgs_send(engine, count);
+				if (err && !first_err)
+					first_err = err;
+				count = 0;
+			}
+		}
+	}
+	if (count) {
+		err = lw_ap_engine_msgs_send(engine, count);
+		if (err && !first_err)
+			first_err = err;
+	}
+	return first_err;
+}
+
+static struct lw_ap_engine *lw_ap_engine_get(struct teamd_context *ctx)
+{
+	struct lw_ap_engine *engine = ctx->lw_ap_engine;
+
+	if (engine) {
+		engine->refcount++;
+		return engine;
+	}
+	engine = myzalloc(sizeof(*engine));
+	if (!engine)
+		return NULL;
+	list_init(&engine->tx_list);
+	teamd_workq_init_work(&engine->tx_workq, lw_ap_engine_flush);
+	if (hash_table_init(&engine->sock_table))
+		goto free_engine;
+	if (hash_table_init(&engine->pair_table))
+		goto fini_sock_table;
+	if (hash_table_init(&engine->port_table))
+		goto fini_pair_table;
+
+	/* Protocol 0 makes the socket transmit only. */
+	engine->tx_sock = socket(PF_PACKET, SOCK_DGRAM, 0);
+	if (engine->tx_sock == -1) {
+		teamd_log_err("Failed to create packet socket.");
+		goto fini_port_table;
+	}
+	engine->refcount = 1;
+	ctx->lw_ap_engine = engine;
+	return engine;
+
+fini_port_table:
+	hash_table_fini(&engine->port_table);
+fini_pair_table:
+	hash_table_fini(&engine->pair_table);
+fini_sock_table:
+	hash_table_fini(&engine->sock_table);
+free_engine:
+	free(engine);
+	return NULL;
+}
+
+static void lw_ap_engine_put(struct teamd_context *ctx,
+			     struct lw_ap_engine *engine)
+{
+	if (--engine->refcount)
+		return;
+	teamd_workq_cancel_work(&engine->tx_workq);
+	close(engine->tx_sock);
+	hash_table_fini(&engine->port_table);
+	hash_table_fini(&engine->pair_table);
+	hash_table_fini(&engine->sock_table);
+	free(engine);
+	ctx->lw_ap_engine = NULL;
+}
+
+static bool lw_ap_lenient(struct lw_ap_port_priv *ap_ppriv)
+{
+	return !ap_ppriv->validate_active || !ap_ppriv->validate_inactive;
+}
+
+static int lw_ap_port_hatype_get(struct lw_ap_engine *engine,
+				 struct lw_ap_port_priv *ap_ppriv)
+{
+	const char *ifname = ap_ppriv->start.common.tdport->ifname;
+	struct ifreq ifr;
+	int ret;
+
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, ifname, sizeof(ifr.ifr_name) - 1);
+	ret = ioctl(engine->tx_sock, SIOCGIFHWADDR, &ifr);
+	if (ret == -1) {
+		teamd_log_err("%s: Failed to get hardware type.", ifname);
+		return -errno;
+	}
+	ap_ppriv->hatype = ifr.ifr_hwaddr.sa_family;
+	return 0;
 }
 
 static int lw_ap_sock_open(struct lw_psr_port_priv *psr_ppriv)
 {
 	struct lw_ap_port_priv *ap_ppriv = lw_ap_ppriv_get(psr_ppriv);
-	struct sock_fprog fprog;
-	struct sock_filter arp_vlan_rpl_flt[ARRAY_SIZE(arp_vlan_rpl_flt)];
+	struct lw_common_port_priv *common_ppriv = &psr_ppriv->common;
+	struct teamd_port *tdport = common_ppriv->tdport;
+	struct sockaddr_ll *ll_bcast = &ap_ppriv->tx_addr;
+	struct lw_ap_engine *engine;
+	struct lw_ap_target *target;
+	unsigned short vlanid = lw_ap_vlanid(ap_ppriv);
+	int err;
 
-	if (ap_ppriv->vlanid_in_use) {
-		memcpy(&arp_vlan_rpl_flt, arp_vlan_rpl_fprog.filter,
-		       sizeof(arp_vlan_rpl_flt));
-		fprog = arp_vlan_rpl_fprog;
-		fprog.filter = arp_vlan_rpl_flt;
-		SET_FILTER_VLANID(&fprog, ap_ppriv->vlanid);
-	} else {
-		fprog = arp_novlan_rpl_fprog;
+	engine = lw_ap_engine_get(common_ppriv->ctx);
+	if (!engine)
+		return -ENOMEM;
+	err = lw_ap_port_hatype_get(engine, ap_ppriv);
+	if (err)
+		goto engine_put;
+	ap_ppriv->port_sock = lw_ap_port_sock_get(common_ppriv->ctx, engine,
+						  tdport->ifindex);
+	if (!ap_ppriv->port_sock) {
+		err = -ENOMEM;
+		goto engine_put;
 	}
-	return teamd_packet_sock_open(&psr_ppriv->sock,
-				      psr_ppriv->common.tdport->ifindex,
-				      htons(ETH_P_ALL), &fprog, &arp_rpl_fprog);
+
+	memset(ll_bcast, 0, sizeof(*ll_bcast));
+	ll_bcast->sll_family = AF_PACKET;
+	ll_bcast->sll_ifindex = tdport->ifindex;
+	ll_bcast->sll_protocol = htons(ap_ppriv->vlanid_in_use ?
+				       ETH_P_8021Q : ETH_P_ARP);
+	ll_bcast->sll_halen = ETH_ALEN;
+	memset(ll_bcast->sll_addr, 0xFF, ETH_ALEN);
+
+	list_init(&ap_ppriv->tx_list);
+	for_each_ap_target(target, ap_ppriv)
+		hash_table_add(&engine->pair_table, &target->pair_node,
+			       lw_ap_pair_hash(tdport->ifindex, vlanid,
+					       ap_ppriv->src, target->dst));
+	if (lw_ap_lenient(ap_ppriv))
+		hash_table_add(&engine->port_table, &ap_ppriv->port_node,
+			       lw_ap_port_hash(tdport->ifindex, vlanid));
+	/* Replies are received on the shared port socket. */
+	psr_ppriv->sock = -1;
+	return 0;
+
+engine_put:
+	lw_ap_engine_put(common_ppriv->ctx, engine);
+	return err;
 }
 
 static void lw_ap_sock_close(struct lw_psr_port_priv *psr_ppriv)
 {
-	close(psr_ppriv->sock);
+	struct lw_ap_port_priv *ap_ppriv = lw_ap_ppriv_get(psr_ppriv);
+	struct teamd_context *ctx = psr_ppriv->common.ctx;
+	struct lw_ap_engine *engine = ctx->lw_ap_engine;
+	struct lw_ap_target *target;
+
+	list_del(&ap_ppriv->tx_list);
+	for_each_ap_target(target, ap_ppriv)
+		hash_table_del(&engine->pair_table, &target->pair_node);
+	if (lw_ap_lenient(ap_ppriv))
+		hash_table_del(&engine->port_table, &ap_ppriv->port_node);
+	lw_ap_port_sock_put(ctx, ap_ppriv->port_sock);
+	lw_ap_engine_put(ctx, engine);
+}
+
+static int lw_ap_load_target(struct teamd_context *ctx,
+			     struct lw_ap_port_priv *ap_ppriv,
+			     const char *host)
+{
+	struct lw_ap_target *target;
+	int err;
+
+	target = &ap_ppriv->targets[ap_ppriv->target_count];
+	err = set_in_addr(&target->dst, host);
+	if (err)
+		return err;
+	target->ap_ppriv = ap_ppriv;
+	ap_ppriv->target_count++;
+	teamd_log_dbg("target address \"%s\".", str_in_addr(&target->dst));
+	return 0;
+}
+
+/* "target_host" is either single hostname or array of hostnames. */
+static int lw_ap_load_targets(struct teamd_context *ctx,
+			      struct lw_ap_port_priv *ap_ppriv,
+			      struct teamd_config_path_cookie *cpcookie)
+{
+	const char *host;
+	size_t count = 1;
+	bool is_arr;
+	int err;
+	int i;
+
+	is_arr = teamd_config_path_is_arr(ctx, "@.target_host", cpcookie);
+	if (is_arr)
+		count = teamd_config_arr_size(ctx, "@.target_host", cpcookie);
+	if (!count) {
+		teamd_log_err("\"target_host\" link-watch option is empty.");
+		return -EINVAL;
+	}
+	ap_ppriv->targets = myzalloc(count * sizeof(*ap_ppriv->targets));
+	if (!ap_ppriv->targets)
+		return -ENOMEM;
+
+	if (!is_arr) {
+		err = teamd_config_string_get(ctx, &host, "@.target_host",
+					      cpcookie);
+		if (err) {
+			teamd_log_err("Failed to get \"target_host\" link-watch option.");
+			return -EINVAL;
+		}
+		return lw_ap_load_target(ctx, ap_ppriv, host);
+	}
+
+	teamd_config_for_each_arr_index(i, ctx, "@.target_host", cpcookie) {
+		err = teamd_config_string_get(ctx, &host, "@.target_host[%d]",
+					      cpcookie, i);
+		if (err) {
+			teamd_log_err("Failed to get \"target_host\" item %d.",
+				      i);
+			return -EINVAL;
+		}
+		err = lw_ap_load_target(ctx, ap_ppriv, host);
+		if (err)
+			return err;
+	}
+	return 0;
 }
 
 static int lw_ap_load_options(struct teamd_context *ctx,
@@ -181,15 +726,22 @@ static int lw_ap_load_options(struct teamd_context *ctx,
 	teamd_log_dbg("source address \"%s\".",
 		      str_in_addr(&ap_ppriv->src));
 
-	err = teamd_config_string_get(ctx, &host, "@.target_host", cpcookie);
-	if (err) {
-		teamd_log_err("Failed to get \"target_host\" link-watch option.");
-		return -EINVAL;
-	}
-	err = set_in_addr(&ap_ppriv->dst, host);
+	err = lw_ap_load_targets(ctx, ap_ppriv, cpcookie);
 	if (err)
 		return err;
-	teamd_log_dbg("target address \"%s\".", str_in_addr(&ap_ppriv->dst));
+
+	err = teamd_config_int_get(ctx, &tmp, "@.quorum", cpcookie);
+	if (!err) {
+		if (tmp < 1 || tmp > ap_ppriv->target_count) {
+			teamd_log_err("\"quorum\" must be in range 1-%u.",
+				      ap_ppriv->target_count);
+			return -EINVAL;
+		}
+	} else {
+		tmp = 1;
+	}
+	teamd_log_dbg("quorum \"%d\".", tmp);
+	ap_ppriv->quorum = tmp;
 
 	err = teamd_config_bool_get(ctx, &ap_ppriv->validate_active,
 				    "@.validate_active", cpcookie);
@@ -223,141 +775,120 @@ static int lw_ap_load_options(struct teamd_context *ctx,
 	return 0;
 }
 
-static int __get_port_curr_hwaddr(struct lw_psr_port_priv *psr_ppriv,
-				  struct sockaddr_ll *addr, size_t expected_len)
+static int lw_ap_send(struct lw_psr_port_priv *psr_ppriv)
 {
-	struct team_ifinfo *ifinfo = psr_ppriv->common.tdport->team_ifinfo;
-	size_t port_hwaddr_len = team_get_ifinfo_hwaddr_len(ifinfo);
-	char *port_hwaddr = team_get_ifinfo_hwaddr(ifinfo);
-	int err;
+	struct lw_ap_port_priv *ap_ppriv = lw_ap_ppriv_get(psr_ppriv);
+	struct teamd_context *ctx = psr_ppriv->common.ctx;
+	struct lw_ap_engine *engine = ctx->lw_ap_engine;
 
-	err = teamd_getsockname_hwaddr(psr_ppriv->sock, addr, expected_len);
-	if (err)
-		return err;
-	if ((addr->sll_halen != port_hwaddr_len) ||
-	    (expected_len && expected_len != port_hwaddr_len)) {
-		teamd_log_err("Unexpected length of hw address.");
-		return -ENOTSUP;
-	}
-	memcpy(addr->sll_addr, port_hwaddr, addr->sll_halen);
+	if (!(psr_ppriv->common.forced_send || ap_ppriv->send_always))
+		return 0;
+	if (!list_empty(&ap_ppriv->tx_list))
+		return 0;
+	list_add_tail(&engine->tx_list, &ap_ppriv->tx_list);
+	teamd_workq_schedule_work(ctx, &engine->tx_workq);
 	return 0;
 }
 
-struct arp_packet {
-	struct arphdr			ah;
-	unsigned char			sender_mac[ETH_ALEN];
-	struct in_addr			sender_ip;
-	unsigned char			target_mac[ETH_ALEN];
-	struct in_addr			target_ip;
-} __attribute__((packed));
-
-struct __vlan_hdr {
-	__be16 h_vlan_TCI;
-	__be16 h_vlan_encapsulated_proto;
-};
-
-struct arp_vlan_packet {
-	struct __vlan_hdr		vlanh;
-	struct arp_packet		ap;
-} __attribute__((packed));
-
-static int lw_ap_send(struct lw_psr_port_priv *psr_ppriv)
+static void lw_ap_period_check(struct lw_psr_port_priv *psr_ppriv)
 {
 	struct lw_ap_port_priv *ap_ppriv = lw_ap_ppriv_get(psr_ppriv);
-	int err;
-	struct sockaddr_ll ll_my;
-	struct sockaddr_ll ll_bcast;
-	struct arp_packet ap;
+	struct lw_ap_target *target;
+	unsigned int replied = 0;
 
-	if (!(psr_ppriv->common.forced_send || ap_ppriv->send_always))
-		return 0;
-
-	err = __get_port_curr_hwaddr(psr_ppriv, &ll_my, 0);
-	if (err)
-		return err;
-	ll_bcast = ll_my;
-	memset(ll_bcast.sll_addr, 0xFF, ll_bcast.sll_halen);
+	for_each_ap_target(target, ap_ppriv) {
+		if (target->reply_received) {
+			replied++;
+			target->missed = 0;
+		} else {
+			target->missed++;
+		}
+		target->reply_received = false;
+	}
+	psr_ppriv->reply_received = replied >= ap_ppriv->quorum;
+}
 
-	memset(&ap, 0, sizeof(ap));
-	ap.ah.ar_hrd = htons(ll_my.sll_hatype);
-	ap.ah.ar_pro = htons(ETH_P_IP);
-	ap.ah.ar_hln = ll_my.sll_halen;
-	ap.ah.ar_pln = 4;
-	ap.ah.ar_op = htons(ARPOP_REQUEST);
+static const struct lw_psr_ops lw_psr_ops_ap = {
+	.sock_open		= lw_ap_sock_open,
+	.sock_close		= lw_ap_sock_close,
+	.load_options		= lw_ap_load_options,
+	.send			= lw_ap_send,
+	.period_check		= lw_ap_period_check,
+};
 
-	memcpy(ap.sender_mac, ll_my.sll_addr, sizeof(ap.sender_mac));
-	ap.sender_ip = ap_ppriv->src;
-	memcpy(ap.target_mac, ll_bcast.sll_addr, sizeof(ap.target_mac));
-	ap.target_ip = ap_ppriv->dst;
+static int lw_ap_target_state_host_get(struct teamd_context *ctx,
+				       struct team_state_gsc *gsc,
+				       void *priv)
+{
+	struct lw_ap_target *target = priv;
 
-	if (ap_ppriv->vlanid_in_use) {
-		struct arp_vlan_packet avp;
-		avp.ap = ap;
-		avp.vlanh.h_vlan_encapsulated_proto = htons(ETH_P_ARP);
-		avp.vlanh.h_vlan_TCI = htons(ap_ppriv->vlanid);
-		ll_bcast.sll_protocol = htons(ETH_P_8021Q);
-		return teamd_sendto(psr_ppriv->sock, &avp, sizeof(avp),
-				    0, (struct sockaddr *) &ll_bcast,
-				    sizeof(ll_bcast));
-	} else {
-		ll_bcast.sll_protocol = htons(ETH_P_ARP);
-		return teamd_sendto(psr_ppriv->sock, &ap, sizeof(ap),
-				    0, (struct sockaddr *) &ll_bcast,
-				    sizeof(ll_bcast));
-	}
+	gsc->data.str_val.ptr = str_in_addr(&target->dst);
+	return 0;
 }
 
-static int lw_ap_receive(struct lw_psr_port_priv *psr_ppriv)
+static int lw_ap_target_state_missed_get(struct teamd_context *ctx,
+					 struct team_state_gsc *gsc,
+					 void *priv)
 {
-	struct lw_common_port_priv *common_ppriv = &psr_ppriv->common;
-	struct lw_ap_port_priv *ap_ppriv = lw_ap_ppriv_get(psr_ppriv);
-	int err;
-	struct sockaddr_ll ll_my;
-	struct sockaddr_ll ll_from;
-	struct arp_packet ap;
-	bool port_enabled;
+	struct lw_ap_target *target = priv;
 
-	err = teamd_recvfrom(psr_ppriv->sock, &ap, sizeof(ap), 0,
-			     (struct sockaddr *) &ll_from, sizeof(ll_from));
-	if (err <= 0)
-		return err;
+	gsc->data.int_val = target->missed;
+	return 0;
+}
 
-	err = teamd_port_enabled(common_ppriv->ctx, common_ppriv->tdport,
-				 &port_enabled);
-	if (err)
-		return err;
+static const struct teamd_state_val lw_ap_target_state_vals[] = {
+	{
+		.subpath = "host",
+		.type = TEAMD_STATE_ITEM_TYPE_STRING,
+		.getter = lw_ap_target_state_host_get,
+	},
+	{
+		.subpath = "missed",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = lw_ap_target_state_missed_get,
+	},
+};
 
-	if ((port_enabled && ap_ppriv->validate_active) ||
-	    (!port_enabled && ap_ppriv->validate_inactive)) {
-		err = __get_port_curr_hwaddr(psr_ppriv, &ll_my, 0);
-		if (err)
-			return err;
+static const struct teamd_state_val lw_ap_target_state_vg = {
+	.vals = lw_ap_target_state_vals,
+	.vals_count = ARRAY_SIZE(lw_ap_target_state_vals),
+};
 
-		if (ap.ah.ar_hrd != htons(ll_my.sll_hatype) ||
-		    ap.ah.ar_pro != htons(ETH_P_IP) ||
-		    ap.ah.ar_hln != ll_my.sll_halen ||
-		    ap.ah.ar_pln != 4) {
-			return 0;
-		}
+static int lw_ap_targets_state_register(struct teamd_context *ctx,
+					struct lw_ap_port_priv *ap_ppriv)
+{
+	struct lw_common_port_priv *common_ppriv = &ap_ppriv->start.common;
+	int err;
+	int i;
 
-		if ((ap_ppriv->src.s_addr != ap.target_ip.s_addr ||
-		     ap_ppriv->dst.s_addr != ap.sender_ip.s_addr) &&
-		    (ap_ppriv->dst.s_addr != ap.target_ip.s_addr ||
-		     ap_ppriv->src.s_addr != ap.sender_ip.s_addr))
-			return 0;
+	for (i = 0; i < ap_ppriv->target_count; i++) {
+		err = teamd_state_val_register_ex(ctx, &lw_ap_target_state_vg,
+						  &ap_ppriv->targets[i],
+						  common_ppriv->tdport,
+						  "link_watches.list.link_watch_%u"
+						  ".targets.target_%d",
+						  common_ppriv->id, i);
+		if (err)
+			goto rollback;
 	}
-
-	psr_ppriv->reply_received = true;
 	return 0;
+
+rollback:
+	while (--i >= 0)
+		teamd_state_val_unregister(ctx, &lw_ap_target_state_vg,
+					   &ap_ppriv->targets[i]);
+	return err;
 }
 
-static const struct lw_psr_ops lw_psr_ops_ap = {
-	.sock_open		= lw_ap_sock_open,
-	.sock_close		= lw_ap_sock_close,
-	.load_options		= lw_ap_load_options,
-	.send			= lw_ap_send,
-	.receive		= lw_ap_receive,
-};
+static void lw_ap_targets_state_unregister(struct teamd_context *ctx,
+					   struct lw_ap_port_priv *ap_ppriv)
+{
+	int i;
+
+	for (i = 0; i < ap_ppriv->target_count; i++)
+		teamd_state_val_unregister(ctx, &lw_ap_target_state_vg,
+					   &ap_ppriv->targets[i]);
+}
 
 static int lw_ap_port_added(struct teamd_context *ctx,
 			    struct teamd_port *tdport,
@@ -365,9 +896,33 @@ static int lw_ap_port_added(struct teamd_context *ctx,
 {
 	struct lw_ap_port_priv *ap_ppriv = priv;
 	struct lw_psr_port_priv *psr_ppriv = &ap_ppriv->start.psr;
+	int err;
 
 	psr_ppriv->ops = &lw_psr_ops_ap;
-	return lw_psr_port_added(ctx, tdport, priv, creator_priv);
+	err = lw_psr_port_added(ctx, tdport, priv, creator_priv);
+	if (err)
+		goto free_targets;
+	err = lw_ap_targets_state_register(ctx, ap_ppriv);
+	if (err)
+		goto psr_port_removed;
+	return 0;
+
+psr_port_removed:
+	lw_psr_port_removed(ctx, tdport, priv, creator_priv);
+free_targets:
+	free(ap_ppriv->targets);
+	return err;
+}
+
+static void lw_ap_port_removed(struct teamd_context *ctx,
+			       struct teamd_port *tdport,
+			       void *priv, void *creator_priv)
+{
+	struct lw_ap_port_priv *ap_ppriv = priv;
+
+	lw_ap_targets_state_unregister(ctx, ap_ppriv);
+	lw_psr_port_removed(ctx, tdport, priv, creator_priv);
+	free(ap_ppriv->targets);
 }
 
 static int lw_ap_state_source_host_get(struct teamd_context *ctx,
@@ -390,7 +945,19 @@ static int lw_ap_state_target_host_get(struct teamd_context *ctx,
 	struct lw_psr_port_priv *psr_ppriv = lw_psr_ppriv_get(common_ppriv);
 	struct lw_ap_port_priv *ap_ppriv = lw_ap_ppriv_get(psr_ppriv);
 
-	gsc->data.str_val.ptr = str_in_addr(&ap_ppriv->dst);
+	gsc->data.str_val.ptr = str_in_addr(&ap_ppriv->targets[0].dst);
+	return 0;
+}
+
+static int lw_ap_state_quorum_get(struct teamd_context *ctx,
+				  struct team_state_gsc *gsc,
+				  void *priv)
+{
+	struct lw_common_port_priv *common_ppriv = priv;
+	struct lw_psr_port_priv *psr_ppriv = lw_psr_ppriv_get(common_ppriv);
+	struct lw_ap_port_priv *ap_ppriv = lw_ap_ppriv_get(psr_ppriv);
+
+	gsc->data.int_val = ap_ppriv->quorum;
 	return 0;
 }
 
@@ -441,11 +1008,26 @@ static const struct teamd_state_val lw_ap_state_vals[] = {
 		.type = TEAMD_STATE_ITEM_TYPE_STRING,
 		.getter = lw_ap_state_target_host_get,
 	},
+	{
+		.subpath = "quorum",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = lw_ap_state_quorum_get,
+	},
 	{
 		.subpath = "interval",
 		.type = TEAMD_STATE_ITEM_TYPE_INT,
 		.getter = lw_psr_state_interval_get,
 	},
+	{
+		.subpath = "interval_max",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = lw_psr_state_interval_max_get,
+	},
+	{
+		.subpath = "effective_interval",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = lw_psr_state_effective_interval_get,
+	},
 	{
 		.subpath = "init_wait",
 		.type = TEAMD_STATE_ITEM_TYPE_INT,
@@ -486,7 +1068,7 @@ const struct teamd_link_watch teamd_link_watch_arp_ping = {
 	},
 	.port_priv = {
 		.init		= lw_ap_port_added,
-		.fini		= lw_psr_port_removed,
+		.fini		= lw_ap_port_removed,
 		.priv_size	= sizeof(struct lw_ap_port_priv),
 	},
 };
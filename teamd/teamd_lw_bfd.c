@@ -0,0 +1,888 @@
+/*
+ *   teamd_lw_bfd.c - Team port BFD link watcher
+ *   Copyright (C) 2026 agent <agent@local>
+ *
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <linux/filter.h>
+#include <netdb.h>
+#include <private/misc.h>
+#include "teamd.h"
+#include "teamd_link_watch.h"
+#include "teamd_config.h"
+
+#ifdef HAVE_GETRANDOM
+#include <sys/random.h>
+#endif
+
+/*
+ * BFD link watch
+ *
+ * Asynchronous mode BFD (RFC 5880) over IPv4 UDP, single hop (RFC 5881).
+ * Port is not expected to have an address configured so packets are built
+ * and received on packet socket. Control packets are sent each interval,
+ * session state is the link state. Optionally echo packets are sent to the
+ * peer which forwards them back.
+ */
+
+#define BFD_CTRL_PORT		3784
+#define BFD_ECHO_PORT		3785
+#define BFD_SRC_PORT_MIN	49152
+#define BFD_SRC_PORT_COUNT	16384
+#define BFD_VERSION		1
+#define BFD_TTL			255
+
+enum bfd_state {
+	BFD_STATE_ADMIN_DOWN,
+	BFD_STATE_DOWN,
+	BFD_STATE_INIT,
+	BFD_STATE_UP,
+};
+
+static const char *bfd_state_names[] = {
+	[BFD_STATE_ADMIN_DOWN]	= "admin_down",
+	[BFD_STATE_DOWN]	= "down",
+	[BFD_STATE_INIT]	= "init",
+	[BFD_STATE_UP]		= "up",
+};
+
+enum bfd_diag {
+	BFD_DIAG_NONE,
+	BFD_DIAG_TIME_EXPIRED,
+	BFD_DIAG_ECHO_FAILED,
+	BFD_DIAG_NEIGHBOR_DOWN,
+};
+
+#define BFD_FLAG_POLL		0x20
+#define BFD_FLAG_FINAL		0x10
+#define BFD_FLAG_AUTH		0x04
+#define BFD_FLAG_MULTIPOINT	0x01
+
+struct bfd_ctrl {
+	uint8_t		vers_diag;
+	uint8_t		state_flags;
+	uint8_t		detect_mult;
+	uint8_t		length;
+	uint32_t	my_discr;
+	uint32_t	your_discr;
+	uint32_t	desired_min_tx;
+	uint32_t	required_min_rx;
+	uint32_t	required_min_echo_rx;
+} __attribute__((packed));
+
+/* Echo packet content is of local significance only. */
+struct bfd_echo {
+	uint32_t	discr;
+	uint32_t	seq;
+} __attribute__((packed));
+
+struct bfd_packet {
+	struct iphdr	iph;
+	struct udphdr	udph;
+	union {
+		struct bfd_ctrl ctrl;
+		struct bfd_echo echo;
+	};
+};
+
+struct lw_bfd_port_priv {
+	union {
+		struct lw_common_port_priv common;
+		struct lw_psr_port_priv psr;
+	} start; /* must be first */
+	struct in_addr src;
+	struct in_addr dst;
+	bool echo;
+	bool send_always;
+	uint16_t src_port;
+	enum bfd_state state;
+	enum bfd_diag diag;
+	uint32_t local_discr;
+	uint32_t remote_discr;
+	enum bfd_state remote_state;
+	unsigned int remote_detect_mult;
+	uint32_t remote_min_tx; /* in microseconds */
+	uint32_t remote_min_rx;
+	uint32_t remote_min_echo_rx;
+	struct timespec last_rx;
+	struct timespec echo_last_rx;
+	bool echo_active;
+	uint32_t echo_seq;
+	unsigned int ctrl_tick;
+	unsigned int echo_tick;
+	bool peer_hwaddr_valid;
+	unsigned char peer_hwaddr[ETH_ALEN];
+};
+
+static struct lw_bfd_port_priv *
+lw_bfd_ppriv_get(struct lw_psr_port_priv *psr_ppriv)
+{
+	return (struct lw_bfd_port_priv *) psr_ppriv;
+}
+
+static int set_in_addr(struct in_addr *addr, const char *hostname)
+{
+	struct sockaddr_in sin;
+	int err;
+
+	err = __set_sockaddr((struct sockaddr *) &sin, sizeof(sin),
+			     AF_INET, hostname);
+	if (err)
+		return err;
+	memcpy(addr, &sin.sin_addr, sizeof(*addr));
+	return 0;
+}
+
+static char *str_in_addr(struct in_addr *addr)
+{
+	struct sockaddr_in sin;
+	static char buf[NI_MAXHOST];
+
+	memcpy(&sin.sin_addr, addr, sizeof(*addr));
+	return __str_sockaddr((struct sockaddr *) &sin, sizeof(sin), AF_INET,
+			      buf, sizeof(buf));
+}
+
+static void bfd_now(struct timespec *ts)
+{
+	clock_gettime(CLOCK_MONOTONIC, ts);
+}
+
+static uint64_t bfd_elapsed_us(struct timespec *now, struct timespec *since)
+{
+	return (now->tv_sec - since->tv_sec) * 1000000LL +
+	       (now->tv_nsec - since->tv_nsec) / 1000;
+}
+
+static uint32_t lw_bfd_interval_us(struct lw_psr_port_priv *psr_ppriv)
+{
+	return timespec_to_ms(&psr_ppriv->interval) * 1000;
+}
+
+/* Number of our intervals needed to cover the given one. */
+static unsigned int lw_bfd_ticks(struct lw_psr_port_priv *psr_ppriv,
+				 uint32_t us)
+{
+	uint32_t interval_us = lw_bfd_interval_us(psr_ppriv);
+
+	if (us <= interval_us)
+		return 1;
+	return (us + interval_us - 1) / interval_us;
+}
+
+#define OFFSET_IP_PROTOCOL					\
+	in_struct_offset(struct iphdr, protocol)
+#define OFFSET_IP_FRAG_OFF					\
+	in_struct_offset(struct iphdr, frag_off)
+#define OFFSET_UDP_DPORT					\
+	in_struct_offset(struct udphdr, dest)
+
+static struct sock_filter bfd_flt[] = {
+	BPF_STMT(BPF_LD + BPF_W + BPF_ABS, SKF_AD_OFF + SKF_AD_PKTTYPE),
+	BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, PACKET_OUTGOING, 11, 0),
+	BPF_STMT(BPF_LD + BPF_H + BPF_ABS, SKF_AD_OFF + SKF_AD_PROTOCOL),
+	BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, ETH_P_IP, 0, 9),
+	BPF_STMT(BPF_LD + BPF_B + BPF_ABS, OFFSET_IP_PROTOCOL),
+	BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, IPPROTO_UDP, 0, 7),
+	BPF_STMT(BPF_LD + BPF_H + BPF_ABS, OFFSET_IP_FRAG_OFF),
+	BPF_JUMP(BPF_JMP + BPF_JSET + BPF_K, 0x1fff, 5, 0),
+	BPF_STMT(BPF_LDX + BPF_B + BPF_MSH, 0),
+	BPF_STMT(BPF_LD + BPF_H + BPF_IND, OFFSET_UDP_DPORT),
+	BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, BFD_CTRL_PORT, 1, 0),
+	BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, BFD_ECHO_PORT, 0, 1),
+	BPF_STMT(BPF_RET + BPF_K, (u_int) -1),
+	BPF_STMT(BPF_RET + BPF_K, 0),
+};
+
+static const struct sock_fprog bfd_fprog = {
+	.len = ARRAY_SIZE(bfd_flt),
+	.filter = bfd_flt,
+};
+
+static uint16_t bfd_ip_csum(struct iphdr *iph)
+{
+	uint16_t *p = (uint16_t *) iph;
+	uint32_t sum = 0;
+	int i;
+
+	for (i = 0; i < sizeof(*iph) / 2; i++)
+		sum += p[i];
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return ~sum;
+}
+
+static size_t lw_bfd_packet_init(struct lw_bfd_port_priv *bfd_ppriv,
+				 struct bfd_packet *bp, struct in_addr daddr,
+				 uint16_t dport, size_t payload_len)
+{
+	size_t len = sizeof(bp->iph) + sizeof(bp->udph) + payload_len;
+
+	memset(bp, 0, sizeof(*bp));
+	bp->iph.version = 4;
+	bp->iph.ihl = sizeof(bp->iph) / 4;
+	bp->iph.tos = IPTOS_PREC_INTERNETCONTROL;
+	bp->iph.tot_len = htons(len);
+	bp->iph.frag_off = htons(IP_DF);
+	bp->iph.ttl = BFD_TTL;
+	bp->iph.protocol = IPPROTO_UDP;
+	bp->iph.saddr = bfd_ppriv->src.s_addr;
+	bp->iph.daddr = daddr.s_addr;
+	bp->iph.check = bfd_ip_csum(&bp->iph);
+	bp->udph.source = htons(bfd_ppriv->src_port);
+	bp->udph.dest = htons(dport);
+	bp->udph.len = htons(sizeof(bp->udph) + payload_len);
+	/* UDP checksum is optional for IPv4 */
+	return len;
+}
+
+static int lw_bfd_packet_send(struct lw_bfd_port_priv *bfd_ppriv,
+			      struct bfd_packet *bp, size_t len)
+{
+	struct lw_psr_port_priv *psr_ppriv = &bfd_ppriv->start.psr;
+	struct sockaddr_ll ll_dst;
+
+	memset(&ll_dst, 0, sizeof(ll_dst));
+	ll_dst.sll_family = AF_PACKET;
+	ll_dst.sll_ifindex = psr_ppriv->common.tdport->ifindex;
+	ll_dst.sll_protocol = htons(ETH_P_IP);
+	ll_dst.sll_halen = ETH_ALEN;
+	/* Until the peer is heard from, control packets are broadcasted. */
+	if (bfd_ppriv->peer_hwaddr_valid)
+		memcpy(ll_dst.sll_addr, bfd_ppriv->peer_hwaddr, ETH_ALEN);
+	else
+		memset(ll_dst.sll_addr, 0xFF, ETH_ALEN);
+	return teamd_sendto(psr_ppriv->sock, bp, len, 0,
+			    (struct sockaddr *) &ll_dst, sizeof(ll_dst));
+}
+
+static int lw_bfd_ctrl_send(struct lw_bfd_port_priv *bfd_ppriv, bool final)
+{
+	struct lw_psr_port_priv *psr_ppriv = &bfd_ppriv->start.psr;
+	struct bfd_packet bp;
+	struct bfd_ctrl *ctrl = &bp.ctrl;
+	uint32_t interval_us = lw_bfd_interval_us(psr_ppriv);
+	size_t len;
+
+	len = lw_bfd_packet_init(bfd_ppriv, &bp, bfd_ppriv->dst,
+				 BFD_CTRL_PORT, sizeof(*ctrl));
+	ctrl->vers_diag = (BFD_VERSION << 5) | bfd_ppriv->diag;
+	ctrl->state_flags = bfd_ppriv->state << 6;
+	if (final)
+		ctrl->state_flags |= BFD_FLAG_FINAL;
+	ctrl->detect_mult = psr_ppriv->missed_max;
+	ctrl->length = sizeof(*ctrl);
+	ctrl->my_discr = htonl(bfd_ppriv->local_discr);
+	ctrl->your_discr = htonl(bfd_ppriv->remote_discr);
+	ctrl->desired_min_tx = htonl(interval_us);
+	ctrl->required_min_rx = htonl(interval_us);
+	/* Echo packets of the peer are not looped back by team port. */
+	ctrl->required_min_echo_rx = 0;
+	return lw_bfd_packet_send(bfd_ppriv, &bp, len);
+}
+
+static int lw_bfd_echo_send(struct lw_bfd_port_priv *bfd_ppriv)
+{
+	struct bfd_packet bp;
+	size_t len;
+
+	/* Peer routes the packet back to us as it is destined to our address. */
+	len = lw_bfd_packet_init(bfd_ppriv, &bp, bfd_ppriv->src,
+				 BFD_ECHO_PORT, sizeof(bp.echo));
+	bp.echo.discr = htonl(bfd_ppriv->local_discr);
+	bp.echo.seq = htonl(bfd_ppriv->echo_seq++);
+	return lw_bfd_packet_send(bfd_ppriv, &bp, len);
+}
+
+static int lw_bfd_state_set(struct lw_bfd_port_priv *bfd_ppriv,
+			    enum bfd_state state, enum bfd_diag diag)
+{
+	struct lw_common_port_priv *common_ppriv = &bfd_ppriv->start.common;
+
+	if (bfd_ppriv->state == state)
+		return 0;
+	teamd_log_dbg("%s: BFD session %s -> %s.",
+		      common_ppriv->tdport->ifname,
+		      bfd_state_names[bfd_ppriv->state],
+		      bfd_state_names[state]);
+	bfd_ppriv->state = state;
+	bfd_ppriv->diag = diag;
+	bfd_ppriv->echo_active = false;
+	if (state == BFD_STATE_DOWN)
+		bfd_ppriv->remote_min_echo_rx = 0;
+	/* Do not wait for the next interval, session state is link state. */
+	return teamd_link_watch_check_link_up(common_ppriv->ctx,
+					      common_ppriv->tdport,
+					      common_ppriv,
+					      state == BFD_STATE_UP);
+}
+
+static int lw_bfd_random_get(void *buf, size_t len)
+{
+	ssize_t ret;
+	int fd;
+
+#ifdef HAVE_GETRANDOM
+	do {
+		ret = getrandom(buf, len, 0);
+	} while (ret == -1 && errno == EINTR);
+	if (ret == (ssize_t) len)
+		return 0;
+#endif
+	fd = open("/dev/urandom", O_RDONLY);
+	if (fd == -1) {
+		teamd_log_err("Failed to open /dev/urandom.");
+		return -errno;
+	}
+	ret = read(fd, buf, len);
+	close(fd);
+	if (ret != (ssize_t) len) {
+		teamd_log_err("Failed to read random bytes.");
+		return -EIO;
+	}
+	return 0;
+}
+
+extern const struct teamd_link_watch teamd_link_watch_bfd;
+
+static bool lw_bfd_discr_in_use(struct teamd_context *ctx, uint32_t discr)
+{
+	struct lw_common_port_priv *common_ppriv;
+	struct lw_bfd_port_priv *bfd_ppriv;
+	struct teamd_port *tdport;
+
+	teamd_for_each_tdport(tdport, ctx) {
+		common_ppriv = NULL;
+		while ((common_ppriv = teamd_link_watch_ppriv_next(tdport,
+								   common_ppriv))) {
+			if (common_ppriv->link_watch != &teamd_link_watch_bfd)
+				continue;
+			bfd_ppriv = (struct lw_bfd_port_priv *) common_ppriv;
+			if (bfd_ppriv->local_discr == discr)
+				return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * LocalDiscr has to be unique on the system and should be random
+ * (RFC 5880 6.8.1). Collisions with sessions of other processes are not
+ * detectable, random 32 bits make them unlikely.
+ */
+static int lw_bfd_session_ids_init(struct lw_bfd_port_priv *bfd_ppriv)
+{
+	struct teamd_context *ctx = bfd_ppriv->start.common.ctx;
+	uint32_t discr;
+	uint16_t port;
+	int err;
+
+	do {
+		err = lw_bfd_random_get(&discr, sizeof(discr));
+		if (err)
+			return err;
+	} while (!discr || lw_bfd_discr_in_use(ctx, discr));
+	err = lw_bfd_random_get(&port, sizeof(port));
+	if (err)
+		return err;
+	bfd_ppriv->local_discr = discr;
+	bfd_ppriv->src_port = BFD_SRC_PORT_MIN + port % BFD_SRC_PORT_COUNT;
+	return 0;
+}
+
+static int lw_bfd_sock_open(struct lw_psr_port_priv *psr_ppriv)
+{
+	struct lw_bfd_port_priv *bfd_ppriv = lw_bfd_ppriv_get(psr_ppriv);
+	struct teamd_context *ctx = psr_ppriv->common.ctx;
+	int err;
+
+	/* Bound to the port so packets are received on inactive ports too. */
+	err = teamd_packet_sock_open_ring(SOCK_DGRAM, &psr_ppriv->sock,
+					  ctx->pkt_rx_ring ?
+					  &psr_ppriv->ring : NULL,
+					  psr_ppriv->common.tdport->ifindex,
+					  htons(ETH_P_ALL), &bfd_fprog, NULL);
+	if (err)
+		return err;
+
+	err = lw_bfd_session_ids_init(bfd_ppriv);
+	if (err)
+		goto close_sock;
+	bfd_ppriv->state = BFD_STATE_DOWN;
+	bfd_ppriv->remote_state = BFD_STATE_DOWN;
+	bfd_ppriv->remote_min_rx = 1;
+	return 0;
+
+close_sock:
+	teamd_packet_ring_teardown(&psr_ppriv->ring);
+	close(psr_ppriv->sock);
+	return err;
+}
+
+static void lw_bfd_sock_close(struct lw_psr_port_priv *psr_ppriv)
+{
+	teamd_packet_ring_teardown(&psr_ppriv->ring);
+	close(psr_ppriv->sock);
+}
+
+static int lw_bfd_load_options(struct teamd_context *ctx,
+			       struct teamd_port *tdport,
+			       struct lw_psr_port_priv *psr_ppriv)
+{
+	struct lw_bfd_port_priv *bfd_ppriv = lw_bfd_ppriv_get(psr_ppriv);
+	struct teamd_config_path_cookie *cpcookie = psr_ppriv->common.cpcookie;
+	const char *host;
+	int err;
+
+	err = teamd_config_string_get(ctx, &host, "@.source_host", cpcookie);
+	if (err) {
+		teamd_log_err("Failed to get \"source_host\" link-watch option.");
+		return -EINVAL;
+	}
+	err = set_in_addr(&bfd_ppriv->src, host);
+	if (err)
+		return err;
+	teamd_log_dbg("source address \"%s\".", str_in_addr(&bfd_ppriv->src));
+
+	err = teamd_config_string_get(ctx, &host, "@.target_host", cpcookie);
+	if (err) {
+		teamd_log_err("Failed to get \"target_host\" link-watch option.");
+		return -EINVAL;
+	}
+	err = set_in_addr(&bfd_ppriv->dst, host);
+	if (err)
+		return err;
+	teamd_log_dbg("target address \"%s\".", str_in_addr(&bfd_ppriv->dst));
+
+	err = teamd_config_bool_get(ctx, &bfd_ppriv->echo, "@.echo", cpcookie);
+	if (err)
+		bfd_ppriv->echo = false;
+	teamd_log_dbg("echo \"%d\".", bfd_ppriv->echo);
+
+	err = teamd_config_bool_get(ctx, &bfd_ppriv->send_always,
+				    "@.send_always", cpcookie);
+	if (err)
+		bfd_ppriv->send_always = false;
+	teamd_log_dbg("send_always \"%d\".", bfd_ppriv->send_always);
+
+	/* Intervals are advertised to the peer, they can't change silently. */
+	if (!timespec_is_zero(&psr_ppriv->interval_max)) {
+		teamd_log_err("\"interval_max\" is not supported by bfd link-watch.");
+		return -EINVAL;
+	}
+
+	/* missed_max is used as Detect Mult */
+	if (psr_ppriv->missed_max < 1 || psr_ppriv->missed_max > 255) {
+		teamd_log_err("\"missed_max\" must be in range 1-255.");
+		return -EINVAL;
+	}
+	return 0;
+}
+
+static int lw_bfd_send(struct lw_psr_port_priv *psr_ppriv)
+{
+	struct lw_bfd_port_priv *bfd_ppriv = lw_bfd_ppriv_get(psr_ppriv);
+	int err;
+
+	if (!(psr_ppriv->common.forced_send || bfd_ppriv->send_always))
+		return 0;
+
+	/* Peer asks us to go at least as slow as its Required Min RX. */
+	if (bfd_ppriv->remote_min_rx &&
+	    ++bfd_ppriv->ctrl_tick >= lw_bfd_ticks(psr_ppriv,
+						   bfd_ppriv->remote_min_rx)) {
+		bfd_ppriv->ctrl_tick = 0;
+		err = lw_bfd_ctrl_send(bfd_ppriv, false);
+		if (err)
+			return err;
+	}
+
+	if (bfd_ppriv->echo_active &&
+	    ++bfd_ppriv->echo_tick >= lw_bfd_ticks(psr_ppriv,
+						   bfd_ppriv->remote_min_echo_rx)) {
+		bfd_ppriv->echo_tick = 0;
+		return lw_bfd_echo_send(bfd_ppriv);
+	}
+	return 0;
+}
+
+static int lw_bfd_ctrl_process(struct lw_bfd_port_priv *bfd_ppriv,
+			       struct bfd_ctrl *ctrl, size_t len,
+			       struct sockaddr_ll *ll_from)
+{
+	enum bfd_state old_state = bfd_ppriv->state;
+	enum bfd_state remote_state;
+	uint32_t your_discr;
+	int err;
+
+	/* Reception checks of RFC 5880 section 6.8.6 */
+	if (ctrl->vers_diag >> 5 != BFD_VERSION ||
+	    ctrl->length < sizeof(*ctrl) || ctrl->length > len ||
+	    !ctrl->detect_mult ||
+	    ctrl->state_flags & (BFD_FLAG_MULTIPOINT | BFD_FLAG_AUTH) ||
+	    !ctrl->my_discr)
+		return 0;
+	your_discr = ntohl(ctrl->your_discr);
+	if (your_discr && your_discr != bfd_ppriv->local_discr)
+		return 0;
+	remote_state = ctrl->state_flags >> 6;
+	if (!your_discr && remote_state != BFD_STATE_DOWN &&
+	    remote_state != BFD_STATE_ADMIN_DOWN)
+		return 0;
+
+	bfd_ppriv->remote_discr = ntohl(ctrl->my_discr);
+	bfd_ppriv->remote_state = remote_state;
+	bfd_ppriv->remote_detect_mult = ctrl->detect_mult;
+	bfd_ppriv->remote_min_tx = ntohl(ctrl->desired_min_tx);
+	bfd_ppriv->remote_min_rx = ntohl(ctrl->required_min_rx);
+	bfd_ppriv->remote_min_echo_rx = ntohl(ctrl->required_min_echo_rx);
+	bfd_now(&bfd_ppriv->last_rx);
+	if (ll_from->sll_halen == ETH_ALEN) {
+		memcpy(bfd_ppriv->peer_hwaddr, ll_from->sll_addr, ETH_ALEN);
+		bfd_ppriv->peer_hwaddr_valid = true;
+	}
+
+	if (remote_state == BFD_STATE_ADMIN_DOWN) {
+		err = lw_bfd_state_set(bfd_ppriv, BFD_STATE_DOWN,
+				       BFD_DIAG_NEIGHBOR_DOWN);
+	} else {
+		switch (bfd_ppriv->state) {
+		case BFD_STATE_DOWN:
+			if (remote_state == BFD_STATE_DOWN)
+				err = lw_bfd_state_set(bfd_ppriv,
+						       BFD_STATE_INIT,
+						       BFD_DIAG_NONE);
+			else if (remote_state == BFD_STATE_INIT)
+				err = lw_bfd_state_set(bfd_ppriv, BFD_STATE_UP,
+						       BFD_DIAG_NONE);
+			else
+				err = 0;
+			break;
+		case BFD_STATE_INIT:
+			if (remote_state == BFD_STATE_INIT ||
+			    remote_state == BFD_STATE_UP)
+				err = lw_bfd_state_set(bfd_ppriv, BFD_STATE_UP,
+						       BFD_DIAG_NONE);
+			else
+				err = 0;
+			break;
+		case BFD_STATE_UP:
+			if (remote_state == BFD_STATE_DOWN)
+				err = lw_bfd_state_set(bfd_ppriv,
+						       BFD_STATE_DOWN,
+						       BFD_DIAG_NEIGHBOR_DOWN);
+			else
+				err = 0;
+			break;
+		default:
+			err = 0;
+		}
+	}
+	if (err)
+		return err;
+
+	if (bfd_ppriv->echo && bfd_ppriv->state == BFD_STATE_UP &&
+	    bfd_ppriv->remote_min_echo_rx && !bfd_ppriv->echo_active) {
+		bfd_ppriv->echo_active = true;
+		bfd_ppriv->echo_tick = 0;
+		bfd_now(&bfd_ppriv->echo_last_rx);
+	} else if (!bfd_ppriv->remote_min_echo_rx) {
+		bfd_ppriv->echo_active = false;
+	}
+
+	/* Answer poll and let the peer know about our state change early. */
+	if (ctrl->state_flags & BFD_FLAG_POLL || bfd_ppriv->state != old_state)
+		return lw_bfd_ctrl_send(bfd_ppriv,
+					ctrl->state_flags & BFD_FLAG_POLL);
+	return 0;
+}
+
+static void lw_bfd_echo_process(struct lw_bfd_port_priv *bfd_ppriv,
+				struct bfd_echo *echo)
+{
+	if (!bfd_ppriv->echo_active ||
+	    ntohl(echo->discr) != bfd_ppriv->local_discr)
+		return;
+	bfd_now(&bfd_ppriv->echo_last_rx);
+}
+
+static int lw_bfd_process(struct teamd_packet *packet, void *priv)
+{
+	struct lw_psr_port_priv *psr_ppriv = priv;
+	struct lw_bfd_port_priv *bfd_ppriv = lw_bfd_ppriv_get(psr_ppriv);
+	unsigned char *buf = packet->data;
+	struct iphdr *iph = packet->data;
+	struct udphdr *udph;
+	size_t len = packet->len;
+	size_t ihl;
+
+	if (len < sizeof(*iph) || iph->version != 4)
+		return 0;
+	ihl = iph->ihl * 4;
+	if (ihl < sizeof(*iph) || len < ihl + sizeof(*udph) ||
+	    ntohs(iph->tot_len) < ihl + sizeof(*udph) ||
+	    ntohs(iph->tot_len) > len)
+		return 0;
+	len = ntohs(iph->tot_len) - ihl - sizeof(*udph);
+	udph = (struct udphdr *) (buf + ihl);
+
+	switch (ntohs(udph->dest)) {
+	case BFD_CTRL_PORT:
+		/* Only packets which were not routed are accepted (RFC 5881). */
+		if (iph->ttl != BFD_TTL ||
+		    iph->saddr != bfd_ppriv->dst.s_addr ||
+		    iph->daddr != bfd_ppriv->src.s_addr ||
+		    len < sizeof(struct bfd_ctrl))
+			return 0;
+		return lw_bfd_ctrl_process(bfd_ppriv,
+					   (struct bfd_ctrl *) (udph + 1),
+					   len, packet->ll_from);
+	case BFD_ECHO_PORT:
+		if (iph->saddr != bfd_ppriv->src.s_addr ||
+		    iph->daddr != bfd_ppriv->src.s_addr ||
+		    len < sizeof(struct bfd_echo))
+			return 0;
+		lw_bfd_echo_process(bfd_ppriv, (struct bfd_echo *) (udph + 1));
+		break;
+	}
+	return 0;
+}
+
+static int lw_bfd_receive(struct lw_psr_port_priv *psr_ppriv)
+{
+	unsigned char buf[128];
+
+	return teamd_packet_recv(psr_ppriv->sock, &psr_ppriv->ring,
+				 buf, sizeof(buf), 1,
+				 lw_bfd_process, psr_ppriv);
+}
+
+static void lw_bfd_period_check(struct lw_psr_port_priv *psr_ppriv)
+{
+	struct lw_bfd_port_priv *bfd_ppriv = lw_bfd_ppriv_get(psr_ppriv);
+	uint32_t interval_us = lw_bfd_interval_us(psr_ppriv);
+	uint64_t detect_time;
+	struct timespec now;
+	int err = 0;
+
+	bfd_now(&now);
+	if (bfd_ppriv->state == BFD_STATE_INIT ||
+	    bfd_ppriv->state == BFD_STATE_UP) {
+		detect_time = (uint64_t) bfd_ppriv->remote_detect_mult *
+			      (interval_us > bfd_ppriv->remote_min_tx ?
+			       interval_us : bfd_ppriv->remote_min_tx);
+		if (bfd_elapsed_us(&now, &bfd_ppriv->last_rx) > detect_time) {
+			bfd_ppriv->remote_discr = 0;
+			bfd_ppriv->remote_min_rx = 1;
+			err = lw_bfd_state_set(bfd_ppriv, BFD_STATE_DOWN,
+					       BFD_DIAG_TIME_EXPIRED);
+		}
+	}
+	if (!err && bfd_ppriv->echo_active) {
+		detect_time = (uint64_t) psr_ppriv->missed_max *
+			      lw_bfd_ticks(psr_ppriv,
+					   bfd_ppriv->remote_min_echo_rx) *
+			      interval_us;
+		if (bfd_elapsed_us(&now, &bfd_ppriv->echo_last_rx) >
+		    detect_time)
+			err = lw_bfd_state_set(bfd_ppriv, BFD_STATE_DOWN,
+					       BFD_DIAG_ECHO_FAILED);
+	}
+	if (err)
+		teamd_log_err("%s: Failed to process BFD session state change.",
+			      psr_ppriv->common.tdport->ifname);
+	psr_ppriv->reply_received = bfd_ppriv->state == BFD_STATE_UP;
+}
+
+static const struct lw_psr_ops lw_psr_ops_bfd = {
+	.sock_open		= lw_bfd_sock_open,
+	.sock_close		= lw_bfd_sock_close,
+	.load_options		= lw_bfd_load_options,
+	.send			= lw_bfd_send,
+	.receive		= lw_bfd_receive,
+	.period_check		= lw_bfd_period_check,
+};
+
+static int lw_bfd_port_added(struct teamd_context *ctx,
+			     struct teamd_port *tdport,
+			     void *priv, void *creator_priv)
+{
+	struct lw_bfd_port_priv *bfd_ppriv = priv;
+	struct lw_psr_port_priv *psr_ppriv = &bfd_ppriv->start.psr;
+
+	psr_ppriv->ops = &lw_psr_ops_bfd;
+	return lw_psr_port_added(ctx, tdport, priv, creator_priv);
+}
+
+static int lw_bfd_state_source_host_get(struct teamd_context *ctx,
+					struct team_state_gsc *gsc,
+					void *priv)
+{
+	struct lw_common_port_priv *common_ppriv = priv;
+	struct lw_psr_port_priv *psr_ppriv = lw_psr_ppriv_get(common_ppriv);
+	struct lw_bfd_port_priv *bfd_ppriv = lw_bfd_ppriv_get(psr_ppriv);
+
+	gsc->data.str_val.ptr = str_in_addr(&bfd_ppriv->src);
+	return 0;
+}
+
+static int lw_bfd_state_target_host_get(struct teamd_context *ctx,
+					struct team_state_gsc *gsc,
+					void *priv)
+{
+	struct lw_common_port_priv *common_ppriv = priv;
+	struct lw_psr_port_priv *psr_ppriv = lw_psr_ppriv_get(common_ppriv);
+	struct lw_bfd_port_priv *bfd_ppriv = lw_bfd_ppriv_get(psr_ppriv);
+
+	gsc->data.str_val.ptr = str_in_addr(&bfd_ppriv->dst);
+	return 0;
+}
+
+static int lw_bfd_state_echo_get(struct teamd_context *ctx,
+				 struct team_state_gsc *gsc,
+				 void *priv)
+{
+	struct lw_common_port_priv *common_ppriv = priv;
+	struct lw_psr_port_priv *psr_ppriv = lw_psr_ppriv_get(common_ppriv);
+	struct lw_bfd_port_priv *bfd_ppriv = lw_bfd_ppriv_get(psr_ppriv);
+
+	gsc->data.bool_val = bfd_ppriv->echo_active;
+	return 0;
+}
+
+static int lw_bfd_state_send_always_get(struct teamd_context *ctx,
+					struct team_state_gsc *gsc,
+					void *priv)
+{
+	struct lw_common_port_priv *common_ppriv = priv;
+	struct lw_psr_port_priv *psr_ppriv = lw_psr_ppriv_get(common_ppriv);
+	struct lw_bfd_port_priv *bfd_ppriv = lw_bfd_ppriv_get(psr_ppriv);
+
+	gsc->data.bool_val = bfd_ppriv->send_always;
+	return 0;
+}
+
+static int lw_bfd_state_session_state_get(struct teamd_context *ctx,
+					  struct team_state_gsc *gsc,
+					  void *priv)
+{
+	struct lw_common_port_priv *common_ppriv = priv;
+	struct lw_psr_port_priv *psr_ppriv = lw_psr_ppriv_get(common_ppriv);
+	struct lw_bfd_port_priv *bfd_ppriv = lw_bfd_ppriv_get(psr_ppriv);
+
+	gsc->data.str_val.ptr = bfd_state_names[bfd_ppriv->state];
+	return 0;
+}
+
+static int lw_bfd_state_remote_state_get(struct teamd_context *ctx,
+					 struct team_state_gsc *gsc,
+					 void *priv)
+{
+	struct lw_common_port_priv *common_ppriv = priv;
+	struct lw_psr_port_priv *psr_ppriv = lw_psr_ppriv_get(common_ppriv);
+	struct lw_bfd_port_priv *bfd_ppriv = lw_bfd_ppriv_get(psr_ppriv);
+
+	gsc->data.str_val.ptr = bfd_state_names[bfd_ppriv->remote_state];
+	return 0;
+}
+
+static int lw_bfd_state_diag_get(struct teamd_context *ctx,
+				 struct team_state_gsc *gsc,
+				 void *priv)
+{
+	struct lw_common_port_priv *common_ppriv = priv;
+	struct lw_psr_port_priv *psr_ppriv = lw_psr_ppriv_get(common_ppriv);
+	struct lw_bfd_port_priv *bfd_ppriv = lw_bfd_ppriv_get(psr_ppriv);
+
+	gsc->data.int_val = bfd_ppriv->diag;
+	return 0;
+}
+
+static const struct teamd_state_val lw_bfd_state_vals[] = {
+	{
+		.subpath = "source_host",
+		.type = TEAMD_STATE_ITEM_TYPE_STRING,
+		.getter = lw_bfd_state_source_host_get,
+	},
+	{
+		.subpath = "target_host",
+		.type = TEAMD_STATE_ITEM_TYPE_STRING,
+		.getter = lw_bfd_state_target_host_get,
+	},
+	{
+		.subpath = "interval",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = lw_psr_state_interval_get,
+	},
+	{
+		.subpath = "init_wait",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = lw_psr_state_init_wait_get,
+	},
+	{
+		.subpath = "missed_max",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = lw_psr_state_missed_max_get,
+	},
+	{
+		.subpath = "echo",
+		.type = TEAMD_STATE_ITEM_TYPE_BOOL,
+		.getter = lw_bfd_state_echo_get,
+	},
+	{
+		.subpath = "send_always",
+		.type = TEAMD_STATE_ITEM_TYPE_BOOL,
+		.getter = lw_bfd_state_send_always_get,
+	},
+	{
+		.subpath = "session_state",
+		.type = TEAMD_STATE_ITEM_TYPE_STRING,
+		.getter = lw_bfd_state_session_state_get,
+	},
+	{
+		.subpath = "remote_state",
+		.type = TEAMD_STATE_ITEM_TYPE_STRING,
+		.getter = lw_bfd_state_remote_state_get,
+	},
+	{
+		.subpath = "diag",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = lw_bfd_state_diag_get,
+	},
+};
+
+const struct teamd_link_watch teamd_link_watch_bfd = {
+	.name			= "bfd",
+	.state_vg		= {
+		.vals		= lw_bfd_state_vals,
+		.vals_count	= ARRAY_SIZE(lw_bfd_state_vals),
+	},
+	.port_priv = {
+		.init		= lw_bfd_port_added,
+		.fini		= lw_psr_port_removed,
+		.priv_size	= sizeof(struct lw_bfd_port_priv),
+	},
+};
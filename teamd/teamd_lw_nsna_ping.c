@@ -128,6 +128,7 @@ static const struct sock_fprog na_fprog = {
 static int lw_nsnap_sock_open(struct lw_psr_port_priv *psr_ppriv)
 {
 	struct lw_nsnap_port_priv *nsnap_ppriv = lw_nsnap_ppriv_get(psr_ppriv);
+	struct teamd_context *ctx = psr_ppriv->common.ctx;
 	int err;
 
 	/*
@@ -136,9 +137,11 @@ static int lw_nsnap_sock_open(struct lw_psr_port_priv *psr_ppriv)
 	 * deliver incoming ICMP6 packet on inactive ports into userspace.
 	 * So we use packet socket to get these packets.
 	 */
-	err = teamd_packet_sock_open(&psr_ppriv->sock,
-				     psr_ppriv->common.tdport->ifindex,
-				     htons(ETH_P_ALL), &na_fprog, NULL);
+	err = teamd_packet_sock_open_ring(SOCK_DGRAM, &psr_ppriv->sock,
+					  ctx->pkt_rx_ring ?
+					  &psr_ppriv->ring : NULL,
+					  psr_ppriv->common.tdport->ifindex,
+					  htons(ETH_P_ALL), &na_fprog, NULL);
 	if (err)
 		return err;
 	err = icmp6_sock_open(&nsnap_ppriv->tx_sock);
@@ -146,6 +149,7 @@ static int lw_nsnap_sock_open(struct lw_psr_port_priv *psr_ppriv)
 		goto close_packet_sock;
 	return 0;
 close_packet_sock:
+	teamd_packet_ring_teardown(&psr_ppriv->ring);
 	close(psr_ppriv->sock);
 	return err;
 }
@@ -155,6 +159,7 @@ static void lw_nsnap_sock_close(struct lw_psr_port_priv *psr_ppriv)
 	struct lw_nsnap_port_priv *nsnap_ppriv = lw_nsnap_ppriv_get(psr_ppriv);
 
 	close(nsnap_ppriv->tx_sock);
+	teamd_packet_ring_teardown(&psr_ppriv->ring);
 	close(psr_ppriv->sock);
 }
 
@@ -234,37 +239,43 @@ struct na_packet {
 	unsigned char			hwaddr[ETH_ALEN];
 };
 
-static int lw_nsnap_receive(struct lw_psr_port_priv *psr_ppriv)
+static int lw_nsnap_process(struct teamd_packet *packet, void *priv)
 {
+	struct lw_psr_port_priv *psr_ppriv = priv;
 	struct lw_nsnap_port_priv *nsnap_ppriv = lw_nsnap_ppriv_get(psr_ppriv);
-	struct na_packet nap;
-	struct sockaddr_ll ll_from;
-	int err;
+	struct na_packet *nap = packet->data;
 
-	err = teamd_recvfrom(psr_ppriv->sock, &nap, sizeof(nap), 0,
-			     (struct sockaddr *) &ll_from, sizeof(ll_from));
-	if (err <= 0)
-		return err;
+	if (packet->len < sizeof(*nap))
+		return 0;
 
 	/* check IPV6 header */
-	if ((nap.ip6h.ip6_vfc & 0xf0) != 0x60 /* IPV6 */ ||
-	    nap.ip6h.ip6_plen != htons(sizeof(nap) - sizeof(nap.ip6h)) ||
-	    nap.ip6h.ip6_nxt != IPPROTO_ICMPV6 ||
-	    nap.ip6h.ip6_hlim != 255 /* Do not route */)
+	if ((nap->ip6h.ip6_vfc & 0xf0) != 0x60 /* IPV6 */ ||
+	    nap->ip6h.ip6_plen != htons(sizeof(*nap) - sizeof(nap->ip6h)) ||
+	    nap->ip6h.ip6_nxt != IPPROTO_ICMPV6 ||
+	    nap->ip6h.ip6_hlim != 255 /* Do not route */)
 		return 0;
 
 	/* check ICMP6 header */
-	if (nap.nah.nd_na_type != ND_NEIGHBOR_ADVERT ||
-	    memcmp(&nap.nah.nd_na_target, &nsnap_ppriv->dst.sin6_addr,
+	if (nap->nah.nd_na_type != ND_NEIGHBOR_ADVERT ||
+	    memcmp(&nap->nah.nd_na_target, &nsnap_ppriv->dst.sin6_addr,
 		   sizeof(struct in6_addr)) ||
-	    nap.opt.nd_opt_type != ND_OPT_TARGET_LINKADDR ||
-	    nap.opt.nd_opt_len != 1 /* 8 bytes */)
+	    nap->opt.nd_opt_type != ND_OPT_TARGET_LINKADDR ||
+	    nap->opt.nd_opt_len != 1 /* 8 bytes */)
 		return 0;
 
 	psr_ppriv->reply_received = true;
 	return 0;
 }
 
+static int lw_nsnap_receive(struct lw_psr_port_priv *psr_ppriv)
+{
+	struct na_packet nap;
+
+	return teamd_packet_recv(psr_ppriv->sock, &psr_ppriv->ring,
+				 &nap, sizeof(nap), 1,
+				 lw_nsnap_process, psr_ppriv);
+}
+
 static const struct lw_psr_ops lw_psr_ops_nsnap = {
 	.sock_open		= lw_nsnap_sock_open,
 	.sock_close		= lw_nsnap_sock_close,
@@ -306,6 +317,16 @@ static const struct teamd_state_val lw_nsnap_state_vals[] = {
 		.type = TEAMD_STATE_ITEM_TYPE_INT,
 		.getter = lw_psr_state_interval_get,
 	},
+	{
+		.subpath = "interval_max",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = lw_psr_state_interval_max_get,
+	},
+	{
+		.subpath = "effective_interval",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = lw_psr_state_effective_interval_get,
+	},
 	{
 		.subpath = "init_wait",
 		.type = TEAMD_STATE_ITEM_TYPE_INT,
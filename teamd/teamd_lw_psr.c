@@ -29,8 +29,41 @@
 
 static const struct timespec lw_psr_default_init_wait = { 0, 1 };
 #define LW_PSR_DEFAULT_MISSED_MAX 3
+/* Consecutive replies needed to double adaptive interval */
+#define LW_PSR_BACKOFF_REPLIES 3
 
 #define LW_PERIODIC_CB_NAME "lw_periodic"
+
+/*
+ * In adaptive mode the interval is doubled up to interval_max while
+ * replies keep coming and it is set back to interval on the first miss,
+ * so detection is slowed down by at most one long interval.
+ */
+static int lw_psr_interval_adapt(struct teamd_context *ctx,
+				 struct lw_psr_port_priv *psr_ppriv)
+{
+	struct timespec *cur = &psr_ppriv->cur_interval;
+	int cur_ms = timespec_to_ms(cur);
+	int max_ms = timespec_to_ms(&psr_ppriv->interval_max);
+
+	if (!max_ms)
+		return 0;
+	if (!psr_ppriv->reply_received) {
+		psr_ppriv->replied = 0;
+		if (cur_ms == timespec_to_ms(&psr_ppriv->interval))
+			return 0;
+		*cur = psr_ppriv->interval;
+	} else {
+		if (cur_ms == max_ms ||
+		    ++psr_ppriv->replied < LW_PSR_BACKOFF_REPLIES)
+			return 0;
+		psr_ppriv->replied = 0;
+		ms_to_timespec(cur, cur_ms * 2 < max_ms ? cur_ms * 2 : max_ms);
+	}
+	return teamd_loop_callback_timer_set_aligned(ctx, LW_PERIODIC_CB_NAME,
+						     psr_ppriv, cur, cur);
+}
+
 static int lw_psr_callback_periodic(struct teamd_context *ctx, int events, void *priv)
 {
 	struct lw_common_port_priv *common_ppriv = priv;
@@ -39,6 +72,8 @@ static int lw_psr_callback_periodic(struct teamd_context *ctx, int events, void
 	bool link_up = common_ppriv->link_up;
 	int err;
 
+	if (psr_ppriv->ops->period_check)
+		psr_ppriv->ops->period_check(psr_ppriv);
 	if (psr_ppriv->reply_received) {
 		link_up = true;
 		psr_ppriv->missed = 0;
@@ -53,6 +88,9 @@ static int lw_psr_callback_periodic(struct teamd_context *ctx, int events, void
 	}
 	err = teamd_link_watch_check_link_up(ctx, tdport,
 					     common_ppriv, link_up);
+	if (err)
+		return err;
+	err = lw_psr_interval_adapt(ctx, psr_ppriv);
 	if (err)
 		return err;
 	psr_ppriv->reply_received = false;
@@ -83,6 +121,17 @@ static int lw_psr_load_options(struct teamd_context *ctx,
 	}
 	teamd_log_dbg("interval \"%d\".", tmp);
 	ms_to_timespec(&psr_ppriv->interval, tmp);
+	psr_ppriv->cur_interval = psr_ppriv->interval;
+
+	err = teamd_config_int_get(ctx, &tmp, "@.interval_max", cpcookie);
+	if (!err) {
+		if (tmp < timespec_to_ms(&psr_ppriv->interval)) {
+			teamd_log_err("\"interval_max\" must not be lower than \"interval\".");
+			return -EINVAL;
+		}
+		teamd_log_dbg("interval_max \"%d\".", tmp);
+		ms_to_timespec(&psr_ppriv->interval_max, tmp);
+	}
 
 	err = teamd_config_int_get(ctx, &tmp, "@.init_wait", cpcookie);
 	if (!err)
@@ -138,24 +187,38 @@ int lw_psr_port_added(struct teamd_context *ctx, struct teamd_port *tdport,
 		return err;
 	}
 
-	err = teamd_loop_callback_fd_add(ctx, LW_SOCKET_CB_NAME, psr_ppriv,
-					 lw_psr_callback_socket,
-					 psr_ppriv->sock,
-					 TEAMD_LOOP_FD_EVENT_READ);
-	if (err) {
-		teamd_log_err("Failed add socket callback.");
-		goto close_sock;
+	/* Socket may be shared, in that case replies are received elsewhere. */
+	if (psr_ppriv->sock != -1) {
+		err = teamd_loop_callback_fd_add(ctx, LW_SOCKET_CB_NAME,
+						 psr_ppriv,
+						 lw_psr_callback_socket,
+						 psr_ppriv->sock,
+						 TEAMD_LOOP_FD_EVENT_READ);
+		if (err) {
+			teamd_log_err("Failed add socket callback.");
+			goto close_sock;
+		}
 	}
 
-	err = teamd_loop_callback_timer_add_set(ctx, LW_PERIODIC_CB_NAME,
-						psr_ppriv,
-						lw_psr_callback_periodic,
-						&psr_ppriv->interval,
-						&psr_ppriv->init_wait);
+	/*
+	 * Align probes to interval boundary so probes of all ports having
+	 * the same interval are sent in one batch.
+	 */
+	err = teamd_loop_callback_timer_add(ctx, LW_PERIODIC_CB_NAME,
+					    psr_ppriv,
+					    lw_psr_callback_periodic);
 	if (err) {
 		teamd_log_err("Failed add callback timer");
 		goto socket_callback_del;
 	}
+	err = teamd_loop_callback_timer_set_aligned(ctx, LW_PERIODIC_CB_NAME,
+						    psr_ppriv,
+						    &psr_ppriv->cur_interval,
+						    &psr_ppriv->init_wait);
+	if (err) {
+		teamd_log_err("Failed to set callback timer");
+		goto periodic_callback_del;
+	}
 
 	err = team_set_port_user_linkup_enabled(ctx->th, tdport->ifindex, true);
 	if (err) {
@@ -164,7 +227,8 @@ int lw_psr_port_added(struct teamd_context *ctx, struct teamd_port *tdport,
 		goto periodic_callback_del;
 	}
 
-	teamd_loop_callback_enable(ctx, LW_SOCKET_CB_NAME, psr_ppriv);
+	if (psr_ppriv->sock != -1)
+		teamd_loop_callback_enable(ctx, LW_SOCKET_CB_NAME, psr_ppriv);
 	teamd_loop_callback_enable(ctx, LW_PERIODIC_CB_NAME, psr_ppriv);
 	return 0;
 
@@ -230,3 +294,25 @@ int lw_psr_state_missed_get(struct teamd_context *ctx,
 	gsc->data.int_val = psr_ppriv->missed;
 	return 0;
 }
+
+int lw_psr_state_interval_max_get(struct teamd_context *ctx,
+				  struct team_state_gsc *gsc,
+				  void *priv)
+{
+	struct lw_common_port_priv *common_ppriv = priv;
+	struct lw_psr_port_priv *psr_ppriv = lw_psr_ppriv_get(common_ppriv);
+
+	gsc->data.int_val = timespec_to_ms(&psr_ppriv->interval_max);
+	return 0;
+}
+
+int lw_psr_state_effective_interval_get(struct teamd_context *ctx,
+					struct team_state_gsc *gsc,
+					void *priv)
+{
+	struct lw_common_port_priv *common_ppriv = priv;
+	struct lw_psr_port_priv *psr_ppriv = lw_psr_ppriv_get(common_ppriv);
+
+	gsc->data.int_val = timespec_to_ms(&psr_ppriv->cur_interval);
+	return 0;
+}
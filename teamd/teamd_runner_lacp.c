@@ -31,6 +31,8 @@
 #include <team.h>
 #include <private/misc.h>
 #include <net/ethernet.h>
+#include <linux/if_packet.h>
+#include <sys/epoll.h>
 
 #include "teamd.h"
 #include "teamd_config.h"
@@ -110,6 +112,44 @@ static bool lacpdu_check(struct lacpdu *lacpdu)
 	return true;
 }
 
+/*
+ * Packet format for Marker PDU described in
+ * IEEE Std 802.3ad-2000 (43.5.3.2)
+ */
+
+#define MARKER_TLV_INFO		0x01
+#define MARKER_TLV_RESPONSE	0x02
+
+struct marker_pdu {
+	struct ether_header	hdr;
+	uint8_t			subtype;
+	uint8_t			version_number;
+	uint8_t			tlv_type;
+	uint8_t			info_len;
+	uint16_t		requester_port;
+	uint8_t			requester_system[ETH_ALEN];
+	uint32_t		requester_transaction_id;
+	uint8_t			__reserved1[2];
+	uint8_t			terminator_tlv_type;
+	uint8_t			terminator_info_len;
+	uint8_t			__reserved2[90];
+} __attribute__((__packed__));
+
+static bool marker_pdu_check(struct marker_pdu *marker)
+{
+	if (marker->subtype		!= 0x02 ||
+	    marker->info_len		!= 0x10 ||
+	    marker->terminator_info_len	!= 0x00)
+		return false;
+	return true;
+}
+
+/* Both PDUs have the same length, subtype tells which one it is. */
+union slow_pdu {
+	struct lacpdu		lacpdu;
+	struct marker_pdu	marker;
+};
+
 enum lacp_agg_select_policy {
 	LACP_AGG_SELECT_LACP_PRIO = 0,
 	LACP_AGG_SELECT_LACP_PRIO_STABLE = 1,
@@ -127,10 +167,19 @@ static const char *lacp_agg_select_policy_names_list[] = {
 
 struct lacp_port;
 
+/* Maximum number of LACPDUs passed to a single sendmmsg() call */
+#define LACP_TX_BATCH 32
+
 struct lacp {
 	struct teamd_context *ctx;
 	struct lacp_port *selected_agg_lead; /* leading port of selected aggregator */
 	bool carrier_up;
+	int tx_sock; /* shared by all ports, -1 if per-port sockets are used */
+	int rx_epfd; /* polls all port sockets if shared_socket is set, otherwise -1 */
+	struct list_item tx_list; /* ports having periodic LACPDU due */
+	struct teamd_workq tx_workq;
+	struct mmsghdr tx_msgs[LACP_TX_BATCH];
+	struct iovec tx_iovs[LACP_TX_BATCH];
 	struct {
 		bool active;
 #define		LACP_CFG_DFLT_ACTIVE true
@@ -138,10 +187,16 @@ struct lacp {
 #define		LACP_CFG_DFLT_SYS_PRIO 0xffff
 		bool fast_rate;
 #define		LACP_CFG_DFLT_FAST_RATE false
+		int fast_rate_interval; /* in ms */
+#define		LACP_CFG_DFLT_FAST_RATE_INTERVAL 1000
+		int timeout_mul;
+#define		LACP_CFG_DFLT_TIMEOUT_MUL 3
 		int min_ports;
 #define		LACP_CFG_DFLT_MIN_PORTS 1
 		enum lacp_agg_select_policy agg_select_policy;
 #define		LACP_CFG_DFLT_AGG_SELECT_POLICY LACP_AGG_SELECT_LACP_PRIO
+		bool shared_socket;
+#define		LACP_CFG_DFLT_SHARED_SOCKET false
 	} cfg;
 	struct teamd_balancer *tb;
 };
@@ -165,6 +220,10 @@ struct lacp_port {
 	struct teamd_port *tdport;
 	struct lacp *lacp;
 	int sock;
+	struct teamd_packet_ring ring;
+	struct sockaddr_ll tx_addr; /* destination for tx_sock */
+	struct lacpdu tx_pdu; /* preformatted, refreshed before each send */
+	struct list_item tx_list;
 	struct lacpdu_info actor;
 	struct lacpdu_info partner;
 	struct lacpdu_info __partner_last; /* last state before update */
@@ -272,6 +331,30 @@ static int lacp_load_config(struct teamd_context *ctx, struct lacp *lacp)
 		lacp->cfg.fast_rate = LACP_CFG_DFLT_FAST_RATE;
 	teamd_log_dbg("Using fast_rate \"%d\".", lacp->cfg.fast_rate);
 
+	err = teamd_config_int_get(ctx, &tmp, "$.runner.fast_rate_interval");
+	if (err) {
+		lacp->cfg.fast_rate_interval = LACP_CFG_DFLT_FAST_RATE_INTERVAL;
+	} else if (tmp < 1 || tmp > LACP_CFG_DFLT_FAST_RATE_INTERVAL) {
+		teamd_log_err("\"fast_rate_interval\" value is out of its limits.");
+		return -EINVAL;
+	} else {
+		lacp->cfg.fast_rate_interval = tmp;
+	}
+	teamd_log_dbg("Using fast_rate_interval \"%d\".",
+		      lacp->cfg.fast_rate_interval);
+
+	err = teamd_config_int_get(ctx, &tmp, "$.runner.timeout_multiplier");
+	if (err) {
+		lacp->cfg.timeout_mul = LACP_CFG_DFLT_TIMEOUT_MUL;
+	} else if (tmp < 2 || tmp > UCHAR_MAX) {
+		teamd_log_err("\"timeout_multiplier\" value is out of its limits.");
+		return -EINVAL;
+	} else {
+		lacp->cfg.timeout_mul = tmp;
+	}
+	teamd_log_dbg("Using timeout_multiplier \"%d\".",
+		      lacp->cfg.timeout_mul);
+
 	err = teamd_config_int_get(ctx, &tmp, "$.runner.min_ports");
 	if (err) {
 		lacp->cfg.min_ports = LACP_CFG_DFLT_MIN_PORTS;
@@ -294,6 +377,12 @@ static int lacp_load_config(struct teamd_context *ctx, struct lacp *lacp)
 	}
 	teamd_log_dbg("Using agg_select_policy \"%s\".",
 		      lacp_get_agg_select_policy_name(lacp));
+
+	err = teamd_config_bool_get(ctx, &lacp->cfg.shared_socket,
+				    "$.runner.shared_socket");
+	if (err)
+		lacp->cfg.shared_socket = LACP_CFG_DFLT_SHARED_SOCKET;
+	teamd_log_dbg("Using shared_socket \"%d\".", lacp->cfg.shared_socket);
 	return 0;
 }
 
@@ -786,26 +875,26 @@ static int slow_addr_del(struct lacp_port *lacp_port)
 	return __slow_addr_add_del(lacp_port, false);
 }
 
-/* Values are in ms */
-#define LACP_PERIODIC_SHORT 1000
+/*
+ * Values are in ms. Short periodic interval is configurable by
+ * "fast_rate_interval", 1000ms by default.
+ */
 #define LACP_PERIODIC_LONG 30000
 
-/* time = periodic_interval * LACP_PERIODIC_MUL */
-#define LACP_PERIODIC_MUL 3
-
 #define LACP_SOCKET_CB_NAME "lacp_socket"
 #define LACP_PERIODIC_CB_NAME "lacp_periodic"
 #define LACP_TIMEOUT_CB_NAME "lacp_timeout"
 
 static int lacp_port_timeout_set(struct lacp_port *lacp_port, bool fast_forced)
 {
+	struct lacp *lacp = lacp_port->lacp;
 	int err;
 	struct timespec ts;
 	int ms;
 
-	ms = fast_forced || lacp_port->lacp->cfg.fast_rate ?
-					LACP_PERIODIC_SHORT: LACP_PERIODIC_LONG;
-	ms *= LACP_PERIODIC_MUL;
+	ms = fast_forced || lacp->cfg.fast_rate ?
+				lacp->cfg.fast_rate_interval : LACP_PERIODIC_LONG;
+	ms *= lacp->cfg.timeout_mul;
 	ms_to_timespec(&ts, ms);
 	err = teamd_loop_callback_timer_set(lacp_port->ctx,
 					    LACP_TIMEOUT_CB_NAME,
@@ -827,11 +916,16 @@ static int lacp_port_periodic_set(struct lacp_port *lacp_port)
 	fast_on = lacp_port->partner.state & INFO_STATE_LACP_TIMEOUT;
 	teamd_log_dbg("%s: Setting periodic timer to \"%s\".",
 		      lacp_port->tdport->ifname, fast_on ? "fast": "slow");
-	ms = fast_on ? LACP_PERIODIC_SHORT: LACP_PERIODIC_LONG;
+	ms = fast_on ? lacp_port->lacp->cfg.fast_rate_interval :
+		       LACP_PERIODIC_LONG;
 	ms_to_timespec(&ts, ms);
-	err = teamd_loop_callback_timer_set(lacp_port->ctx,
-					    LACP_PERIODIC_CB_NAME,
-					    lacp_port, &ts, NULL);
+	/*
+	 * Align the timers so ports with the same rate expire together
+	 * and their LACPDUs can be flushed in one batch.
+	 */
+	err = teamd_loop_callback_timer_set_aligned(lacp_port->ctx,
+						    LACP_PERIODIC_CB_NAME,
+						    lacp_port, &ts, NULL);
 	if (err) {
 		teamd_log_err("Failed to set periodic timer.");
 		return err;
@@ -1026,67 +1120,195 @@ static int lacp_port_link_update(struct lacp_port *lacp_port)
 	return 0;
 }
 
-static int lacpdu_send(struct lacp_port *lacp_port)
+static void lacp_port_tx_init(struct lacp_port *lacp_port)
+{
+	struct sockaddr_ll *ll_slow = &lacp_port->tx_addr;
+	struct lacpdu *lacpdu = &lacp_port->tx_pdu;
+
+	memset(ll_slow, 0, sizeof(*ll_slow));
+	ll_slow->sll_family = AF_PACKET;
+	ll_slow->sll_ifindex = lacp_port->tdport->ifindex;
+	ll_slow->sll_protocol = htons(ETH_P_SLOW);
+	ll_slow->sll_halen = ETH_ALEN;
+	memcpy(ll_slow->sll_addr, slow_addr, ETH_ALEN);
+
+	lacpdu_init(lacpdu);
+	memcpy(lacpdu->hdr.ether_dhost, slow_addr, ETH_ALEN);
+	lacpdu->hdr.ether_type = htons(ETH_P_SLOW);
+	list_init(&lacp_port->tx_list);
+}
+
+/* Returns false in case no LACPDU should be sent at the moment. */
+static bool lacpdu_build(struct lacp_port *lacp_port)
 {
-	struct lacpdu lacpdu;
-	struct sockaddr_ll ll_my;
-	struct sockaddr_ll ll_slow;
+	struct lacpdu *lacpdu = &lacp_port->tx_pdu;
 	char *hwaddr;
 	unsigned char hwaddr_len;
-	int err;
 	bool admin_state;
 
 	admin_state = team_get_ifinfo_admin_state(lacp_port->ctx->ifinfo);
 	if (!admin_state)
-		return 0;
-
-	err = teamd_getsockname_hwaddr(lacp_port->sock, &ll_my, 0);
-	if (err)
-		return err;
-	ll_slow = ll_my;
-	memcpy(ll_slow.sll_addr, slow_addr, ll_slow.sll_halen);
+		return false;
 
 	memcpy(lacp_port->actor.system, lacp_port->ctx->hwaddr, ETH_ALEN);
 
 	hwaddr = team_get_ifinfo_orig_hwaddr(lacp_port->tdport->team_ifinfo);
 	hwaddr_len = team_get_ifinfo_orig_hwaddr_len(lacp_port->tdport->team_ifinfo);
 	if (hwaddr_len != ETH_ALEN)
+		return false;
+
+	lacpdu->actor = lacp_port->actor;
+	lacpdu->partner = lacp_port->partner;
+	memcpy(lacpdu->hdr.ether_shost, hwaddr, hwaddr_len);
+	return true;
+}
+
+static int lacp_port_send(struct lacp_port *lacp_port,
+			  const void *buf, size_t len)
+{
+	int tx_sock = lacp_port->lacp->tx_sock;
+
+	if (tx_sock == -1)
+		return teamd_send(lacp_port->sock, buf, len, 0);
+	return teamd_sendto(tx_sock, buf, len, 0,
+			    (struct sockaddr *) &lacp_port->tx_addr,
+			    sizeof(lacp_port->tx_addr));
+}
+
+static int lacpdu_send(struct lacp_port *lacp_port)
+{
+	/* Whatever was queued is superseded by this one. */
+	if (!list_empty(&lacp_port->tx_list)) {
+		list_del(&lacp_port->tx_list);
+		list_init(&lacp_port->tx_list);
+	}
+
+	if (!lacpdu_build(lacp_port))
 		return 0;
+	return lacp_port_send(lacp_port, &lacp_port->tx_pdu,
+			      sizeof(lacp_port->tx_pdu));
+}
 
-	lacpdu_init(&lacpdu);
-	lacpdu.actor = lacp_port->actor;
-	lacpdu.partner = lacp_port->partner;
-	memcpy(lacpdu.hdr.ether_shost, hwaddr, hwaddr_len);
-	memcpy(lacpdu.hdr.ether_dhost, ll_slow.sll_addr, ll_slow.sll_halen);
-	lacpdu.hdr.ether_type = htons(ETH_P_SLOW);
+/* Skips the message which failed and sends the rest, returns the first
+ * error which is not caused by the port being down.
+ */
+static int lacp_tx_msgs_send(struct lacp *lacp, unsigned int count)
+{
+	unsigned int i = 0;
+	int first_err = 0;
+	int ret;
 
-	err = teamd_send(lacp_port->sock, &lacpdu, sizeof(lacpdu), 0);
-	return err;
+	while (i < count) {
+		ret = sendmmsg(lacp->tx_sock, &lacp->tx_msgs[i], count - i, 0);
+		if (ret == -1) {
+			switch(errno) {
+			case EINTR:
+				continue;
+			case ENETDOWN:
+			case ENETUNREACH:
+			case EADDRNOTAVAIL:
+			case ENXIO:
+				break;
+			default:
+				teamd_log_err("sendmmsg failed.");
+				if (!first_err)
+					first_err = -errno;
+			}
+			i++;
+			continue;
+		}
+		i += ret;
+	}
+	return first_err;
 }
 
-static int lacpdu_recv(struct lacp_port *lacp_port)
+static void lacp_tx_msg_fill(struct lacp *lacp, unsigned int i,
+			     struct lacp_port *lacp_port)
+{
+	struct msghdr *msg = &lacp->tx_msgs[i].msg_hdr;
+
+	lacp->tx_iovs[i].iov_base = &lacp_port->tx_pdu;
+	lacp->tx_iovs[i].iov_len = sizeof(lacp_port->tx_pdu);
+	memset(msg, 0, sizeof(*msg));
+	msg->msg_name = &lacp_port->tx_addr;
+	msg->msg_namelen = sizeof(lacp_port->tx_addr);
+	msg->msg_iov = &lacp->tx_iovs[i];
+	msg->msg_iovlen = 1;
+}
+
+/*
+ * Sends LACPDUs of all ports queued by their periodic timers. As
+ * the timers are aligned, this usually covers all ports with the same rate.
+ */
+static int lacp_tx_flush(struct teamd_context *ctx, struct teamd_workq *workq)
 {
-	struct lacpdu lacpdu;
-	struct sockaddr_ll ll_from;
+	struct lacp *lacp = get_container(workq, struct lacp, tx_workq);
+	struct lacp_port *lacp_port;
+	struct lacp_port *tmp;
+	unsigned int count = 0;
+	int first_err = 0;
 	int err;
 
-	err = teamd_recvfrom(lacp_port->sock, &lacpdu, sizeof(lacpdu), 0,
-			     (struct sockaddr *) &ll_from, sizeof(ll_from));
-	if (err <= 0)
-		return err;
+	/* Failure of one port must not hold back LACPDUs of the others */
+	list_for_each_node_entry_safe(lacp_port, tmp, &lacp->tx_list, tx_list) {
+		list_del(&lacp_port->tx_list);
+		list_init(&lacp_port->tx_list);
+		if (!lacpdu_build(lacp_port))
+			continue;
+		if (lacp->tx_sock == -1) {
+			err = teamd_send(lacp_port->sock, &lacp_port->tx_pdu,
+					 sizeof(lacp_port->tx_pdu), 0);
+			if (err) {
+				teamd_log_err("%s: Failed to send LACPDU.",
+					      lacp_port->tdport->ifname);
+				if (!first_err)
+					first_err = err;
+			}
+			continue;
+		}
+		lacp_tx_msg_fill(lacp, count++, lacp_port);
+		if (count == LACP_TX_BATCH) {
+			err = lacp_tx_msgs_send(lacp, count);
+			if (err && !first_err)
+				first_err = err;
+			count = 0;
+		}
+	}
+	if (count) {
+		err = lacp_tx_msgs_send(lacp, count);
+		if (err && !first_err)
+			first_err = err;
+	}
+	return first_err;
+}
+
+static void lacpdu_send_queue(struct lacp_port *lacp_port)
+{
+	struct lacp *lacp = lacp_port->lacp;
+
+	if (!list_empty(&lacp_port->tx_list))
+		return;
+	list_add_tail(&lacp->tx_list, &lacp_port->tx_list);
+	teamd_workq_schedule_work(lacp->ctx, &lacp->tx_workq);
+}
+
+static int lacpdu_process(struct lacp_port *lacp_port,
+			  struct lacpdu *lacpdu)
+{
+	int err;
 
 	if (!teamd_port_present(lacp_port->ctx, lacp_port->tdport))
 		return 0;
 
-	if (!lacpdu_check(&lacpdu)) {
+	if (!lacpdu_check(lacpdu)) {
 		teamd_log_warn("malformed LACP PDU came.");
 		return 0;
 	}
 
 	/* Check if we have correct info about the other side */
-	if (memcmp(&lacpdu.actor, &lacp_port->partner,
+	if (memcmp(&lacpdu->actor, &lacp_port->partner,
 		   sizeof(struct lacpdu_info))) {
-		lacp_port->partner = lacpdu.actor;
+		lacp_port->partner = lacpdu->actor;
 		err = lacp_port_partner_update(lacp_port);
 		if (err)
 			return err;
@@ -1101,7 +1323,7 @@ static int lacpdu_recv(struct lacp_port *lacp_port)
 
 	/* Check if the other side has correct info about us */
 	if (!lacp_port->periodic_on &&
-	    memcmp(&lacpdu.partner, &lacp_port->actor,
+	    memcmp(&lacpdu->partner, &lacp_port->actor,
 		   sizeof(struct lacpdu_info))) {
 		err = lacpdu_send(lacp_port);
 		if (err)
@@ -1116,6 +1338,115 @@ static int lacpdu_recv(struct lacp_port *lacp_port)
 	return 0;
 }
 
+/* Marker Responder, see 43.5.4.2 */
+static int marker_pdu_respond(struct lacp_port *lacp_port,
+			      struct marker_pdu *marker)
+{
+	char *hwaddr;
+	unsigned char hwaddr_len;
+
+	hwaddr = team_get_ifinfo_orig_hwaddr(lacp_port->tdport->team_ifinfo);
+	hwaddr_len = team_get_ifinfo_orig_hwaddr_len(lacp_port->tdport->team_ifinfo);
+	if (hwaddr_len != ETH_ALEN)
+		return 0;
+
+	marker->tlv_type = MARKER_TLV_RESPONSE;
+	memcpy(marker->hdr.ether_shost, hwaddr, hwaddr_len);
+	memcpy(marker->hdr.ether_dhost, slow_addr, ETH_ALEN);
+	return lacp_port_send(lacp_port, marker, sizeof(*marker));
+}
+
+static int marker_pdu_process(struct lacp_port *lacp_port,
+			      struct marker_pdu *marker)
+{
+	if (!teamd_port_present(lacp_port->ctx, lacp_port->tdport))
+		return 0;
+
+	if (!marker_pdu_check(marker)) {
+		teamd_log_warn("malformed Marker PDU came.");
+		return 0;
+	}
+
+	/* No Markers are sent, so responses are not expected. */
+	if (marker->tlv_type == MARKER_TLV_INFO)
+		return marker_pdu_respond(lacp_port, marker);
+	return 0;
+}
+
+static int slow_pdu_process(struct lacp_port *lacp_port, union slow_pdu *pdu)
+{
+	if (pdu->marker.subtype == 0x02)
+		return marker_pdu_process(lacp_port, &pdu->marker);
+	return lacpdu_process(lacp_port, &pdu->lacpdu);
+}
+
+static int lacpdu_packet_process(struct teamd_packet *packet, void *priv)
+{
+	if (packet->len < sizeof(union slow_pdu))
+		return 0;
+	return slow_pdu_process(priv, packet->data);
+}
+
+static int lacpdu_recv(struct lacp_port *lacp_port)
+{
+	union slow_pdu pdu;
+
+	return teamd_packet_recv(lacp_port->sock, &lacp_port->ring,
+				 &pdu, sizeof(pdu), 1,
+				 lacpdu_packet_process, lacp_port);
+}
+
+/* Upper bound of ports handled in one go so other callbacks get a chance */
+#define LACP_RX_BATCH 64
+
+/* Receives one PDU on every port socket which has some */
+static int lacp_shared_recv(struct lacp *lacp)
+{
+	struct epoll_event evs[LACP_RX_BATCH];
+	int first_err = 0;
+	int nevs;
+	int err;
+	int i;
+
+	nevs = epoll_wait(lacp->rx_epfd, evs, LACP_RX_BATCH, 0);
+	if (nevs == -1) {
+		if (errno == EINTR)
+			return 0;
+		teamd_log_err("epoll_wait() failed.");
+		return -errno;
+	}
+	for (i = 0; i < nevs; i++) {
+		err = lacpdu_recv(evs[i].data.ptr);
+		if (err && !first_err)
+			first_err = err;
+	}
+	return first_err;
+}
+
+static int lacp_port_rx_epoll_add(struct lacp_port *lacp_port)
+{
+	struct epoll_event ev;
+	int ret;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = lacp_port;
+	ret = epoll_ctl(lacp_port->lacp->rx_epfd, EPOLL_CTL_ADD,
+			lacp_port->sock, &ev);
+	if (ret == -1) {
+		teamd_log_err("%s: Failed to add socket to LACP epoll fd.",
+			      lacp_port->tdport->ifname);
+		return -errno;
+	}
+	return 0;
+}
+
+static void lacp_port_rx_epoll_del(struct lacp_port *lacp_port)
+{
+	epoll_ctl(lacp_port->lacp->rx_epfd, EPOLL_CTL_DEL,
+		  lacp_port->sock, NULL);
+}
+
 static int lacp_callback_timeout(struct teamd_context *ctx, int events,
 				 void *priv)
 {
@@ -1143,7 +1474,8 @@ static int lacp_callback_periodic(struct teamd_context *ctx, int events,
 	struct lacp_port *lacp_port = priv;
 
 	lacp_port_actor_update(lacp_port);
-	return lacpdu_send(lacp_port);
+	lacpdu_send_queue(lacp_port);
+	return 0;
 }
 
 static int lacp_callback_socket(struct teamd_context *ctx, int events,
@@ -1154,6 +1486,14 @@ static int lacp_callback_socket(struct teamd_context *ctx, int events,
 	return lacpdu_recv(lacp_port);
 }
 
+static int lacp_callback_shared_socket(struct teamd_context *ctx, int events,
+				       void *priv)
+{
+	struct lacp *lacp = priv;
+
+	return lacp_shared_recv(lacp);
+}
+
 static int lacp_port_set_mac(struct teamd_context *ctx,
 			     struct teamd_port *tdport)
 {
@@ -1230,8 +1570,16 @@ static int lacp_port_added(struct teamd_context *ctx,
 		teamd_log_err("Failed to load port config.");
 		return err;
 	}
+	lacp_port_tx_init(lacp_port);
 
-	err = teamd_packet_sock_open_type(SOCK_RAW, &lacp_port->sock,
+	/*
+	 * Team driver passes slow protocol frames of disabled ports only
+	 * to sockets bound exactly to the port, so there is one per port
+	 * even if they are polled through the shared epoll fd.
+	 */
+	err = teamd_packet_sock_open_ring(SOCK_RAW, &lacp_port->sock,
+					  ctx->pkt_rx_ring ?
+					  &lacp_port->ring : NULL,
 					  tdport->ifindex,
 					  htons(ETH_P_SLOW), NULL, NULL);
 	if (err)
@@ -1241,13 +1589,16 @@ static int lacp_port_added(struct teamd_context *ctx,
 	if (err)
 		goto close_sock;
 
-	err = teamd_loop_callback_fd_add(ctx, LACP_SOCKET_CB_NAME, lacp_port,
-					 lacp_callback_socket,
-					 lacp_port->sock,
-					 TEAMD_LOOP_FD_EVENT_READ);
-	if (err) {
-		teamd_log_err("Failed add socket callback.");
-		goto slow_addr_del;
+	if (lacp->rx_epfd == -1) {
+		err = teamd_loop_callback_fd_add(ctx, LACP_SOCKET_CB_NAME,
+						 lacp_port,
+						 lacp_callback_socket,
+						 lacp_port->sock,
+						 TEAMD_LOOP_FD_EVENT_READ);
+		if (err) {
+			teamd_log_err("Failed add socket callback.");
+			goto slow_addr_del;
+		}
 	}
 
 	err = teamd_loop_callback_timer_add(ctx, LACP_PERIODIC_CB_NAME,
@@ -1282,7 +1633,13 @@ static int lacp_port_added(struct teamd_context *ctx,
 	lacp_port_actor_init(lacp_port);
 	lacp_port_link_update(lacp_port);
 
-	teamd_loop_callback_enable(ctx, LACP_SOCKET_CB_NAME, lacp_port);
+	if (lacp->rx_epfd == -1) {
+		teamd_loop_callback_enable(ctx, LACP_SOCKET_CB_NAME, lacp_port);
+	} else {
+		err = lacp_port_rx_epoll_add(lacp_port);
+		if (err)
+			goto timeout_callback_del;
+	}
 	return 0;
 
 timeout_callback_del:
@@ -1290,10 +1647,12 @@ timeout_callback_del:
 periodic_callback_del:
 	teamd_loop_callback_del(ctx, LACP_PERIODIC_CB_NAME, lacp_port);
 socket_callback_del:
-	teamd_loop_callback_del(ctx, LACP_SOCKET_CB_NAME, lacp_port);
+	if (lacp->rx_epfd == -1)
+		teamd_loop_callback_del(ctx, LACP_SOCKET_CB_NAME, lacp_port);
 slow_addr_del:
 	slow_addr_del(lacp_port);
 close_sock:
+	teamd_packet_ring_teardown(&lacp_port->ring);
 	close(lacp_port->sock);
 	return err;
 }
@@ -1303,12 +1662,19 @@ static void lacp_port_removed(struct teamd_context *ctx,
 			      void *priv, void *creator_priv)
 {
 	struct lacp_port *lacp_port = priv;
+	struct lacp *lacp = creator_priv;
 
 	lacp_port_set_state(lacp_port, PORT_STATE_DISABLED);
+	if (!list_empty(&lacp_port->tx_list))
+		list_del(&lacp_port->tx_list);
 	teamd_loop_callback_del(ctx, LACP_TIMEOUT_CB_NAME, lacp_port);
 	teamd_loop_callback_del(ctx, LACP_PERIODIC_CB_NAME, lacp_port);
-	teamd_loop_callback_del(ctx, LACP_SOCKET_CB_NAME, lacp_port);
 	slow_addr_del(lacp_port);
+	if (lacp->rx_epfd == -1)
+		teamd_loop_callback_del(ctx, LACP_SOCKET_CB_NAME, lacp_port);
+	else
+		lacp_port_rx_epoll_del(lacp_port);
+	teamd_packet_ring_teardown(&lacp_port->ring);
 	close(lacp_port->sock);
 }
 
@@ -1482,6 +1848,26 @@ static int lacp_state_fast_rate_get(struct teamd_context *ctx,
 	return 0;
 }
 
+static int lacp_state_fast_rate_interval_get(struct teamd_context *ctx,
+					     struct team_state_gsc *gsc,
+					     void *priv)
+{
+	struct lacp *lacp = priv;
+
+	gsc->data.int_val = lacp->cfg.fast_rate_interval;
+	return 0;
+}
+
+static int lacp_state_timeout_multiplier_get(struct teamd_context *ctx,
+					     struct team_state_gsc *gsc,
+					     void *priv)
+{
+	struct lacp *lacp = priv;
+
+	gsc->data.int_val = lacp->cfg.timeout_mul;
+	return 0;
+}
+
 static int lacp_state_select_policy_get(struct teamd_context *ctx,
 					struct team_state_gsc *gsc,
 					void *priv)
@@ -1508,6 +1894,16 @@ static const struct teamd_state_val lacp_state_vals[] = {
 		.type = TEAMD_STATE_ITEM_TYPE_BOOL,
 		.getter = lacp_state_fast_rate_get,
 	},
+	{
+		.subpath = "fast_rate_interval",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = lacp_state_fast_rate_interval_get,
+	},
+	{
+		.subpath = "timeout_multiplier",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = lacp_state_timeout_multiplier_get,
+	},
 	{
 		.subpath = "select_policy",
 		.type = TEAMD_STATE_ITEM_TYPE_STRING,
@@ -1875,6 +2271,61 @@ static const struct teamd_state_val lacp_state_vg = {
 	.vals_count = ARRAY_SIZE(lacp_state_vgs),
 };
 
+#define LACP_SHARED_SOCKET_CB_NAME "lacp_shared_socket"
+
+static int lacp_rx_epoll_open(struct teamd_context *ctx, struct lacp *lacp)
+{
+	int err;
+
+	lacp->rx_epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (lacp->rx_epfd == -1) {
+		teamd_log_err("Failed to create LACP epoll fd.");
+		return -errno;
+	}
+	err = teamd_loop_callback_fd_add(ctx, LACP_SHARED_SOCKET_CB_NAME, lacp,
+					 lacp_callback_shared_socket,
+					 lacp->rx_epfd,
+					 TEAMD_LOOP_FD_EVENT_READ);
+	if (err) {
+		teamd_log_err("Failed add shared socket callback.");
+		close(lacp->rx_epfd);
+		lacp->rx_epfd = -1;
+		return err;
+	}
+	teamd_loop_callback_enable(ctx, LACP_SHARED_SOCKET_CB_NAME, lacp);
+	return 0;
+}
+
+static int lacp_socks_open(struct teamd_context *ctx, struct lacp *lacp)
+{
+	int err;
+
+	lacp->rx_epfd = -1;
+	if (lacp->cfg.shared_socket) {
+		err = lacp_rx_epoll_open(ctx, lacp);
+		if (err)
+			return err;
+	}
+	/*
+	 * Protocol 0 makes the socket transmit only, LACPDUs are still
+	 * received on per-port sockets.
+	 */
+	lacp->tx_sock = socket(PF_PACKET, SOCK_RAW, 0);
+	if (lacp->tx_sock == -1)
+		teamd_log_warn("Failed to create shared LACPDU socket, falling back to per-port sockets.");
+	return 0;
+}
+
+static void lacp_socks_close(struct teamd_context *ctx, struct lacp *lacp)
+{
+	if (lacp->rx_epfd != -1) {
+		teamd_loop_callback_del(ctx, LACP_SHARED_SOCKET_CB_NAME, lacp);
+		close(lacp->rx_epfd);
+	}
+	if (lacp->tx_sock != -1)
+		close(lacp->tx_sock);
+}
+
 static int lacp_init(struct teamd_context *ctx, void *priv)
 {
 	struct lacp *lacp = priv;
@@ -1886,23 +2337,28 @@ static int lacp_init(struct teamd_context *ctx, void *priv)
 	}
 
 	lacp->ctx = ctx;
+	list_init(&lacp->tx_list);
+	teamd_workq_init_work(&lacp->tx_workq, lacp_tx_flush);
 	err = teamd_hash_func_set(ctx);
 	if (err)
 		return err;
 	err = lacp_load_config(ctx, lacp);
 	if (err) {
 		teamd_log_err("Failed to load config values.");
-		return err;
+		goto hash_func_unset;
 	}
 	err = lacp_carrier_init(ctx, lacp);
 	if (err) {
 		teamd_log_err("Failed to initialize carrier.");
-		return err;
+		goto hash_func_unset;
 	}
+	err = lacp_socks_open(ctx, lacp);
+	if (err)
+		goto hash_func_unset;
 	err = teamd_event_watch_register(ctx, &lacp_event_watch_ops, lacp);
 	if (err) {
 		teamd_log_err("Failed to register event watch.");
-		return err;
+		goto socks_close;
 	}
 	err = teamd_balancer_init(ctx, &lacp->tb);
 	if (err) {
@@ -1920,6 +2376,10 @@ balancer_fini:
 	teamd_balancer_fini(lacp->tb);
 event_watch_unregister:
 	teamd_event_watch_unregister(ctx, &lacp_event_watch_ops, lacp);
+socks_close:
+	lacp_socks_close(ctx, lacp);
+hash_func_unset:
+	teamd_hash_func_unset(ctx);
 	return err;
 }
 
@@ -1931,6 +2391,9 @@ static void lacp_fini(struct teamd_context *ctx, void *priv)
 	teamd_balancer_fini(lacp->tb);
 	teamd_event_watch_unregister(ctx, &lacp_event_watch_ops, lacp);
 	lacp_carrier_fini(ctx, lacp);
+	teamd_workq_cancel_work(&lacp->tx_workq);
+	lacp_socks_close(ctx, lacp);
+	teamd_hash_func_unset(ctx);
 }
 
 const struct teamd_runner teamd_runner_lacp = {
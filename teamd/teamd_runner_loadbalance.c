@@ -128,7 +128,7 @@ static int lb_init(struct teamd_context *ctx, void *priv)
 	err = teamd_event_watch_register(ctx, &lb_port_watch_ops, lb);
 	if (err) {
 		teamd_log_err("Failed to register event watch.");
-		return err;
+		goto hash_func_unset;
 	}
 	err = teamd_balancer_init(ctx, &lb->tb);
 	if (err) {
@@ -138,6 +138,8 @@ static int lb_init(struct teamd_context *ctx, void *priv)
 	return 0;
 event_watch_unregister:
 	teamd_event_watch_unregister(ctx, &lb_port_watch_ops, lb);
+hash_func_unset:
+	teamd_hash_func_unset(ctx);
 	return err;
 }
 
@@ -147,6 +149,7 @@ static void lb_fini(struct teamd_context *ctx, void *priv)
 
 	teamd_balancer_fini(lb->tb);
 	teamd_event_watch_unregister(ctx, &lb_port_watch_ops, lb);
+	teamd_hash_func_unset(ctx);
 }
 
 const struct teamd_runner teamd_runner_loadbalance = {
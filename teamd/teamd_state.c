@@ -559,6 +559,41 @@ static const struct teamd_state_val ifinfo_state_vals[] = {
 	},
 };
 
+static int ifinfo_events_state_requery_count_get(struct teamd_context *ctx,
+						 struct team_state_gsc *gsc,
+						 void *priv)
+{
+	uint32_t requery_count;
+
+	team_get_ifinfo_event_stats(ctx->th, &requery_count, NULL);
+	gsc->data.int_val = requery_count;
+	return 0;
+}
+
+static int ifinfo_events_state_requery_avoided_count_get(struct teamd_context *ctx,
+							 struct team_state_gsc *gsc,
+							 void *priv)
+{
+	uint32_t requery_avoided_count;
+
+	team_get_ifinfo_event_stats(ctx->th, NULL, &requery_avoided_count);
+	gsc->data.int_val = requery_avoided_count;
+	return 0;
+}
+
+static const struct teamd_state_val ifinfo_events_state_vals[] = {
+	{
+		.subpath = "requery_count",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = ifinfo_events_state_requery_count_get,
+	},
+	{
+		.subpath = "requery_avoided_count",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = ifinfo_events_state_requery_avoided_count_get,
+	},
+};
+
 static int port_link_state_up_get(struct teamd_context *ctx,
 				  struct team_state_gsc *gsc,
 				  void *priv)
@@ -734,6 +769,11 @@ static const struct teamd_state_val state_vgs[] = {
 		.vals = ifinfo_state_vals,
 		.vals_count = ARRAY_SIZE(ifinfo_state_vals),
 	},
+	{
+		.subpath = "team_device.ifinfo_events",
+		.vals = ifinfo_events_state_vals,
+		.vals_count = ARRAY_SIZE(ifinfo_events_state_vals),
+	},
 	{
 		.subpath = "ifinfo",
 		.vals = ifinfo_state_vals,
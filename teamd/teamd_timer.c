@@ -0,0 +1,385 @@
+/*
+ *   teamd_timer.c - Teamd timer wheel
+ *   Copyright (C) 2026 agent <agent@local>
+ *
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <sys/timerfd.h>
+#include <private/list.h>
+#include <private/misc.h>
+
+#include "teamd.h"
+#include "teamd_timer.h"
+
+/*
+ * Timer wheel consists of TEAMD_TIMER_LVL_DEPTH levels, each having
+ * TEAMD_TIMER_LVL_SIZE slots. Level 0 slot covers one tick, level 1 slot
+ * covers TEAMD_TIMER_LVL_SIZE ticks and so on. Timers from higher level
+ * slots are cascaded to lower levels once their slot is reached. Per-level
+ * bitmaps of occupied slots allow to find the next tick where something
+ * needs to be done without walking the slots.
+ */
+#define TEAMD_TIMER_LVL_BITS		6
+#define TEAMD_TIMER_LVL_SIZE		(1 << TEAMD_TIMER_LVL_BITS)
+#define TEAMD_TIMER_LVL_MASK		(TEAMD_TIMER_LVL_SIZE - 1)
+#define TEAMD_TIMER_LVL_DEPTH		4
+#define TEAMD_TIMER_LVL_SHIFT(lvl)	((lvl) * TEAMD_TIMER_LVL_BITS)
+#define TEAMD_TIMER_MAX_DELTA \
+	((1ULL << TEAMD_TIMER_LVL_SHIFT(TEAMD_TIMER_LVL_DEPTH)) - 1)
+#define TEAMD_TIMER_NONE		UINT64_MAX
+
+struct teamd_timer_wheel {
+	int fd;
+	uint64_t base; /* last processed tick */
+	uint64_t armed; /* tick timerfd is armed for */
+	uint64_t occupied[TEAMD_TIMER_LVL_DEPTH];
+	struct list_item vec[TEAMD_TIMER_LVL_DEPTH * TEAMD_TIMER_LVL_SIZE];
+	struct list_item expired_list;
+};
+
+static uint64_t teamd_timer_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t timespec_to_ns(const struct timespec *ts)
+{
+	return (uint64_t) ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+}
+
+static bool teamd_timer_wheel_empty(struct teamd_timer_wheel *tw)
+{
+	int lvl;
+
+	for (lvl = 0; lvl < TEAMD_TIMER_LVL_DEPTH; lvl++)
+		if (tw->occupied[lvl])
+			return false;
+	return list_empty(&tw->expired_list);
+}
+
+static void teamd_timer_enqueue(struct teamd_timer_wheel *tw,
+				struct teamd_timer *timer)
+{
+	uint64_t expires = timer->expires;
+	uint64_t delta;
+	unsigned int lvl;
+	unsigned int idx;
+
+	if (expires <= tw->base) {
+		timer->head = &tw->expired_list;
+		list_add_tail(timer->head, &timer->list);
+		return;
+	}
+	delta = expires - tw->base;
+	if (delta > TEAMD_TIMER_MAX_DELTA) {
+		/* Will be cascaded to the top level again later. */
+		delta = TEAMD_TIMER_MAX_DELTA;
+		expires = tw->base + delta;
+	}
+	for (lvl = 0; lvl < TEAMD_TIMER_LVL_DEPTH - 1; lvl++)
+		if (delta < (1ULL << TEAMD_TIMER_LVL_SHIFT(lvl + 1)))
+			break;
+	idx = (expires >> TEAMD_TIMER_LVL_SHIFT(lvl)) & TEAMD_TIMER_LVL_MASK;
+	timer->head = &tw->vec[lvl * TEAMD_TIMER_LVL_SIZE + idx];
+	list_add_tail(timer->head, &timer->list);
+	tw->occupied[lvl] |= 1ULL << idx;
+}
+
+static void teamd_timer_dequeue(struct teamd_timer_wheel *tw,
+				struct teamd_timer *timer)
+{
+	unsigned int i;
+
+	if (!timer->head)
+		return;
+	list_del(&timer->list);
+	list_init(&timer->list);
+	if (timer->head != &tw->expired_list && list_empty(timer->head)) {
+		i = timer->head - tw->vec;
+		tw->occupied[i / TEAMD_TIMER_LVL_SIZE] &=
+			~(1ULL << (i % TEAMD_TIMER_LVL_SIZE));
+	}
+	timer->head = NULL;
+}
+
+/*
+ * Returns the nearest tick after base where either some level 0 slot
+ * expires or some non-empty higher level slot needs to be cascaded.
+ */
+static uint64_t teamd_timer_wheel_next(struct teamd_timer_wheel *tw)
+{
+	uint64_t next = TEAMD_TIMER_NONE;
+	uint64_t block;
+	uint64_t occ;
+	uint64_t tick;
+	unsigned int rot;
+	int lvl;
+
+	for (lvl = 0; lvl < TEAMD_TIMER_LVL_DEPTH; lvl++) {
+		occ = tw->occupied[lvl];
+		if (!occ)
+			continue;
+		block = (tw->base >> TEAMD_TIMER_LVL_SHIFT(lvl)) + 1;
+		rot = block & TEAMD_TIMER_LVL_MASK;
+		occ = (occ >> rot) | (occ << ((TEAMD_TIMER_LVL_SIZE - rot) &
+					      TEAMD_TIMER_LVL_MASK));
+		tick = (block + __builtin_ctzll(occ)) <<
+		       TEAMD_TIMER_LVL_SHIFT(lvl);
+		if (tick < next)
+			next = tick;
+	}
+	return next;
+}
+
+static void teamd_timer_wheel_move_slot(struct teamd_timer_wheel *tw,
+					unsigned int lvl, unsigned int idx)
+{
+	struct list_item *head = &tw->vec[lvl * TEAMD_TIMER_LVL_SIZE + idx];
+	struct teamd_timer *timer;
+	struct teamd_timer *tmp;
+	struct list_item tmp_list;
+
+	list_init(&tmp_list);
+	list_move_nodes(&tmp_list, head);
+	tw->occupied[lvl] &= ~(1ULL << idx);
+	list_for_each_node_entry_safe(timer, tmp, &tmp_list, list) {
+		list_del(&timer->list);
+		teamd_timer_enqueue(tw, timer);
+	}
+}
+
+static void teamd_timer_wheel_run(struct teamd_timer_wheel *tw, uint64_t now)
+{
+	uint64_t next;
+	int lvl;
+
+	while ((next = teamd_timer_wheel_next(tw)) <= now) {
+		tw->base = next;
+		for (lvl = TEAMD_TIMER_LVL_DEPTH - 1; lvl > 0; lvl--) {
+			if (next & ((1ULL << TEAMD_TIMER_LVL_SHIFT(lvl)) - 1))
+				continue;
+			teamd_timer_wheel_move_slot(tw, lvl,
+				(next >> TEAMD_TIMER_LVL_SHIFT(lvl)) &
+				TEAMD_TIMER_LVL_MASK);
+		}
+		/* Base is now equal to expiry, so all go to expired_list. */
+		teamd_timer_wheel_move_slot(tw, 0, next & TEAMD_TIMER_LVL_MASK);
+	}
+	if (now > tw->base)
+		tw->base = now;
+}
+
+static int teamd_timer_wheel_arm(struct teamd_timer_wheel *tw, uint64_t tick)
+{
+	struct itimerspec its;
+	uint64_t ns;
+
+	if (tick == TEAMD_TIMER_NONE || (tw->armed && tw->armed <= tick))
+		return 0;
+	/* Zero it_value would disarm the timer. */
+	ns = tick ? tick * TEAMD_TIMER_TICK_NS : 1;
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = ns / 1000000000ULL;
+	its.it_value.tv_nsec = ns % 1000000000ULL;
+	if (timerfd_settime(tw->fd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+		teamd_log_err("Failed to set timerfd.");
+		return -errno;
+	}
+	tw->armed = tick;
+	return 0;
+}
+
+static int teamd_timer_wheel_callback(struct teamd_context *ctx, int events,
+				      void *priv)
+{
+	struct teamd_timer_wheel *tw = ctx->timer_wheel;
+	struct teamd_timer *timer;
+	struct list_item expired_list;
+	uint64_t exp;
+	ssize_t ret;
+
+	ret = read(tw->fd, &exp, sizeof(exp));
+	if (ret == -1 && errno != EINTR && errno != EAGAIN) {
+		teamd_log_err("read() failed.");
+		return -errno;
+	}
+	tw->armed = 0;
+	teamd_timer_wheel_run(tw, teamd_timer_now_ns() / TEAMD_TIMER_TICK_NS);
+
+	/*
+	 * Timers which expire again while calling the functions will be
+	 * handled in the next round.
+	 */
+	list_init(&expired_list);
+	list_move_nodes(&expired_list, &tw->expired_list);
+	while (!list_empty(&expired_list)) {
+		timer = list_get_node_entry(expired_list.next,
+					    struct teamd_timer, list);
+		list_del(&timer->list);
+		list_init(&timer->list);
+		timer->head = NULL;
+		timer->func(ctx, timer);
+	}
+
+	if (!list_empty(&tw->expired_list))
+		return teamd_timer_wheel_arm(tw, tw->base);
+	return teamd_timer_wheel_arm(tw, teamd_timer_wheel_next(tw));
+}
+
+static int teamd_timer_add_tick(struct teamd_context *ctx,
+				struct teamd_timer *timer, uint64_t expires)
+{
+	struct teamd_timer_wheel *tw = ctx->timer_wheel;
+
+	teamd_timer_dequeue(tw, timer);
+	/* There is nothing to process in between, so fast forward. */
+	if (teamd_timer_wheel_empty(tw))
+		tw->base = teamd_timer_now_ns() / TEAMD_TIMER_TICK_NS;
+	timer->expires = expires;
+	teamd_timer_enqueue(tw, timer);
+	return teamd_timer_wheel_arm(tw, expires > tw->base ? expires : tw->base);
+}
+
+void teamd_timer_init(struct teamd_timer *timer, teamd_timer_func_t func)
+{
+	list_init(&timer->list);
+	timer->head = NULL;
+	timer->func = func;
+}
+
+/*
+ * Schedules the timer to expire after delay. NULL delay means to expire
+ * as soon as possible. In case the timer is already pending, it is
+ * rescheduled.
+ */
+int teamd_timer_add(struct teamd_context *ctx, struct teamd_timer *timer,
+		    const struct timespec *delay)
+{
+	uint64_t ns = teamd_timer_now_ns();
+
+	if (delay)
+		ns += timespec_to_ns(delay);
+	return teamd_timer_add_tick(ctx, timer, (ns + TEAMD_TIMER_TICK_NS - 1) /
+						TEAMD_TIMER_TICK_NS);
+}
+
+/*
+ * Reschedules expired periodic timer one interval after its last expiry,
+ * skipping the periods which were already missed.
+ */
+int teamd_timer_forward(struct teamd_context *ctx, struct teamd_timer *timer,
+			const struct timespec *interval)
+{
+	uint64_t now = teamd_timer_now_ns() / TEAMD_TIMER_TICK_NS;
+	uint64_t ticks;
+	uint64_t expires;
+	uint64_t missed;
+
+	ticks = (timespec_to_ns(interval) + TEAMD_TIMER_TICK_NS - 1) /
+		TEAMD_TIMER_TICK_NS;
+	if (!ticks)
+		ticks = 1;
+	expires = timer->expires + ticks;
+	if (expires <= now) {
+		missed = (now - expires) / ticks + 1;
+		teamd_log_warn("some periodic function calls missed (%" PRIu64 ")",
+			       missed);
+		expires += missed * ticks;
+	}
+	return teamd_timer_add_tick(ctx, timer, expires);
+}
+
+/*
+ * Reschedules expired periodic timer to the next multiple of interval.
+ * Timers forwarded this way with the same interval expire in the same tick.
+ */
+int teamd_timer_forward_aligned(struct teamd_context *ctx,
+				struct teamd_timer *timer,
+				const struct timespec *interval)
+{
+	uint64_t now = teamd_timer_now_ns() / TEAMD_TIMER_TICK_NS;
+	uint64_t ticks;
+
+	ticks = (timespec_to_ns(interval) + TEAMD_TIMER_TICK_NS - 1) /
+		TEAMD_TIMER_TICK_NS;
+	if (!ticks)
+		ticks = 1;
+	return teamd_timer_add_tick(ctx, timer, (now / ticks + 1) * ticks);
+}
+
+void teamd_timer_del(struct teamd_context *ctx, struct teamd_timer *timer)
+{
+	teamd_timer_dequeue(ctx->timer_wheel, timer);
+}
+
+#define TIMER_WHEEL_CB_NAME "timer_wheel"
+
+int teamd_timer_wheel_init(struct teamd_context *ctx)
+{
+	struct teamd_timer_wheel *tw;
+	int err;
+	int i;
+
+	tw = myzalloc(sizeof(*tw));
+	if (!tw)
+		return -ENOMEM;
+	for (i = 0; i < ARRAY_SIZE(tw->vec); i++)
+		list_init(&tw->vec[i]);
+	list_init(&tw->expired_list);
+	tw->base = teamd_timer_now_ns() / TEAMD_TIMER_TICK_NS;
+	tw->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (tw->fd < 0) {
+		teamd_log_err("Failed to create timerfd.");
+		err = -errno;
+		goto free_tw;
+	}
+	ctx->timer_wheel = tw;
+
+	err = teamd_loop_callback_fd_add(ctx, TIMER_WHEEL_CB_NAME, ctx,
+					 teamd_timer_wheel_callback, tw->fd,
+					 TEAMD_LOOP_FD_EVENT_READ);
+	if (err) {
+		teamd_log_err("Failed add timer wheel callback.");
+		goto close_fd;
+	}
+	teamd_loop_callback_enable(ctx, TIMER_WHEEL_CB_NAME, ctx);
+	return 0;
+
+close_fd:
+	ctx->timer_wheel = NULL;
+	close(tw->fd);
+free_tw:
+	free(tw);
+	return err;
+}
+
+void teamd_timer_wheel_fini(struct teamd_context *ctx)
+{
+	struct teamd_timer_wheel *tw = ctx->timer_wheel;
+
+	teamd_loop_callback_del(ctx, TIMER_WHEEL_CB_NAME, ctx);
+	close(tw->fd);
+	free(tw);
+	ctx->timer_wheel = NULL;
+}
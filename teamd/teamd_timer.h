@@ -0,0 +1,61 @@
+/*
+ *   teamd_timer.h - Teamd timer wheel
+ *   Copyright (C) 2026 agent <agent@local>
+ *
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _TEAMD_TIMER_H_
+#define _TEAMD_TIMER_H_
+
+#include <stdint.h>
+#include <time.h>
+
+#include "teamd.h"
+
+/*
+ * All timers are driven by a single timerfd. Expiry times are kept in
+ * a hierarchical timer wheel with granularity of TEAMD_TIMER_TICK_NS.
+ */
+#define TEAMD_TIMER_TICK_NS	1000000ULL
+
+struct teamd_timer;
+typedef void (*teamd_timer_func_t)(struct teamd_context *ctx,
+				   struct teamd_timer *timer);
+struct teamd_timer {
+	struct list_item list;
+	struct list_item *head;
+	uint64_t expires; /* in ticks */
+	teamd_timer_func_t func;
+};
+
+int teamd_timer_wheel_init(struct teamd_context *ctx);
+void teamd_timer_wheel_fini(struct teamd_context *ctx);
+void teamd_timer_init(struct teamd_timer *timer, teamd_timer_func_t func);
+int teamd_timer_add(struct teamd_context *ctx, struct teamd_timer *timer,
+		    const struct timespec *delay);
+int teamd_timer_forward(struct teamd_context *ctx, struct teamd_timer *timer,
+			const struct timespec *interval);
+int teamd_timer_forward_aligned(struct teamd_context *ctx,
+				struct teamd_timer *timer,
+				const struct timespec *interval);
+void teamd_timer_del(struct teamd_context *ctx, struct teamd_timer *timer);
+
+static inline bool teamd_timer_pending(struct teamd_timer *timer)
+{
+	return timer->head;
+}
+
+#endif /* _TEAMD_TIMER_H_ */
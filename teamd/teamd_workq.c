@@ -33,6 +33,7 @@ static int teamd_workq_callback_socket(struct teamd_context *ctx, int events,
 	struct teamd_workq *workq;
 	struct teamd_workq *tmp;
 	char bytes[16];
+	int first_err = 0;
 	int ret;
 	int err;
 
@@ -50,11 +51,14 @@ again:
 	list_for_each_node_entry_safe(workq, tmp, &ctx->workq.work_list, list) {
 		list_del(&workq->list);
 		list_init(&workq->list);
+		/* Run the rest anyway, callback is disabled by now so
+		 * anything left on the list would wait for next schedule.
+		 */
 		err = workq->func(ctx, workq);
-		if (err)
-			return err;
+		if (err && !first_err)
+			first_err = err;
 	}
-	return 0;
+	return first_err;
 }
 
 int teamd_workq_init(struct teamd_context *ctx)
@@ -120,6 +124,14 @@ void teamd_workq_schedule_work(struct teamd_context *ctx,
 	teamd_workq_set_for_process(ctx);
 }
 
+void teamd_workq_cancel_work(struct teamd_workq *workq)
+{
+	if (list_empty(&workq->list))
+		return;
+	list_del(&workq->list);
+	list_init(&workq->list);
+}
+
 void teamd_workq_init_work(struct teamd_workq *workq, teamd_workq_func_t func)
 {
 	workq->func = func;
@@ -34,6 +34,7 @@ int teamd_workq_init(struct teamd_context *ctx);
 void teamd_workq_fini(struct teamd_context *ctx);
 void teamd_workq_schedule_work(struct teamd_context *ctx,
 			       struct teamd_workq *workq);
+void teamd_workq_cancel_work(struct teamd_workq *workq);
 void teamd_workq_init_work(struct teamd_workq *workq, teamd_workq_func_t func);
 
 #endif /* _TEAMD_WORKQ_H_ */